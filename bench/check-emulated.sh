@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# Check that synchronizing to an emulated MTP device stays within a fixed
+# budget of round trips and time.  A regression that adds a query per file
+# or serializes what used to overlap shows up here long before anyone tries
+# it on a real phone.
+#
+# Usage: check-emulated.sh, with $RUDGIOSYNC and $GENTREE naming the programs
+# (as `make check' does).  The check is skipped when rudgiosync was built
+# without --enable-emulation.
+#
+# The first run copies a small generated tree, the second finds nothing to do.
+
+set -e
+
+RUDGIOSYNC=${RUDGIOSYNC:-../src/rudgiosync}
+GENTREE=${GENTREE:-./gentree}
+CHECK_DIR=${CHECK_DIR:-check-work}
+
+# The budgets, with some room above what is currently needed.
+COPY_ROUND_TRIPS=64
+COPY_SECONDS=5
+NOOP_ROUND_TRIPS=10
+NOOP_SECONDS=2
+
+if ! "$RUDGIOSYNC" --help | grep -q -e --emulate-destination; then
+  echo "rudgiosync was built without emulation support, skipping."
+  exit 77
+fi
+
+rm -rf "$CHECK_DIR"
+mkdir -p "$CHECK_DIR/dst"
+"$GENTREE" --depth=1 --fanout=2 --files=3 --max-size=65536 "$CHECK_DIR/src" > /dev/null
+
+failed=0
+
+# Run a sync, and hold its round trips and wall time against the budget.
+check_run ()
+{
+  run=$1
+  round_trips=$2
+  seconds=$3
+
+  "$RUDGIOSYNC" --stats -q --emulate-destination=mtp "$CHECK_DIR/src/" "$CHECK_DIR/dst/" > "$CHECK_DIR/stats.txt"
+  if ! awk -v run="$run" -v round_trips="$round_trips" -v seconds="$seconds" '
+         $1 == "total" { sub (/s$/, "", $2); wall = $2 }
+         /^  Emulated round trips:/ { trips = $4 }
+         END {
+           printf "%-6s %d round trips (budget %d), %.3fs (budget %ds)\n", run, trips, round_trips, wall, seconds
+           exit (trips > round_trips || wall > seconds)
+         }
+       ' "$CHECK_DIR/stats.txt"; then
+    echo "$run: over budget." >&2
+    failed=1
+  fi
+}
+
+check_run copy $COPY_ROUND_TRIPS $COPY_SECONDS
+check_run no-op $NOOP_ROUND_TRIPS $NOOP_SECONDS
+
+rm -rf "$CHECK_DIR"
+exit $failed
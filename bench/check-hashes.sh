@@ -0,0 +1,11 @@
+#!/bin/sh
+#
+# Check the checksum module against known SHA-256 digests, fed in pieces of
+# awkward sizes and hashed from a file, without measuring its throughput.
+#
+# Usage: check-hashes.sh, with $HASHBENCH naming the program (as `make check'
+# does).
+
+HASHBENCH=${HASHBENCH:-./hashbench}
+
+exec "$HASHBENCH" --check
@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * A generator of synthetic directory trees, for benchmarking.
+ *
+ * The same options and seed always give the same tree, down to the contents
+ * and modification times of the files.
+ */
+
+#include "boiler.h"
+
+
+/* Modification times count up from here, a second per file. */
+#define GENTREE_EPOCH ((guint64) 1500000000)
+
+typedef struct
+{
+  const gchar *name;
+  gint         depth;
+  gint         fanout;
+  gint         files;
+  gint         min_size;
+  gint         max_size;
+} GentreeShape;
+
+static const GentreeShape gentree_shapes[] =
+{
+  /* name        depth  fanout  files   min-size  max-size */
+  { "balanced",  3,     4,      20,     1024,     256 * 1024 },
+  { "wide",      0,     0,      100000, 64,       4 * 1024 },
+  { "deep",      64,    1,      4,      4 * 1024, 64 * 1024 },
+  { NULL }
+};
+
+static gchar *opt_shape    = "balanced";
+static gint   opt_depth    = -1;
+static gint   opt_fanout   = -1;
+static gint   opt_files    = -1;
+static gint   opt_min_size = -1;
+static gint   opt_max_size = -1;
+static gint   opt_seed     = 1;
+
+static GOptionEntry opt_entries[] =
+{
+  { "shape",    0, 0, G_OPTION_ARG_STRING, &opt_shape,    "Start from the SHAPE: balanced, wide (a single directory of 100000 files) or deep (a chain of 64 directories)", "SHAPE" },
+  { "depth",    0, 0, G_OPTION_ARG_INT,    &opt_depth,    "Nest directories N levels below the top", "N" },
+  { "fanout",   0, 0, G_OPTION_ARG_INT,    &opt_fanout,   "Give each directory above the bottom level N subdirectories", "N" },
+  { "files",    0, 0, G_OPTION_ARG_INT,    &opt_files,    "Put N files in each directory", "N" },
+  { "min-size", 0, 0, G_OPTION_ARG_INT,    &opt_min_size, "Make files at least SIZE bytes large", "SIZE" },
+  { "max-size", 0, 0, G_OPTION_ARG_INT,    &opt_max_size, "Make files at most SIZE bytes large, sizes in between being spread evenly on a log scale", "SIZE" },
+  { "seed",     0, 0, G_OPTION_ARG_INT,    &opt_seed,     "Seed the random choices with N (default: 1)", "N" },
+  { NULL }
+};
+
+typedef struct
+{
+  GentreeShape  shape;
+  GRand        *rand;
+  gchar        *buffer;
+  guint64       files;
+  guint64       bytes;
+} Gentree;
+
+
+/* Small files are far more common than large ones, as in real trees, so pick
+   a power of two evenly first and then a size within it. */
+static gsize
+gentree_size (Gentree *tree)
+{
+  gint64 low = MAX (tree->shape.min_size, 1);
+  gint64 high = MAX (tree->shape.max_size, low);
+  gint64 bucket;
+  guint  low_bits = g_bit_storage (low);
+  guint  high_bits = g_bit_storage (high);
+
+  bucket = (gint64) 1 << (g_rand_int_range (tree->rand, low_bits, high_bits + 1) - 1);
+  bucket += g_rand_int_range (tree->rand, 0, bucket);
+  return CLAMP (bucket, low, high);
+}
+
+static gboolean
+gentree_file (Gentree *tree, const gchar *path, GError **error)
+{
+  GFile  *descriptor;
+  FILE   *stream;
+  gsize   size;
+  gsize   iter;
+  gint    errsv;
+
+  size = gentree_size (tree);
+  for (iter = 0; iter + sizeof (guint32) <= size; iter += sizeof (guint32))
+    *(guint32 *)(tree->buffer + iter) = g_rand_int (tree->rand);
+  for (; iter < size; iter++)
+    tree->buffer[iter] = (gchar) g_rand_int (tree->rand);
+
+  stream = fopen (path, "wb");
+  if (stream == NULL || fwrite (tree->buffer, 1, size, stream) != size || fclose (stream) != 0)
+    {
+      errsv = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Failed to write the file `%s': %s", path, g_strerror (errsv));
+      return FALSE;
+    }
+
+  descriptor = g_file_new_for_path (path);
+  g_file_set_attribute_uint64 (descriptor, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                               GENTREE_EPOCH + tree->files,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+  g_object_unref (descriptor);
+
+  tree->files++;
+  tree->bytes += size;
+  return TRUE;
+}
+
+static gboolean
+gentree_directory (Gentree *tree, const gchar *path, gint depth, GError **error)
+{
+  gchar   *child;
+  gboolean success = TRUE;
+  gint     iter;
+
+  if (g_mkdir_with_parents (path, 0755) != 0)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Failed to create the directory `%s': %s", path, g_strerror (errno));
+      return FALSE;
+    }
+
+  for (iter = 0; iter < tree->shape.files && success; iter++)
+    {
+      child = g_strdup_printf ("%s/file%05d", path, iter);
+      success = gentree_file (tree, child, error);
+      g_free (child);
+    }
+
+  for (iter = 0; depth < tree->shape.depth && iter < tree->shape.fanout && success; iter++)
+    {
+      child = g_strdup_printf ("%s/dir%03d", path, iter);
+      success = gentree_directory (tree, child, depth + 1, error);
+      g_free (child);
+    }
+
+  return success;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *opt_context;
+  Gentree         tree;
+  guint           iter;
+
+  GError *ierror = NULL;
+
+
+  opt_context = g_option_context_new ("<directory>");
+  g_option_context_set_summary (opt_context,
+                                "Generate a synthetic directory tree for benchmarking rudgiosync.  The same\n"
+                                "options always give the same tree.");
+  g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+  g_option_context_parse (opt_context, &argc, &argv, &ierror);
+  g_option_context_free (opt_context);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), ierror->message);
+      g_clear_error (&ierror);
+      return 1;
+    }
+  if (argc != 2)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "A single directory must be given");
+      return 1;
+    }
+
+  for (iter = 0; gentree_shapes[iter].name != NULL; iter++)
+    {
+      if (strcmp (gentree_shapes[iter].name, opt_shape) == 0)
+        break;
+    }
+  if (gentree_shapes[iter].name == NULL)
+    {
+      g_printerr ("%s: Command line option parsing failed: Unknown shape `%s'.\n", g_get_prgname (), opt_shape);
+      return 1;
+    }
+
+  tree.shape = gentree_shapes[iter];
+  if (opt_depth >= 0)
+    tree.shape.depth = opt_depth;
+  if (opt_fanout >= 0)
+    tree.shape.fanout = opt_fanout;
+  if (opt_files >= 0)
+    tree.shape.files = opt_files;
+  if (opt_min_size >= 0)
+    tree.shape.min_size = opt_min_size;
+  if (opt_max_size >= 0)
+    tree.shape.max_size = opt_max_size;
+  if (tree.shape.min_size > tree.shape.max_size)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (),
+                  "The minimum file size is above the maximum, give both --min-size and --max-size");
+      return 1;
+    }
+
+  tree.rand = g_rand_new_with_seed ((guint32) opt_seed);
+  tree.buffer = g_malloc (MAX (tree.shape.max_size, 1));
+  tree.files = 0;
+  tree.bytes = 0;
+
+  gentree_directory (&tree, argv[1], 0, &ierror);
+
+  g_free (tree.buffer);
+  g_rand_free (tree.rand);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: %s.\n", g_get_prgname (), ierror->message);
+      g_clear_error (&ierror);
+      return 1;
+    }
+
+  g_print ("%" G_GUINT64_FORMAT " files, %" G_GUINT64_FORMAT " bytes.\n", tree.files, tree.bytes);
+  return 0;
+}
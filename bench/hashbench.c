@@ -0,0 +1,345 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * A microbenchmark of the checksum module.
+ *
+ * Known SHA-256 vectors are checked first, fed in pieces of awkward sizes and
+ * read back from files, so that a faster hashing path can't quietly be a
+ * wrong one.  Then the throughput of hashing is measured at a range of chunk
+ * sizes, from memory with the module's hash and with GLib's for comparison,
+ * and from a file as --checksum would hash it.
+ */
+
+#include "boiler.h"
+#include "checksum.h"
+#include "buffers.h"
+
+#include <glib/gstdio.h>
+
+
+typedef struct
+{
+  const gchar *input;
+  gsize        repeat;        /* How many times the input is repeated. */
+  const gchar *digest;
+} HashbenchVector;
+
+static const HashbenchVector hashbench_vectors[] =
+{
+  { "",    1,       "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "abc", 1,       "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+                    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "a",   1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+  { NULL }
+};
+
+/* Pieces straddling the 64 byte blocks of SHA-256 every which way. */
+static const gsize hashbench_pieces[] = { 1, 3, 55, 56, 63, 64, 65, 4096, 1000000 };
+
+/* The chunk sizes hashed at. */
+static const gsize hashbench_chunks[] =
+{
+  4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024,
+  1024 * 1024, RUDGIOSYNC_TRANSFER_BUF_SIZE, 8 * 1024 * 1024
+};
+
+static gint     opt_size  = 256;
+static gboolean opt_check = FALSE;
+static gchar   *opt_dir   = NULL;
+
+static GOptionEntry opt_entries[] =
+{
+  { "size",  0, 0, G_OPTION_ARG_INT,      &opt_size,  "Hash N MiB of data per measurement (default: 256)", "N" },
+  { "check", 0, 0, G_OPTION_ARG_NONE,     &opt_check, "Only check the test vectors", NULL },
+  { "dir",   0, 0, G_OPTION_ARG_FILENAME, &opt_dir,   "Put the file hashed in DIRECTORY (default: the temporary directory)", "DIRECTORY" },
+  { NULL }
+};
+
+
+static gchar *
+hashbench_hex (RudgiosyncChecksum *checksum)
+{
+  GString *retval;
+  guint    iter;
+
+  retval = g_string_new (NULL);
+  for (iter = 0; iter < SHA256_DIGEST_SIZE; iter++)
+    g_string_append_printf (retval, "%02x", checksum->sha256_digest[iter]);
+
+  return g_string_free (retval, FALSE);
+}
+
+/* Compare a checksum against the expected digest, reporting a mismatch. */
+static gboolean
+hashbench_expect (const HashbenchVector *vector, const gchar *how, RudgiosyncChecksum *checksum)
+{
+  gchar   *digest;
+  gboolean retval;
+
+  digest = hashbench_hex (checksum);
+  retval = (strcmp (digest, vector->digest) == 0);
+  if (!retval)
+    g_printerr ("%s: SHA-256 of `%.16s' x %" G_GSIZE_FORMAT " %s is %s, expected %s.\n", g_get_prgname (),
+                vector->input, vector->repeat, how, digest, vector->digest);
+
+  g_free (digest);
+  return retval;
+}
+
+static gboolean
+hashbench_check_vectors (void)
+{
+  const HashbenchVector *vector;
+  RudgiosyncHashContext  context;
+  RudgiosyncChecksum     checksum;
+  RudgiosyncChecksum     first;
+  GString               *data;
+  GFile                 *descriptor;
+  gchar                 *path;
+  gchar                 *how;
+  gsize                  offset;
+  gsize                  piece;
+  guint                  iter;
+  gint                   fd;
+  gboolean               retval = TRUE;
+
+  GError *ierror = NULL;
+
+
+  for (vector = hashbench_vectors; vector->input != NULL; vector++)
+    {
+      data = g_string_new (NULL);
+      for (iter = 0; iter < vector->repeat; iter++)
+        g_string_append (data, vector->input);
+
+      for (piece = 0; piece < G_N_ELEMENTS (hashbench_pieces); piece++)
+        {
+          rudgiosync_hash_init (&context);
+          for (offset = 0; offset < data->len; offset += hashbench_pieces[piece])
+            rudgiosync_hash_data (&context, MIN (hashbench_pieces[piece], data->len - offset), data->str + offset);
+          rudgiosync_hash_finish (&context, &checksum);
+
+          how = g_strdup_printf ("in pieces of %" G_GSIZE_FORMAT, hashbench_pieces[piece]);
+          retval = hashbench_expect (vector, how, &checksum) && retval;
+          g_free (how);
+        }
+
+      /* The way --checksum goes about it, mapping the file if it can. */
+      fd = g_file_open_tmp ("hashbench-XXXXXX", &path, &ierror);
+      if (fd < 0 || !g_file_set_contents (path, data->str, data->len, &ierror))
+        {
+          g_printerr ("%s: Failed to write a test file: %s.\n", g_get_prgname (), ierror->message);
+          g_clear_error (&ierror);
+          retval = FALSE;
+        }
+      else
+        {
+          descriptor = g_file_new_for_path (path);
+          if (!rudgiosync_checksum_for_gfile (descriptor, &checksum, &ierror))
+            {
+              g_printerr ("%s: Failed to hash a test file: %s.\n", g_get_prgname (), ierror->message);
+              g_clear_error (&ierror);
+              retval = FALSE;
+            }
+          else
+            retval = hashbench_expect (vector, "from a file", &checksum) && retval;
+          g_object_unref (descriptor);
+        }
+      if (fd >= 0)
+        {
+          close (fd);
+          g_unlink (path);
+          g_free (path);
+        }
+
+      /* Every digest differs from every other, and not from itself. */
+      if (vector == hashbench_vectors)
+        first = checksum;
+      else if (!rudgiosync_checksums_differ (&first, &checksum))
+        {
+          g_printerr ("%s: Different digests were taken to be the same.\n", g_get_prgname ());
+          retval = FALSE;
+        }
+      if (rudgiosync_checksums_differ (&checksum, &checksum))
+        {
+          g_printerr ("%s: A digest was taken to differ from itself.\n", g_get_prgname ());
+          retval = FALSE;
+        }
+
+      g_string_free (data, TRUE);
+    }
+
+  return retval;
+}
+
+
+/* Megabytes (in the decimal sense) a second. */
+static gdouble
+hashbench_rate (guint64 bytes, gint64 start)
+{
+  gint64 elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  return (gdouble)bytes / elapsed;
+}
+
+static void
+hashbench_memory (const gchar *buffer, guint64 total)
+{
+  RudgiosyncHashContext context;
+  RudgiosyncChecksum    checksum;
+  GChecksum            *alternative;
+  guint64               done;
+  gint64                start;
+  gdouble               module_rate;
+  gsize                 chunk;
+  guint                 iter;
+
+  g_print ("%-22s %12s %12s\n", "Chunk size", "module", "GChecksum");
+  for (iter = 0; iter < G_N_ELEMENTS (hashbench_chunks); iter++)
+    {
+      chunk = hashbench_chunks[iter];
+
+      start = g_get_monotonic_time ();
+      rudgiosync_hash_init (&context);
+      for (done = 0; done < total; done += chunk)
+        rudgiosync_hash_data (&context, chunk, buffer);
+      rudgiosync_hash_finish (&context, &checksum);
+      module_rate = hashbench_rate (done, start);
+
+      start = g_get_monotonic_time ();
+      alternative = g_checksum_new (G_CHECKSUM_SHA256);
+      for (done = 0; done < total; done += chunk)
+        g_checksum_update (alternative, (const guchar *)buffer, chunk);
+      g_checksum_get_string (alternative);
+      g_checksum_free (alternative);
+
+      g_print ("%-22" G_GSIZE_FORMAT " %7.1f MB/s %7.1f MB/s\n", chunk, module_rate, hashbench_rate (done, start));
+    }
+}
+
+static gboolean
+hashbench_file (const gchar *buffer, guint64 total)
+{
+  RudgiosyncChecksum checksum;
+  GFile             *descriptor;
+  FILE              *stream;
+  gchar             *path;
+  guint64            done;
+  gint64             start;
+  gint               fd;
+  gboolean           retval;
+
+  GError *ierror = NULL;
+
+
+  if (opt_dir != NULL)
+    {
+      path = g_build_filename (opt_dir, "hashbench-XXXXXX", NULL);
+      fd = g_mkstemp (path);
+    }
+  else
+    fd = g_file_open_tmp ("hashbench-XXXXXX", &path, NULL);
+  stream = (fd >= 0) ? fdopen (fd, "wb") : NULL;
+
+  for (done = 0; stream != NULL && done < total; done += RUDGIOSYNC_TRANSFER_BUF_SIZE)
+    {
+      if (fwrite (buffer, 1, RUDGIOSYNC_TRANSFER_BUF_SIZE, stream) != RUDGIOSYNC_TRANSFER_BUF_SIZE)
+        break;
+    }
+  if (stream == NULL || done < total || fclose (stream) != 0)
+    {
+      g_printerr ("%s: Failed to write the file to hash: %s.\n", g_get_prgname (), g_strerror (errno));
+      if (fd >= 0)
+        g_unlink (path);
+      g_free (path);
+      return FALSE;
+    }
+
+  /* Once to bring it into the page cache, then for the measurement. */
+  descriptor = g_file_new_for_path (path);
+  retval = rudgiosync_checksum_for_gfile (descriptor, &checksum, &ierror);
+  start = g_get_monotonic_time ();
+  retval = retval && rudgiosync_checksum_for_gfile (descriptor, &checksum, &ierror);
+  if (retval)
+    g_print ("\n%-22s %7.1f MB/s\n", "From a cached file", hashbench_rate (done, start));
+  else
+    {
+      g_printerr ("%s: Failed to hash the file: %s.\n", g_get_prgname (), ierror->message);
+      g_clear_error (&ierror);
+    }
+
+  g_object_unref (descriptor);
+  g_unlink (path);
+  g_free (path);
+  return retval;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *opt_context;
+  GRand          *rand;
+  gchar          *buffer;
+  guint64         total;
+  gsize           largest;
+  gsize           iter;
+  gboolean        success;
+
+  GError *ierror = NULL;
+
+
+  opt_context = g_option_context_new (NULL);
+  g_option_context_set_summary (opt_context,
+                                "Check the checksum module against known SHA-256 digests, then measure how\n"
+                                "fast it hashes.");
+  g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+  g_option_context_parse (opt_context, &argc, &argv, &ierror);
+  g_option_context_free (opt_context);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), ierror->message);
+      g_clear_error (&ierror);
+      return 1;
+    }
+  if (opt_size <= 0)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The size must be positive");
+      return 1;
+    }
+
+  if (!hashbench_check_vectors ())
+    return 1;
+  g_print ("Test vectors: OK\n");
+  if (opt_check)
+    return 0;
+
+  largest = MAX (hashbench_chunks[G_N_ELEMENTS (hashbench_chunks) - 1], RUDGIOSYNC_TRANSFER_BUF_SIZE);
+  buffer = g_malloc (largest);
+  rand = g_rand_new_with_seed (1);
+  for (iter = 0; iter + sizeof (guint32) <= largest; iter += sizeof (guint32))
+    *(guint32 *)(buffer + iter) = g_rand_int (rand);
+  g_rand_free (rand);
+
+  total = (guint64)opt_size * 1024 * 1024;
+  g_print ("\nHashing %d MiB:\n", opt_size);
+  hashbench_memory (buffer, total);
+  success = hashbench_file (buffer, total);
+
+  g_free (buffer);
+  return success ? 0 : 1;
+}
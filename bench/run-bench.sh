@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Run rudgiosync over a set of synthetic trees and collect per-phase timings.
+#
+# Usage: run-bench.sh <rudgiosync> <gentree>
+#
+# For every shape in $BENCH_SHAPES, a tree is generated under $BENCH_DIR (and
+# reused on later runs), then synchronized three times:
+#
+#   cold      into an empty destination, with the page cache dropped first
+#             when /proc/sys/vm/drop_caches is writable,
+#   warm      again, with nothing left to do,
+#   checksum  again, comparing the files by checksum.
+#
+# The phase table printed by `--stats' is collected into $BENCH_OUTPUT.csv and
+# $BENCH_OUTPUT.json.  The `caches' column tells whether the cache could be
+# dropped, as cold numbers taken with a warm cache are not comparable.
+#
+# $BENCH_ARGS is passed on to every run, for instance to emulate a slow
+# destination with a build configured with --enable-emulation:
+#
+#   make bench BENCH_ARGS=--emulate-destination=mtp
+
+set -e
+
+if test $# -ne 2; then
+  echo "Usage: $0 <rudgiosync> <gentree>" >&2
+  exit 1
+fi
+
+RUDGIOSYNC=$1
+GENTREE=$2
+BENCH_SHAPES=${BENCH_SHAPES:-"balanced wide deep"}
+BENCH_DIR=${BENCH_DIR:-bench-work}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench-results}
+BENCH_ARGS=${BENCH_ARGS:-}
+
+csv=$BENCH_OUTPUT.csv
+stats=$BENCH_DIR/stats.txt
+
+mkdir -p "$BENCH_DIR"
+echo "shape,run,caches,phase,wall_s,process_cpu_s" > "$csv"
+
+drop_caches ()
+{
+  sync
+  if (echo 3 > /proc/sys/vm/drop_caches) 2> /dev/null; then
+    caches=dropped
+  else
+    caches=warm
+  fi
+}
+
+# Run a sync, and append its phase table to the CSV file.
+bench_run ()
+{
+  run=$1
+  shift
+
+  "$RUDGIOSYNC" --stats -q $BENCH_ARGS "$@" "$BENCH_DIR/$shape/" "$BENCH_DIR/$shape.dst/" > "$stats"
+  awk -v prefix="$shape,$run,$caches" '
+    /^  Phase/ { table = 1; next }
+    table && /^$/ { exit }
+    table { sub (/s$/, "", $2); sub (/s$/, "", $3); print prefix "," $1 "," $2 "," $3 }
+  ' "$stats" >> "$csv"
+  printf '  %-10s %s\n' "$run" "$(awk '$1 == "total" { print $2 " wall, " $3 " process CPU" }' "$stats")"
+}
+
+for shape in $BENCH_SHAPES; do
+  echo "Shape \`$shape':"
+  if test ! -d "$BENCH_DIR/$shape"; then
+    printf '  generated  '
+    "$GENTREE" --shape="$shape" "$BENCH_DIR/$shape"
+  fi
+
+  rm -rf "$BENCH_DIR/$shape.dst"
+  mkdir "$BENCH_DIR/$shape.dst"
+
+  drop_caches
+  bench_run cold
+  caches=warm
+  bench_run warm
+  bench_run checksum --checksum
+
+  rm -rf "$BENCH_DIR/$shape.dst"
+done
+
+rm -f "$stats"
+
+awk -F, '
+  BEGIN { printf "[" }
+  NR > 1 {
+    printf "%s\n  {\"shape\": \"%s\", \"run\": \"%s\", \"caches\": \"%s\", \"phase\": \"%s\", \"wall_s\": %s, \"process_cpu_s\": %s}",
+           (NR > 2 ? "," : ""), $1, $2, $3, $4, $5, $6
+  }
+  END { print "\n]" }
+' "$csv" > "$BENCH_OUTPUT.json"
+
+echo "Results written to \`$csv' and \`$BENCH_OUTPUT.json'."
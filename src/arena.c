@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "arena.h"
+#include "stats.h"
+
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE ((gsize)(1024 * 1024)) /* 1 MiB */
+#define ARENA_ALIGNMENT  ((gsize)(2 * sizeof (gpointer)))
+
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+struct RudgiosyncArenaBlock_
+{
+  RudgiosyncArenaBlock *next;
+  gsize                 size;   /* Usable size of the block. */
+};
+
+/* The usable area of a block starts right after its (aligned) header. */
+#define ARENA_BLOCK_HEADER_SIZE ARENA_ALIGN (sizeof (RudgiosyncArenaBlock))
+#define ARENA_BLOCK_DATA(block) (((gchar *)(block)) + ARENA_BLOCK_HEADER_SIZE)
+
+
+void
+rudgiosync_arena_init (RudgiosyncArena *arena)
+{
+  arena->blocks    = NULL;
+  arena->used      = 0;
+  arena->allocated = 0;
+}
+
+static RudgiosyncArenaBlock *
+arena_block_new (RudgiosyncArena *arena, gsize size)
+{
+  RudgiosyncArenaBlock *block;
+
+  block = g_malloc (ARENA_BLOCK_HEADER_SIZE + size);
+  block->size = size;
+  arena->allocated += ARENA_BLOCK_HEADER_SIZE + size;
+  rudgiosync_stats_memory (ARENA_BLOCK_HEADER_SIZE + size);
+
+  return block;
+}
+
+gpointer
+rudgiosync_arena_alloc (RudgiosyncArena *arena, gsize size)
+{
+  RudgiosyncArenaBlock *block;
+  gpointer retval;
+
+  size = ARENA_ALIGN (size);
+
+  /**
+   * Oversized requests get a block of their own, which is placed behind the
+   * current block, so that the free space remaining in it isn't lost.
+   */
+  if (size > ARENA_BLOCK_SIZE / 4)
+    {
+      block = arena_block_new (arena, size);
+      if (arena->blocks != NULL)
+        {
+          block->next = arena->blocks->next;
+          arena->blocks->next = block;
+        }
+      else
+        {
+          block->next = NULL;
+          arena->blocks = block;
+          arena->used = size;
+        }
+
+      retval = ARENA_BLOCK_DATA (block);
+      memset (retval, 0, size);
+      return retval;
+    }
+
+  if (arena->blocks == NULL || arena->blocks->size - arena->used < size)
+    {
+      block = arena_block_new (arena, ARENA_BLOCK_SIZE);
+      block->next = arena->blocks;
+      arena->blocks = block;
+      arena->used = 0;
+    }
+
+  retval = ARENA_BLOCK_DATA (arena->blocks) + arena->used;
+  arena->used += size;
+
+  memset (retval, 0, size);
+  return retval;
+}
+
+gchar *
+rudgiosync_arena_strdup (RudgiosyncArena *arena, const gchar *string)
+{
+  gchar *retval;
+  gsize  length;
+
+  if (string == NULL)
+    return NULL;
+
+  length = strlen (string) + 1;
+  retval = rudgiosync_arena_alloc (arena, length);
+  memcpy (retval, string, length);
+
+  return retval;
+}
+
+void
+rudgiosync_arena_clear (RudgiosyncArena *arena)
+{
+  RudgiosyncArenaBlock *block;
+
+  while (arena->blocks != NULL)
+    {
+      block = arena->blocks;
+      arena->blocks = block->next;
+      g_free (block);
+    }
+  rudgiosync_stats_memory (-(gssize)arena->allocated);
+
+  arena->used      = 0;
+  arena->allocated = 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Simple region allocator, used to store directory trees compactly. */
+
+#ifndef _RUDGIOSYNC_ARENA_H_
+#define _RUDGIOSYNC_ARENA_H_
+
+#include "boiler.h"
+
+
+typedef struct RudgiosyncArenaBlock_ RudgiosyncArenaBlock;
+typedef struct RudgiosyncArena_ RudgiosyncArena;
+
+struct RudgiosyncArena_
+{
+  RudgiosyncArenaBlock *blocks;      /* Most recently allocated first. */
+  gsize                 used;        /* Bytes used in the current block. */
+  gsize                 allocated;   /* Total bytes obtained from malloc. */
+};
+
+
+/* Initialize an arena, which is to be allocated statically. */
+void rudgiosync_arena_init (RudgiosyncArena *arena);
+
+/* Allocate a zero-filled chunk of memory from the arena. */
+gpointer rudgiosync_arena_alloc (RudgiosyncArena *arena, gsize size);
+
+/* Copy a string into the arena. */
+gchar *rudgiosync_arena_strdup (RudgiosyncArena *arena, const gchar *string);
+
+/* Release all of the memory held by the arena at once. */
+void rudgiosync_arena_clear (RudgiosyncArena *arena);
+
+
+#endif /* _RUDGIOSYNC_ARENA_H_ */
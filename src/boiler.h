@@ -36,6 +36,21 @@
 #if HAVE_ERRNO_H
 #  include <errno.h>
 #endif
+#if HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif
+#if HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#if HAVE_SYS_STAT_H
+#  include <sys/stat.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+#if HAVE_DIRENT_H
+#  include <dirent.h>
+#endif
 
 
 /* Glib and friends. */
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "buffers.h"
+
+/* Files from which reading around the page cache is worth it. */
+#define CACHE_DIRECT_MIN_SIZE ((off_t)(8 * 1024 * 1024)) /* 8 MiB */
+
+
+static GMutex     pool_lock;
+static GPtrArray *pool = NULL;           /* Buffers not currently in use. */
+
+static gboolean   cache_dropping = FALSE;
+
+
+gpointer
+rudgiosync_aligned_alloc (gsize size)
+{
+#if HAVE_POSIX_MEMALIGN
+  gpointer memory;
+
+  if (posix_memalign (&memory, RUDGIOSYNC_BUFFER_ALIGNMENT, size) != 0)
+    g_error ("Failed to allocate %" G_GSIZE_FORMAT " bytes", size);
+
+  return memory;
+#else
+  return g_malloc (size);
+#endif
+}
+
+void
+rudgiosync_aligned_free (gpointer memory)
+{
+#if HAVE_POSIX_MEMALIGN
+  free (memory);
+#else
+  g_free (memory);
+#endif
+}
+
+
+gchar *
+rudgiosync_buffer_acquire (void)
+{
+  gchar *buffer = NULL;
+
+  g_mutex_lock (&pool_lock);
+  if (pool != NULL && pool->len > 0)
+    buffer = g_ptr_array_remove_index_fast (pool, pool->len - 1);
+  g_mutex_unlock (&pool_lock);
+
+  if (buffer == NULL)
+    buffer = rudgiosync_aligned_alloc (RUDGIOSYNC_TRANSFER_BUF_SIZE);
+
+  return buffer;
+}
+
+void
+rudgiosync_buffer_release (gchar *buffer)
+{
+  g_mutex_lock (&pool_lock);
+  if (pool == NULL)
+    pool = g_ptr_array_new ();
+  g_ptr_array_add (pool, buffer);
+  g_mutex_unlock (&pool_lock);
+}
+
+
+void
+rudgiosync_cache_set_dropping (gboolean dropping)
+{
+  cache_dropping = dropping;
+}
+
+gboolean
+rudgiosync_cache_dropping (void)
+{
+  return cache_dropping;
+}
+
+int
+rudgiosync_cache_open_direct (GFile *descriptor)
+{
+#ifdef O_DIRECT
+  struct stat info;
+  gchar      *path;
+  int         fd;
+
+  if (!cache_dropping || !g_file_is_native (descriptor))
+    return -1;
+
+  path = g_file_get_path (descriptor);
+  if (path == NULL)
+    return -1;
+
+  /* Filesystems which can't do direct I/O refuse to open the file so. */
+  fd = open (path, O_RDONLY | O_DIRECT);
+  g_free (path);
+
+  if (fd >= 0 && (fstat (fd, &info) != 0 || info.st_size < CACHE_DIRECT_MIN_SIZE))
+    {
+      close (fd);
+      fd = -1;
+    }
+
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+gssize
+rudgiosync_cache_read_direct (int fd, gchar *buffer, gsize size, GError **error)
+{
+  gssize count;
+  int    saved_errno;
+#ifdef O_DIRECT
+  int    flags;
+#endif
+
+  while ((count = read (fd, buffer, size)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+#ifdef O_DIRECT
+      /* Typically the unaligned tail of the file, read it through the cache. */
+      if (errno == EINVAL
+          && (flags = fcntl (fd, F_GETFL)) >= 0
+          && (flags & O_DIRECT) != 0
+          && fcntl (fd, F_SETFL, flags & ~O_DIRECT) == 0)
+        continue;
+#endif
+
+      saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Error reading from file: %s", g_strerror (saved_errno));
+      break;
+    }
+
+  return count;
+}
+
+void
+rudgiosync_cache_drop_fd (int fd, gboolean written)
+{
+#if HAVE_POSIX_FADVISE
+#if HAVE_FDATASYNC
+  struct stat info;
+#endif
+
+  if (!cache_dropping)
+    return;
+
+#if HAVE_FDATASYNC
+  /* Dirty pages stay, waiting for them is only worth it for large files. */
+  if (written && fstat (fd, &info) == 0 && info.st_size >= CACHE_DIRECT_MIN_SIZE)
+    fdatasync (fd);
+#endif
+
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+void
+rudgiosync_cache_drop (GFile *descriptor, gboolean written)
+{
+#if HAVE_POSIX_FADVISE
+  gchar *path;
+  int    fd;
+
+  if (!cache_dropping || !g_file_is_native (descriptor))
+    return;
+
+  path = g_file_get_path (descriptor);
+  if (path == NULL)
+    return;
+
+  fd = open (path, O_RDONLY);
+  if (fd >= 0)
+    {
+      rudgiosync_cache_drop_fd (fd, written);
+      close (fd);
+    }
+  g_free (path);
+#endif
+}
+
+void
+rudgiosync_cache_evict (GFile *descriptor)
+{
+#if HAVE_POSIX_FADVISE
+  gchar *path;
+  int    fd;
+
+  if (!g_file_is_native (descriptor))
+    return;
+
+  path = g_file_get_path (descriptor);
+  if (path == NULL)
+    return;
+
+  fd = open (path, O_RDONLY);
+  if (fd >= 0)
+    {
+      /* Only clean pages can be dropped. */
+#if HAVE_FDATASYNC
+      fdatasync (fd);
+#else
+      fsync (fd);
+#endif
+      posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+      close (fd);
+    }
+  g_free (path);
+#endif
+}
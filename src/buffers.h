@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Transfer buffers, and keeping transfers out of the page cache.
+ *
+ * The buffers data is moved through are aligned for direct I/O, and kept in
+ * a pool shared by the copying and hashing of all threads, rather than being
+ * allocated anew for every file.
+ *
+ * When asked to, the files which are read or written are kept from evicting
+ * everything else from the page cache: large local sources are read around
+ * it, and whatever ends up cached of a local file is dropped once it's done
+ * with.
+ */
+
+#ifndef _RUDGIOSYNC_BUFFERS_H_
+#define _RUDGIOSYNC_BUFFERS_H_
+
+#include "boiler.h"
+
+#define RUDGIOSYNC_TRANSFER_BUF_SIZE ((gsize)(2 * 1024 * 1024)) /* 2 MiB */
+#define RUDGIOSYNC_BUFFER_ALIGNMENT  ((gsize)4096)
+
+
+/* Allocate memory aligned for direct I/O. */
+gpointer rudgiosync_aligned_alloc (gsize size);
+
+void rudgiosync_aligned_free (gpointer memory);
+
+/**
+ * Take a buffer of RUDGIOSYNC_TRANSFER_BUF_SIZE bytes from the pool, to be
+ * given back once done with.  Pooled buffers live until the program exits.
+ */
+gchar *rudgiosync_buffer_acquire (void);
+
+void rudgiosync_buffer_release (gchar *buffer);
+
+
+/* Keep the files transferred from here on out of the page cache. */
+void rudgiosync_cache_set_dropping (gboolean dropping);
+
+gboolean rudgiosync_cache_dropping (void);
+
+/**
+ * Open a local file for reading around the page cache, if it should be and
+ * can be.  Returns -1 otherwise.
+ */
+int rudgiosync_cache_open_direct (GFile *descriptor);
+
+/* Read from a file opened for direct I/O, as far as the kernel allows it. */
+gssize rudgiosync_cache_read_direct (int fd,
+                                     gchar *buffer,
+                                     gsize size,
+                                     GError **error);
+
+/**
+ * Drop what's cached of a file, if that's wanted.  Large files which were
+ * written are flushed out first, so their pages can go as well.
+ */
+void rudgiosync_cache_drop_fd (int fd, gboolean written);
+
+void rudgiosync_cache_drop (GFile *descriptor, gboolean written);
+
+/**
+ * Flush a local file out to disk and drop all of it from the page cache,
+ * whether or not the cache is being kept clean, so that it's read back from
+ * the disk.  Does nothing for other files.
+ */
+void rudgiosync_cache_evict (GFile *descriptor);
+
+
+#endif /* _RUDGIOSYNC_BUFFERS_H_ */
@@ -16,8 +16,13 @@
 
 #include "boiler.h"
 #include "checksum.h"
+#include "buffers.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <string.h>
+#include <setjmp.h>
+#include <signal.h>
 
 #ifdef RUDGIOSYNC_CHECKSUM_ENABLED
 void
@@ -62,15 +67,127 @@ rudgiosync_checksums_differ (RudgiosyncChecksum *checksum_a,
 }
 
 
-#define HASH_BUF_SIZE ((gsize)(2 * 1024 * 1024)) /* 2 MiB */
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+#define HASH_MAP_WINDOW ((off_t)(64 * 1024 * 1024)) /* 64 MiB */
 
-gboolean
-rudgiosync_checksum_for_gfile (GFile *descriptor,
-                               RudgiosyncChecksum *checksum,
-                               GError **error)
+/* Where to go when a mapped file turns out shorter than it was. */
+static GPrivate checksum_escape;
+
+static void
+checksum_sigbus (int signum)
+{
+  sigjmp_buf *escape = g_private_get (&checksum_escape);
+
+  if (escape != NULL)
+    siglongjmp (*escape, 1);
+
+  signal (signum, SIG_DFL);
+  raise (signum);
+}
+
+static gpointer
+checksum_catch_sigbus (gpointer data)
+{
+  struct sigaction action;
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = checksum_sigbus;
+  sigemptyset (&action.sa_mask);
+  sigaction (SIGBUS, &action, NULL);
+
+  return NULL;
+}
+
+/**
+ * Hash a local file straight from mappings of it, a window at a time.  Files
+ * which can't be mapped, or shrink while being hashed, are left to be read
+ * the usual way, with FALSE returned.
+ */
+static gboolean
+checksum_mapped (GFile *descriptor, RudgiosyncChecksum *checksum, guint64 *hashed)
+{
+  static GOnce          sigbus_once = G_ONCE_INIT;
+  RudgiosyncHashContext hash_context;
+  struct stat           info;
+  sigjmp_buf            escape;
+  gchar                *path;
+  int                   fd;
+
+  gpointer volatile window = NULL;
+  volatile off_t    length = 0;
+  off_t             offset;
+
+
+  if (!g_file_is_native (descriptor))
+    return FALSE;
+
+  path = g_file_get_path (descriptor);
+  if (path == NULL)
+    return FALSE;
+
+  fd = open (path, O_RDONLY);
+  g_free (path);
+  if (fd < 0)
+    return FALSE;
+
+  if (fstat (fd, &info) != 0 || !S_ISREG (info.st_mode))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  g_once (&sigbus_once, checksum_catch_sigbus, NULL);
+  if (sigsetjmp (escape, 1) != 0)
+    {
+      g_private_set (&checksum_escape, NULL);
+      if (window != NULL)
+        munmap (window, length);
+      close (fd);
+      return FALSE;
+    }
+  g_private_set (&checksum_escape, &escape);
+
+  rudgiosync_hash_init (&hash_context);
+  for (offset = 0; offset < info.st_size; offset += length)
+    {
+      length = MIN (HASH_MAP_WINDOW, info.st_size - offset);
+      window = mmap (NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+      if (window == MAP_FAILED)
+        {
+          window = NULL;
+          break;
+        }
+
+#ifdef MADV_SEQUENTIAL
+      madvise (window, length, MADV_SEQUENTIAL);
+#endif
+      rudgiosync_hash_data (&hash_context, length, window);
+      munmap (window, length);
+      window = NULL;
+    }
+  g_private_set (&checksum_escape, NULL);
+
+  rudgiosync_cache_drop_fd (fd, FALSE);
+  close (fd);
+
+  if (offset < info.st_size)
+    return FALSE;
+
+  rudgiosync_hash_finish (&hash_context, checksum);
+  *hashed = info.st_size;
+  return TRUE;
+}
+#endif /* HAVE_SYS_MMAN_H && HAVE_MMAP */
+
+static gboolean
+checksum_for_gfile (GFile *descriptor,
+                    RudgiosyncChecksum *checksum,
+                    guint64 *hashed,
+                    GError **error)
 {
   RudgiosyncHashContext  hash_context;
   GFileInputStream      *input_stream;
+  RudgiosyncTraceSpan    span;
 
   gssize  read_count;
   gchar  *hash_buf;
@@ -78,24 +195,33 @@ rudgiosync_checksum_for_gfile (GFile *descriptor,
   GError *ierror = NULL;
 
 
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+  if (checksum_mapped (descriptor, checksum, hashed))
+    return TRUE;
+#endif
+
+  rudgiosync_trace_begin (&span);
   input_stream = g_file_read (descriptor, NULL, &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, descriptor, -1);
   if (ierror != NULL)
     {
       g_propagate_error (error, ierror);
       return FALSE;
     }
-  hash_buf = g_new (gchar, HASH_BUF_SIZE);
+  hash_buf = rudgiosync_buffer_acquire ();
   rudgiosync_hash_init (&hash_context);
   while (TRUE)
     {
+      rudgiosync_trace_begin (&span);
       read_count = g_input_stream_read (G_INPUT_STREAM (input_stream),
-                                        hash_buf, HASH_BUF_SIZE,
+                                        hash_buf, RUDGIOSYNC_TRANSFER_BUF_SIZE,
                                         NULL, &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_READ, descriptor, MAX (read_count, 0));
       if (ierror != NULL)
         {
           g_propagate_error (error, ierror);
 
-          g_free (hash_buf);
+          rudgiosync_buffer_release (hash_buf);
           g_object_unref (input_stream);
           return FALSE;
         }
@@ -104,14 +230,39 @@ rudgiosync_checksum_for_gfile (GFile *descriptor,
         break;
 
       rudgiosync_hash_data (&hash_context, (gsize)read_count, hash_buf);
+      *hashed += read_count;
     }
-  g_free (hash_buf);
+  rudgiosync_buffer_release (hash_buf);
+  rudgiosync_trace_begin (&span);
   g_object_unref (input_stream);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_CLOSE, descriptor, -1);
+  rudgiosync_cache_drop (descriptor, FALSE);
 
   rudgiosync_hash_finish (&hash_context, checksum);
   return TRUE;
 }
 
+gboolean
+rudgiosync_checksum_for_gfile (GFile *descriptor,
+                               RudgiosyncChecksum *checksum,
+                               GError **error)
+{
+  RudgiosyncStatsTimer timer;
+  guint64              hashed = 0;
+  gboolean             retval;
+
+  rudgiosync_stats_start (&timer);
+  retval = checksum_for_gfile (descriptor, checksum, &hashed, error);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_CHECKSUM);
+
+  if (retval)
+    {
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_HASHED, 1);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_HASHED, hashed);
+    }
+  return retval;
+}
+
 
 #else /* !RUDGIOSYNC_CHECKSUM_ENABLED */
 void
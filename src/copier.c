@@ -0,0 +1,588 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "copier.h"
+#include "operations.h"
+#include "buffers.h"
+#include "resume.h"
+#include "verify.h"
+#include "uring.h"
+#include "trace.h"
+#include "progress.h"
+
+#if HAVE_GIO_UNIX
+#include <gio/gfiledescriptorbased.h>
+#endif
+
+#define COPIER_READAHEAD ((off_t)(4 * 1024 * 1024)) /* 4 MiB */
+
+
+typedef struct
+{
+  GFile             *source;
+  GFile             *destination;
+  GFileInputStream  *input;
+  GFileOutputStream *output;
+  GError            *error;      /* The first failure to open either. */
+  guint              pending;    /* Opens still in progress. */
+  gboolean           open_destination; /* Once the source has been opened. */
+  RudgiosyncTraceSpan read_span;
+  RudgiosyncTraceSpan replace_span;
+} CopierPrefetch;
+
+typedef struct
+{
+  RudgiosyncCopier  *copier;
+  GFile             *source;
+  GFile             *destination;
+  GFileInputStream  *input;
+  GFileOutputStream *output;
+  guint64            size;
+  guint64            modified_time;
+  gboolean           partial;   /* Written to the destination's partial file. */
+  gboolean           verify;    /* Whether to check it against the checksum. */
+  RudgiosyncChecksum checksum;  /* Of what was written. */
+  RudgiosyncTraceSpan span;     /* Of the step in progress. */
+} CopierFinish;
+
+struct RudgiosyncCopier_
+{
+  GMainContext   *context;      /* Where the background work completes. */
+  CopierPrefetch *prefetch;     /* The streams of the expected next copy. */
+  guint           finishing;    /* Files being completed in the background. */
+  GError         *error;        /* The first failure to complete one. */
+
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+  RudgiosyncUring *uring;       /* For copies between local files, if usable. */
+#endif
+};
+
+
+RudgiosyncCopier *
+rudgiosync_copier_new (void)
+{
+  RudgiosyncCopier *copier;
+
+  copier = g_new0 (RudgiosyncCopier, 1);
+  copier->context = g_main_context_new ();
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+  copier->uring = rudgiosync_uring_new (NULL);
+#endif
+
+  /* Asynchronous operations complete in the context of the calling thread. */
+  g_main_context_push_thread_default (copier->context);
+
+  return copier;
+}
+
+
+/* Prefetching. */
+
+static void
+copier_prefetch_record (CopierPrefetch *prefetch, GError *ierror)
+{
+  if (prefetch->error == NULL)
+    g_propagate_error (&(prefetch->error), ierror);
+  else
+    g_error_free (ierror);
+}
+
+static void
+copier_replace_ready (GObject *object, GAsyncResult *result, gpointer data)
+{
+  CopierPrefetch *prefetch = data;
+
+  GError *ierror = NULL;
+
+
+  prefetch->output = g_file_replace_finish (G_FILE (object), result, &ierror);
+  rudgiosync_trace_end (&(prefetch->replace_span), RUDGIOSYNC_TRACE_OPEN, prefetch->destination, -1);
+  if (ierror != NULL)
+    copier_prefetch_record (prefetch, ierror);
+
+  prefetch->pending--;
+}
+
+/* The destination is only opened once the source is known to be readable. */
+static void
+copier_read_ready (GObject *object, GAsyncResult *result, gpointer data)
+{
+  CopierPrefetch *prefetch = data;
+
+  GError *ierror = NULL;
+
+
+  prefetch->input = g_file_read_finish (G_FILE (object), result, &ierror);
+  rudgiosync_trace_end (&(prefetch->read_span), RUDGIOSYNC_TRACE_OPEN, prefetch->source, -1);
+  if (ierror != NULL)
+    {
+      copier_prefetch_record (prefetch, ierror);
+    }
+  else if (prefetch->open_destination)
+    {
+      prefetch->pending++;
+      rudgiosync_trace_begin (&(prefetch->replace_span));
+      g_file_replace_async (prefetch->destination,
+                            NULL,
+                            FALSE,
+                            G_FILE_CREATE_NONE,
+                            G_PRIORITY_DEFAULT,
+                            NULL,
+                            copier_replace_ready,
+                            prefetch);
+    }
+
+  prefetch->pending--;
+}
+
+/* Ask the kernel to start reading a local source before it's needed. */
+static void
+copier_readahead (GFile *source)
+{
+#if HAVE_POSIX_FADVISE
+  gchar *path;
+  int    fd;
+
+  if (!g_file_is_native (source))
+    return;
+
+  path = g_file_get_path (source);
+  if (path == NULL)
+    return;
+
+  fd = open (path, O_RDONLY);
+  if (fd >= 0)
+    {
+      posix_fadvise (fd, 0, COPIER_READAHEAD, POSIX_FADV_WILLNEED);
+      close (fd);
+    }
+  g_free (path);
+#endif
+}
+
+static void
+copier_prefetch_wait (RudgiosyncCopier *copier, CopierPrefetch *prefetch)
+{
+  while (prefetch->pending > 0)
+    g_main_context_iteration (copier->context, TRUE);
+}
+
+/* Drop prefetched streams which turned out not to be needed. */
+static void
+copier_prefetch_discard (RudgiosyncCopier *copier, CopierPrefetch *prefetch)
+{
+  copier_prefetch_wait (copier, prefetch);
+
+  if (prefetch->input != NULL)
+    g_object_unref (prefetch->input);
+  if (prefetch->output != NULL)
+    rudgiosync_abandon_output (prefetch->output);
+
+  g_clear_error (&(prefetch->error));
+  g_object_unref (prefetch->source);
+  g_object_unref (prefetch->destination);
+  g_free (prefetch);
+}
+
+void
+rudgiosync_copier_prefetch (RudgiosyncCopier *copier,
+                            GFile *destination,
+                            GFile *source,
+                            gboolean open_destination)
+{
+  CopierPrefetch *prefetch;
+
+  if (copier->prefetch != NULL)
+    copier_prefetch_discard (copier, copier->prefetch);
+
+  prefetch = g_new0 (CopierPrefetch, 1);
+  prefetch->source = g_object_ref (source);
+  prefetch->destination = g_object_ref (destination);
+  copier->prefetch = prefetch;
+
+  prefetch->open_destination = open_destination;
+  copier_readahead (source);
+
+  prefetch->pending++;
+  rudgiosync_trace_begin (&(prefetch->read_span));
+  g_file_read_async (source, G_PRIORITY_DEFAULT, NULL, copier_read_ready, prefetch);
+}
+
+
+/* Completing copies in the background. */
+
+static void
+copier_finish_free (CopierFinish *finish)
+{
+  finish->copier->finishing--;
+
+  g_object_unref (finish->source);
+  g_object_unref (finish->destination);
+  g_object_unref (finish->input);
+  g_object_unref (finish->output);
+  g_free (finish);
+}
+
+static void
+copier_attributes_ready (GObject *object, GAsyncResult *result, gpointer data)
+{
+  CopierFinish *finish = data;
+
+  /* The times are merely a hint for later runs, as with a plain copy. */
+  g_file_set_attributes_finish (G_FILE (object), result, NULL, NULL);
+  rudgiosync_trace_end (&(finish->span), RUDGIOSYNC_TRACE_SET_ATTRIBUTES, finish->destination, -1);
+
+  if (finish->verify)
+    {
+      rudgiosync_verify_queue (finish->destination, finish->source, &(finish->checksum),
+                               finish->size, finish->modified_time);
+    }
+  copier_finish_free (finish);
+}
+
+static void
+copier_output_closed (GObject *object, GAsyncResult *result, gpointer data)
+{
+  CopierFinish *finish = data;
+  GFileInfo    *info;
+
+  GError *ierror = NULL;
+
+
+  rudgiosync_trace_end (&(finish->span), RUDGIOSYNC_TRACE_CLOSE, finish->destination, -1);
+  if (!g_output_stream_close_finish (G_OUTPUT_STREAM (object), result, &ierror)
+      || (finish->partial && !rudgiosync_resume_complete (finish->destination, &ierror)))
+    {
+      if (finish->copier->error == NULL)
+        rudgiosync_propagate_copy_error (&(finish->copier->error), ierror, finish->destination, finish->source);
+      else
+        g_error_free (ierror);
+
+      copier_finish_free (finish);
+      return;
+    }
+
+  rudgiosync_cache_drop (finish->destination, TRUE);
+
+  info = g_file_info_new ();
+  g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED, finish->modified_time);
+  rudgiosync_trace_begin (&(finish->span));
+  g_file_set_attributes_async (finish->destination,
+                               info,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               G_PRIORITY_DEFAULT,
+                               NULL,
+                               copier_attributes_ready,
+                               finish);
+  g_object_unref (info);
+}
+
+static void
+copier_input_closed (GObject *object, GAsyncResult *result, gpointer data)
+{
+  CopierFinish *finish = data;
+
+  /* Everything has been read, a failure to close the source changes nothing. */
+  g_input_stream_close_finish (G_INPUT_STREAM (object), result, NULL);
+  rudgiosync_trace_end (&(finish->span), RUDGIOSYNC_TRACE_CLOSE, finish->source, -1);
+
+  rudgiosync_trace_begin (&(finish->span));
+  g_output_stream_close_async (G_OUTPUT_STREAM (finish->output),
+                               G_PRIORITY_DEFAULT,
+                               NULL,
+                               copier_output_closed,
+                               finish);
+}
+
+static void
+copier_finish (RudgiosyncCopier *copier,
+               GFile *destination,
+               GFile *source,
+               GFileInputStream *input,
+               GFileOutputStream *output,
+               guint64 size,
+               guint64 modified_time,
+               gboolean partial,
+               RudgiosyncHashContext *hash)
+{
+  CopierFinish *finish;
+
+  finish = g_new (CopierFinish, 1);
+  finish->copier = copier;
+  finish->source = g_object_ref (source);
+  finish->destination = g_object_ref (destination);
+  finish->input = input;
+  finish->output = output;
+  finish->size = size;
+  finish->modified_time = modified_time;
+  finish->partial = partial;
+  finish->verify = hash != NULL;
+  if (hash != NULL)
+    rudgiosync_hash_finish (hash, &(finish->checksum));
+
+  copier->finishing++;
+  rudgiosync_trace_begin (&(finish->span));
+  g_input_stream_close_async (G_INPUT_STREAM (input),
+                              G_PRIORITY_DEFAULT,
+                              NULL,
+                              copier_input_closed,
+                              finish);
+}
+
+/* Report a failure which happened in the background, if there was one. */
+static gboolean
+copier_check (RudgiosyncCopier *copier, GError **error)
+{
+  if (copier->error != NULL)
+    {
+      g_propagate_error (error, copier->error);
+      copier->error = NULL;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Copying. */
+
+static gboolean
+copier_transfer_direct (int fd, GOutputStream *output, gchar *buffer,
+                        RudgiosyncHashContext *hash, GError **error)
+{
+  RudgiosyncTraceSpan span;
+  gssize              read_count;
+  gsize               wrote_count;
+
+  while ((read_count = rudgiosync_cache_read_direct (fd, buffer, RUDGIOSYNC_TRANSFER_BUF_SIZE, error)) > 0)
+    {
+      if (hash != NULL)
+        rudgiosync_hash_data (hash, (gsize)read_count, buffer);
+
+      rudgiosync_trace_begin (&span);
+      if (!g_output_stream_write_all (output, buffer, (gsize)read_count, &wrote_count, NULL, error))
+        return FALSE;
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_WRITE, NULL, read_count);
+      rudgiosync_progress_bytes (read_count);
+    }
+
+  return read_count == 0;
+}
+
+/**
+ * Move the data over: by the data only for local sources with holes, around
+ * the page cache for large local sources if it's to be spared, and through
+ * io_uring when both ends are local files.  Runs of zeroes are looked for in
+ * what comes from elsewhere.  Other than for holes, the space is reserved
+ * beforehand.  The data is hashed on the way if a hashing state is given,
+ * which io_uring, completing out of order, doesn't allow for.
+ */
+static gboolean
+copier_transfer (RudgiosyncCopier *copier,
+                 GFile *source,
+                 GFileInputStream *input,
+                 GFileOutputStream *output,
+                 guint64 size,
+                 RudgiosyncHashContext *hash,
+                 GError **error)
+{
+  gboolean  retval;
+  gchar    *buffer;
+  int       sparse_fd;
+  int       direct_fd;
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+  int       input_fd;
+#endif
+
+  sparse_fd = rudgiosync_sparse_open (source, G_OUTPUT_STREAM (output));
+  if (sparse_fd >= 0)
+    {
+      buffer = rudgiosync_buffer_acquire ();
+      retval = rudgiosync_sparse_copy (sparse_fd, G_OUTPUT_STREAM (output),
+                                       buffer, RUDGIOSYNC_TRANSFER_BUF_SIZE,
+                                       hash, error);
+      rudgiosync_buffer_release (buffer);
+
+      rudgiosync_cache_drop_fd (sparse_fd, FALSE);
+      close (sparse_fd);
+      return retval;
+    }
+
+  if (!rudgiosync_preallocate (G_OUTPUT_STREAM (output), size, error))
+    return FALSE;
+
+  direct_fd = rudgiosync_cache_open_direct (source);
+  if (direct_fd >= 0)
+    {
+      buffer = rudgiosync_buffer_acquire ();
+      retval = copier_transfer_direct (direct_fd, G_OUTPUT_STREAM (output), buffer, hash, error);
+      rudgiosync_buffer_release (buffer);
+
+      rudgiosync_cache_drop_fd (direct_fd, FALSE);
+      close (direct_fd);
+      return retval;
+    }
+
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+  if (copier->uring != NULL
+      && hash == NULL
+      && G_IS_FILE_DESCRIPTOR_BASED (input)
+      && G_IS_FILE_DESCRIPTOR_BASED (output))
+    {
+      input_fd = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (input));
+      retval = rudgiosync_uring_copy (copier->uring,
+                                      g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (output)),
+                                      input_fd,
+                                      error);
+      if (retval)
+        rudgiosync_progress_bytes (size);
+      rudgiosync_cache_drop_fd (input_fd, FALSE);
+      return retval;
+    }
+#endif
+
+  buffer = rudgiosync_buffer_acquire ();
+  retval = rudgiosync_copy_stream (G_INPUT_STREAM (input), G_OUTPUT_STREAM (output),
+                                   !g_file_is_native (source),
+                                   buffer, RUDGIOSYNC_TRANSFER_BUF_SIZE,
+                                   hash, error);
+  rudgiosync_buffer_release (buffer);
+  rudgiosync_cache_drop (source, FALSE);
+
+  return retval;
+}
+
+gboolean
+rudgiosync_copier_copy (RudgiosyncCopier *copier,
+                        GFile *destination,
+                        GFile *source,
+                        guint64 size,
+                        guint64 modified_time,
+                        GError **error)
+{
+  CopierPrefetch    *prefetch = copier->prefetch;
+  GFileInputStream  *input_stream = NULL;
+  GFileOutputStream *output_stream = NULL;
+  RudgiosyncTraceSpan span;
+  RudgiosyncHashContext hash_context;
+  RudgiosyncHashContext *hash = NULL;
+  gboolean           partial;
+  guint64            offset = 0;
+
+  GError *ierror = NULL;
+
+
+  while (g_main_context_iteration (copier->context, FALSE));
+  if (!copier_check (copier, error))
+    return FALSE;
+
+  copier->prefetch = NULL;
+  if (prefetch != NULL
+      && g_file_equal (prefetch->source, source)
+      && g_file_equal (prefetch->destination, destination))
+    {
+      copier_prefetch_wait (copier, prefetch);
+
+      input_stream = prefetch->input;
+      output_stream = prefetch->output;
+      ierror = prefetch->error;
+
+      prefetch->input = NULL;
+      prefetch->output = NULL;
+      prefetch->error = NULL;
+    }
+  if (prefetch != NULL)
+    copier_prefetch_discard (copier, prefetch);
+
+  if (ierror == NULL && input_stream == NULL)
+    {
+      rudgiosync_trace_begin (&span);
+      input_stream = g_file_read (source, NULL, &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, source, -1);
+    }
+
+  /* Large files go by way of their partial file, which is never prefetched. */
+  partial = output_stream == NULL && rudgiosync_resume_wanted (size);
+  if (ierror == NULL && partial)
+    {
+      output_stream = rudgiosync_resume_open (destination, source, &input_stream,
+                                              size, modified_time, &offset,
+                                              &ierror);
+    }
+  else if (ierror == NULL && output_stream == NULL)
+    {
+      rudgiosync_trace_begin (&span);
+      output_stream = g_file_replace (destination,
+                                      NULL,
+                                      FALSE,
+                                      G_FILE_CREATE_NONE,
+                                      NULL,
+                                      &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, destination, -1);
+    }
+
+  if (rudgiosync_verify_enabled ())
+    {
+      hash = &hash_context;
+      rudgiosync_hash_init (hash);
+    }
+
+  if (ierror == NULL && offset > 0)
+    rudgiosync_resume_transfer (source, input_stream, output_stream, size, offset, hash, &ierror);
+  else if (ierror == NULL)
+    copier_transfer (copier, source, input_stream, output_stream, size, hash, &ierror);
+
+  if (ierror != NULL)
+    {
+      if (input_stream != NULL)
+        g_object_unref (input_stream);
+      if (output_stream != NULL)
+        rudgiosync_abandon_output (output_stream);
+
+      rudgiosync_propagate_copy_error (error, ierror, destination, source);
+      return FALSE;
+    }
+
+  copier_finish (copier, destination, source, input_stream, output_stream,
+                 size, modified_time, partial, hash);
+
+  return TRUE;
+}
+
+gboolean
+rudgiosync_copier_free (RudgiosyncCopier *copier, GError **error)
+{
+  gboolean retval;
+
+  if (copier->prefetch != NULL)
+    copier_prefetch_discard (copier, copier->prefetch);
+
+  while (copier->finishing > 0)
+    g_main_context_iteration (copier->context, TRUE);
+
+  retval = copier_check (copier, error);
+
+  g_main_context_pop_thread_default (copier->context);
+  g_main_context_unref (copier->context);
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+  if (copier->uring != NULL)
+    rudgiosync_uring_free (copier->uring);
+#endif
+  g_free (copier);
+
+  return retval;
+}
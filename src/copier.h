@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Pipelined copying.
+ *
+ * A copier copies one file at a time, but opens the streams of the file
+ * expected to come next while the current one is still being transferred,
+ * and finishes closing files and fixing their times in the background, so
+ * backends with a high latency per operation are kept busy.
+ *
+ * A copier belongs to the thread which created it.
+ */
+
+#ifndef _RUDGIOSYNC_COPIER_H_
+#define _RUDGIOSYNC_COPIER_H_
+
+#include "boiler.h"
+
+
+typedef struct RudgiosyncCopier_ RudgiosyncCopier;
+
+RudgiosyncCopier *rudgiosync_copier_new (void);
+
+/**
+ * Wait for the work left in the background, and free the copier.  Returns
+ * FALSE if any of it failed.
+ */
+gboolean rudgiosync_copier_free (RudgiosyncCopier *copier,
+                                 GError **error);
+
+/**
+ * Start opening the streams for the next copy.  The destination is only
+ * opened once the source has been, and without opening the destination it
+ * is left untouched until the copy is made.
+ */
+void rudgiosync_copier_prefetch (RudgiosyncCopier *copier,
+                                 GFile *destination,
+                                 GFile *source,
+                                 gboolean open_destination);
+
+/**
+ * Replace the contents of a file, expected to be of the given size, and give
+ * it the wanted modification time.  The destination may not be complete until the next copy or until the
+ * copier is freed, and failures to complete it are reported there.
+ */
+gboolean rudgiosync_copier_copy (RudgiosyncCopier *copier,
+                                 GFile *destination,
+                                 GFile *source,
+                                 guint64 size,
+                                 guint64 modified_time,
+                                 GError **error);
+
+#endif /* _RUDGIOSYNC_COPIER_H_ */
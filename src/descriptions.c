@@ -17,31 +17,63 @@
 #include "boiler.h"
 #include "descriptions.h"
 #include "errors.h"
+#include "resume.h"
+#include "stats.h"
+#include "trace.h"
+#include "uring.h"
 
+#include <string.h>
 
+#define ENTRY_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_TYPE ","           \
+                         G_FILE_ATTRIBUTE_STANDARD_NAME ","           \
+                         G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","   \
+                         G_FILE_ATTRIBUTE_STANDARD_SIZE ","           \
+                         G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+
+/* Fill in a new entry from a GFileInfo, without looking at its contents. */
 static RudgiosyncDirectoryEntry *
-rudgiosync_directory_entry_new_internal (const gchar *uri, GFile *descriptor, GFileInfo *info, gboolean checksum_wanted, GError **error)
+entry_new_from_info (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *parent, GFileInfo *info, GError **error)
 {
   RudgiosyncDirectoryEntry  *retval;
-  GFileEnumerator           *enumerator;
-  const gchar               *string_attr;
+  const gchar               *name;
+  const gchar               *display_name;
 
-  RudgiosyncDirectoryEntry  *child_entry;
-  GFileInfo                 *child_info;
-  GFile                     *child_descriptor;
-  gchar                     *child_uri;
 
-  GError *ierror = NULL;
+  name = g_file_info_get_attribute_byte_string (info, G_FILE_ATTRIBUTE_STANDARD_NAME);
+  if (name == NULL)
+    {
+      g_set_error (error, RUDGIOSYNC_ERROR,
+                   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                   "Filename information missing in GFileInfo");
+      return NULL;
+    }
+  display_name = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME);
+  if (display_name == NULL)
+    {
+      g_set_error (error, RUDGIOSYNC_ERROR,
+                   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                   "Displayable filename information missing in GFileInfo");
+      return NULL;
+    }
 
+  retval = rudgiosync_arena_alloc (&(tree->arena), sizeof (RudgiosyncDirectoryEntry));
+  retval->parent = parent;
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_ENTRIES_SCANNED, 1);
 
-  retval = g_slice_new0 (RudgiosyncDirectoryEntry);
-  retval->descriptor = g_object_ref (descriptor);
+  retval->name = rudgiosync_arena_strdup (&(tree->arena), name);
+  if (strcmp (name, display_name) == 0)
+    retval->display_name = retval->name;
+  else
+    retval->display_name = rudgiosync_arena_strdup (&(tree->arena), display_name);
 
   retval->modified_time = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
   switch (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_STANDARD_TYPE))
     {
       case G_FILE_TYPE_REGULAR:
         retval->type = RUDGIOSYNC_DIR_ENTRY_FILE;
+        retval->data.file.size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+        rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SCANNED, retval->data.file.size);
         break;
 
       case G_FILE_TYPE_DIRECTORY:
@@ -53,147 +85,480 @@ rudgiosync_directory_entry_new_internal (const gchar *uri, GFile *descriptor, GF
         break;
     }
 
-  string_attr = g_file_info_get_attribute_byte_string (info, G_FILE_ATTRIBUTE_STANDARD_NAME);
-  if (string_attr == NULL)
+  return retval;
+}
+
+static gboolean
+compute_checksum (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *entry, GFile *descriptor, const gchar *uri, GError **error)
+{
+  GError *ierror = NULL;
+
+  if (entry->data.file.checksum == NULL)
+    entry->data.file.checksum = rudgiosync_arena_alloc (&(tree->arena), sizeof (RudgiosyncChecksum));
+  rudgiosync_checksum_for_gfile (descriptor, entry->data.file.checksum, &ierror);
+  if (ierror != NULL)
     {
-      g_set_error (error, RUDGIOSYNC_ERROR,
-                   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
-                   "Failed to retrieve information about the file `%s': %s",
-                   uri,
-                   "Filename information missing in GFileInfo");
+      g_propagate_prefixed_error (error, ierror, "Failed to produce a checksum for the file `%s': ", uri);
+      return FALSE;
+    }
 
-      rudgiosync_directory_entry_free (retval);
-      return NULL;
+  return TRUE;
+}
+
+#if HAVE_OPENAT && HAVE_FDOPENDIR && HAVE_FSTATAT
+
+/* Native scanning of local directories, without GIO's per-entry overhead. */
+
+#define LOCAL_SCAN_ENABLED 1
+
+static void
+local_set_error (GError **error, int errsv, const gchar *format, const gchar *path)
+{
+  gchar *uri;
+
+  uri = g_filename_to_uri (path, NULL, NULL);
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv), format,
+               (uri != NULL) ? uri : path, g_strerror (errsv));
+  g_free (uri);
+}
+
+/* Look up the type, size and time of an entry, without following links. */
+static int
+local_stat (int dir_fd, const gchar *name, guint *type, guint64 *size, guint64 *modified_time)
+{
+  mode_t mode;
+
+#if HAVE_STATX
+  struct statx info;
+
+  if (statx (dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+             STATX_TYPE | STATX_SIZE | STATX_MTIME, &info) != 0)
+    return -1;
+
+  mode = info.stx_mode;
+  *size = info.stx_size;
+  *modified_time = info.stx_mtime.tv_sec;
+#else
+  struct stat info;
+
+  if (fstatat (dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+    return -1;
+
+  mode = info.st_mode;
+  *size = info.st_size;
+  *modified_time = info.st_mtime;
+#endif
+
+  if (S_ISREG (mode))
+    *type = RUDGIOSYNC_DIR_ENTRY_FILE;
+  else if (S_ISDIR (mode))
+    *type = RUDGIOSYNC_DIR_ENTRY_DIR;
+  else
+    *type = RUDGIOSYNC_DIR_ENTRY_OTHER;
+
+  return 0;
+}
+
+static RudgiosyncDirectoryEntry *
+local_entry_new (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *parent, const gchar *name)
+{
+  RudgiosyncDirectoryEntry *retval;
+  const gchar             **charsets;
+  gchar                    *display_name;
+
+  retval = rudgiosync_arena_alloc (&(tree->arena), sizeof (RudgiosyncDirectoryEntry));
+  retval->parent = parent;
+  retval->name = rudgiosync_arena_strdup (&(tree->arena), name);
+
+  /* The same display names as GIO would give, see g_filename_display_name. */
+  if (g_get_filename_charsets (&charsets) && g_utf8_validate (name, -1, NULL))
+    {
+      retval->display_name = retval->name;
+    }
+  else
+    {
+      display_name = g_filename_display_name (name);
+      retval->display_name = rudgiosync_arena_strdup (&(tree->arena), display_name);
+      g_free (display_name);
     }
-  retval->name = g_strdup (string_attr);
 
-  string_attr = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME);
-  if (string_attr == NULL)
+  return retval;
+}
+
+/**
+ * Scan an open directory, whose descriptor is taken over, found at the path.
+ * Files which need a checksum are added to the given array, if any.  Each
+ * directory is traced as an enumeration of its own, which takes in those of
+ * its subdirectories.
+ */
+static gboolean
+local_scan_directory (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *directory, int fd, GString *path, GPtrArray *checksums, GError **error)
+{
+  RudgiosyncDirectoryEntry  *child_entry;
+  RudgiosyncTraceSpan        span;
+  DIR                       *handle;
+  struct dirent             *dirent;
+  gsize                      path_length = path->len;
+  int                        child_fd;
+  int                        errsv;
+  gchar                     *child_uri;
+  guint                      type;
+  guint64                    size;
+  guint64                    modified_time;
+
+  GError *ierror = NULL;
+
+
+  rudgiosync_trace_begin (&span);
+  handle = fdopendir (fd);
+  if (handle == NULL)
     {
-      g_set_error (error, RUDGIOSYNC_ERROR,
-                   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
-                   "Failed to retrieve information about the file `%s': %s",
-                   uri,
-                   "Displayable filename information missing in GFileInfo");
+      errsv = errno;
+      close (fd);
+      rudgiosync_trace_end_path (&span, RUDGIOSYNC_TRACE_ENUMERATE, path->str, -1);
+      local_set_error (error, errsv, "Failed to retrieve information about the children of the directory `%s': %s", path->str);
+      return FALSE;
+    }
 
-      rudgiosync_directory_entry_free (retval);
-      return NULL;
+  while (TRUE)
+    {
+      errno = 0;
+      dirent = readdir (handle);
+      if (dirent == NULL)
+        {
+          if (errno != 0)
+            local_set_error (&ierror, errno, "Failed to retrieve information about a child of the directory `%s': %s", path->str);
+          break;
+        }
+      if (strcmp (dirent->d_name, ".") == 0 || strcmp (dirent->d_name, "..") == 0)
+        continue;
+
+      if (path->str[path_length - 1] != '/')
+        g_string_append_c (path, '/');
+      g_string_append (path, dirent->d_name);
+
+      if (local_stat (dirfd (handle), dirent->d_name, &type, &size, &modified_time) != 0)
+        {
+          errsv = errno;
+          g_string_truncate (path, path_length);
+
+          /* It was removed since the directory was read. */
+          if (errsv == ENOENT)
+            continue;
+
+          local_set_error (&ierror, errsv, "Failed to retrieve information about a child of the directory `%s': %s", path->str);
+          break;
+        }
+
+      child_entry = local_entry_new (tree, directory, dirent->d_name);
+      child_entry->type = type;
+      child_entry->modified_time = modified_time;
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_ENTRIES_SCANNED, 1);
+
+      if (type == RUDGIOSYNC_DIR_ENTRY_DIR)
+        {
+          child_fd = openat (dirfd (handle), dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+          if (child_fd < 0)
+            local_set_error (&ierror, errno, "Failed to retrieve information about the children of the directory `%s': %s", path->str);
+          else
+            local_scan_directory (tree, child_entry, child_fd, path, checksums, &ierror);
+        }
+      else if (type == RUDGIOSYNC_DIR_ENTRY_FILE)
+        {
+          child_entry->data.file.size = size;
+          rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SCANNED, size);
+          if (checksums != NULL && !rudgiosync_resume_is_leftover (dirent->d_name))
+            g_ptr_array_add (checksums, child_entry);
+        }
+      g_string_truncate (path, path_length);
+
+      if (ierror != NULL)
+        {
+          child_uri = g_filename_to_uri (path->str, NULL, NULL);
+          g_prefix_error (&ierror, "Failed to retrieve information about a child of the directory `%s': ",
+                          (child_uri != NULL) ? child_uri : path->str);
+          g_free (child_uri);
+          break;
+        }
+
+      rudgiosync_directory_entry_link (directory, child_entry);
     }
-  retval->display_name = g_strdup (string_attr);
+  closedir (handle);
+  rudgiosync_trace_end_path (&span, RUDGIOSYNC_TRACE_ENUMERATE, path->str, -1);
 
-  switch (retval->type)
+  if (ierror != NULL)
     {
-      case RUDGIOSYNC_DIR_ENTRY_FILE:
-        retval->data.file.size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
-        if (checksum_wanted)
-          {
-            rudgiosync_checksum_for_gfile (retval->descriptor,
-                                           &(retval->data.file.checksum),
-                                           &ierror);
-            if (ierror != NULL)
-              {
-                g_propagate_prefixed_error (error, ierror, "Failed to produce a checksum for the file `%s': ", uri);
-
-                rudgiosync_directory_entry_free (retval);
-                return NULL;
-              }
-          }
-        break;
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
 
-      case RUDGIOSYNC_DIR_ENTRY_DIR:
-        enumerator = g_file_enumerate_children (retval->descriptor,
-                                                G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                                G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","
-                                                G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-                                                G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                                NULL,
-                                                &ierror);
-        if (ierror != NULL)
-          {
-            g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the children of the directory `%s': ", uri);
-
-            rudgiosync_directory_entry_free (retval);
-            return NULL;
-          }
-        while (TRUE)
-          {
-            child_info = g_file_enumerator_next_file (enumerator, NULL, &ierror);
-            if (ierror != NULL)
-              {
-                g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
-
-                g_object_unref (enumerator);
-                rudgiosync_directory_entry_free (retval);
-
-                return NULL;
-              }
-            if (child_info == NULL)
-              {
-                break;
-              }
-            string_attr = g_file_info_get_attribute_byte_string (child_info, G_FILE_ATTRIBUTE_STANDARD_NAME);
-            if (string_attr == NULL)
-              {
-                g_set_error (error, RUDGIOSYNC_ERROR,
-                             RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
-                             "Failed to retrieve information about a child of the directory `%s': %s",
-                             uri,
-                             "Filename information missing in GFileInfo retrieved from GFileEnumerator");
-
-                g_object_unref (child_info);
-                g_object_unref (enumerator);
-                rudgiosync_directory_entry_free (retval);
-
-                return NULL;
-              }
-            child_descriptor = g_file_get_child (retval->descriptor, string_attr);
-            child_uri = g_file_get_uri (child_descriptor);
-            child_entry = rudgiosync_directory_entry_new_internal (child_uri, child_descriptor, child_info, checksum_wanted, &ierror);
-            g_free (child_uri);
-            g_object_unref (child_descriptor);
-            g_object_unref (child_info);
-
-            if (ierror != NULL)
-              {
-                g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
-
-                g_object_unref (enumerator);
-                rudgiosync_directory_entry_free (retval);
-
-                return NULL;
-              }
-
-            retval->data.directory.entries = g_slist_prepend (retval->data.directory.entries, child_entry);
-          }
-
-        g_object_unref (enumerator);
-        break;
+  return TRUE;
+}
+
+/* The path of an entry found by a local scan of the given directory. */
+static gchar *
+local_entry_path (RudgiosyncDirectoryEntry *top, const gchar *top_path, RudgiosyncDirectoryEntry *entry)
+{
+  RudgiosyncDirectoryEntry *iter;
+  GPtrArray                *names;
+  GString                  *retval;
+  guint                     index;
+
+  names = g_ptr_array_new ();
+  for (iter = entry; iter != top; iter = iter->parent)
+    g_ptr_array_add (names, (gpointer) iter->name);
+
+  retval = g_string_new (top_path);
+  for (index = names->len; index > 0; index--)
+    {
+      if (retval->str[retval->len - 1] != '/')
+        g_string_append_c (retval, '/');
+      g_string_append (retval, g_ptr_array_index (names, index - 1));
     }
+  g_ptr_array_free (names, TRUE);
 
-  return retval;
+  return g_string_free (retval, FALSE);
+}
+
+/**
+ * Produce the checksums of the files found by a local scan.  With io_uring,
+ * many of them are read at once, otherwise one after another.
+ */
+static gboolean
+local_compute_checksums (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *top, const gchar *top_path, GPtrArray *entries, GError **error)
+{
+  RudgiosyncDirectoryEntry  *entry;
+  RudgiosyncChecksum       **checksums;
+  GFile                     *descriptor;
+  gchar                    **paths;
+  gchar                     *uri;
+  gboolean                   done = FALSE;
+  guint                      iter;
+
+  GError *ierror = NULL;
+
+#if defined (RUDGIOSYNC_IO_URING_ENABLED) && defined (RUDGIOSYNC_CHECKSUM_ENABLED)
+  RudgiosyncUring      *uring;
+  RudgiosyncStatsTimer  timer;
+  guint                 failed = 0;
+#endif
+
+
+  paths = g_new0 (gchar *, entries->len + 1);
+  checksums = g_new (RudgiosyncChecksum *, entries->len);
+  for (iter = 0; iter < entries->len; iter++)
+    {
+      entry = g_ptr_array_index (entries, iter);
+      entry->data.file.checksum = rudgiosync_arena_alloc (&(tree->arena), sizeof (RudgiosyncChecksum));
+      checksums[iter] = entry->data.file.checksum;
+      paths[iter] = local_entry_path (top, top_path, entry);
+    }
+
+#if defined (RUDGIOSYNC_IO_URING_ENABLED) && defined (RUDGIOSYNC_CHECKSUM_ENABLED)
+  /* Without a usable ring, the files are read through GIO instead. */
+  uring = rudgiosync_uring_new (NULL);
+  if (uring != NULL)
+    {
+      rudgiosync_stats_start (&timer);
+      if (rudgiosync_uring_checksum (uring, paths, checksums, entries->len, &failed, &ierror))
+        {
+          rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_HASHED, entries->len);
+          for (iter = 0; iter < entries->len; iter++)
+            {
+              entry = g_ptr_array_index (entries, iter);
+              rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_HASHED, entry->data.file.size);
+            }
+        }
+      else
+        {
+          uri = g_filename_to_uri (paths[failed], NULL, NULL);
+          g_prefix_error (&ierror, "Failed to produce a checksum for the file `%s': ", (uri != NULL) ? uri : paths[failed]);
+          g_free (uri);
+        }
+      rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_CHECKSUM);
+      rudgiosync_uring_free (uring);
+      done = TRUE;
+    }
+#endif
+
+  for (iter = 0; iter < entries->len && !done && ierror == NULL; iter++)
+    {
+      descriptor = g_file_new_for_path (paths[iter]);
+      uri = g_file_get_uri (descriptor);
+      compute_checksum (tree, g_ptr_array_index (entries, iter), descriptor, uri, &ierror);
+      g_free (uri);
+      g_object_unref (descriptor);
+    }
+
+  g_strfreev (paths);
+  g_free (checksums);
+
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+#endif /* HAVE_OPENAT && HAVE_FDOPENDIR && HAVE_FSTATAT */
+
+static gboolean
+scan_directory (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *directory, GFile *descriptor, const gchar *uri, gboolean checksum_wanted, GError **error)
+{
+  GFileEnumerator           *enumerator;
+  RudgiosyncTraceSpan        span;
+
+  RudgiosyncDirectoryEntry  *child_entry;
+  GFileInfo                 *child_info;
+  GFile                     *child_descriptor;
+  gchar                     *child_uri;
+
+  GError *ierror = NULL;
+
+#if LOCAL_SCAN_ENABLED
+  gchar     *path;
+  GString   *path_buf;
+  GPtrArray *checksums;
+  int        fd;
+
+  path = g_file_is_native (descriptor) ? g_file_get_path (descriptor) : NULL;
+  if (path != NULL)
+    {
+      fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          local_set_error (error, errno, "Failed to retrieve information about the children of the directory `%s': %s", path);
+          g_free (path);
+          return FALSE;
+        }
+
+      /* The contents of files are examined once the whole tree is known. */
+      path_buf = g_string_new (path);
+      checksums = checksum_wanted ? g_ptr_array_new () : NULL;
+
+      local_scan_directory (tree, directory, fd, path_buf, checksums, &ierror);
+      if (ierror == NULL && checksums != NULL)
+        local_compute_checksums (tree, directory, path, checksums, &ierror);
+
+      if (checksums != NULL)
+        g_ptr_array_free (checksums, TRUE);
+      g_string_free (path_buf, TRUE);
+      g_free (path);
+
+      if (ierror != NULL)
+        {
+          g_propagate_error (error, ierror);
+          return FALSE;
+        }
+
+      return TRUE;
+    }
+#endif
+
+
+  rudgiosync_trace_begin (&span);
+  enumerator = g_file_enumerate_children (descriptor,
+                                          ENTRY_ATTRIBUTES,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL,
+                                          &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_ENUMERATE, descriptor, -1);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the children of the directory `%s': ", uri);
+      return FALSE;
+    }
+  while (TRUE)
+    {
+      rudgiosync_trace_begin (&span);
+      child_info = g_file_enumerator_next_file (enumerator, NULL, &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_ENUMERATE, descriptor, -1);
+      if (ierror != NULL)
+        {
+          g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
+
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+      if (child_info == NULL)
+        {
+          break;
+        }
+      if (g_file_info_get_attribute_byte_string (child_info, G_FILE_ATTRIBUTE_STANDARD_NAME) == NULL)
+        {
+          g_set_error (error, RUDGIOSYNC_ERROR,
+                       RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                       "Failed to retrieve information about a child of the directory `%s': %s",
+                       uri,
+                       "Filename information missing in GFileInfo retrieved from GFileEnumerator");
+
+          g_object_unref (child_info);
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+
+      child_entry = entry_new_from_info (tree, directory, child_info, &ierror);
+      if (ierror != NULL)
+        {
+          child_descriptor = g_file_get_child (descriptor, g_file_info_get_attribute_byte_string (child_info, G_FILE_ATTRIBUTE_STANDARD_NAME));
+          child_uri = g_file_get_uri (child_descriptor);
+          g_prefix_error (&ierror, "Failed to retrieve information about the file `%s': ", child_uri);
+          g_free (child_uri);
+          g_object_unref (child_descriptor);
+        }
+      else if (child_entry->type == RUDGIOSYNC_DIR_ENTRY_DIR
+               || (child_entry->type == RUDGIOSYNC_DIR_ENTRY_FILE && checksum_wanted
+                   && !rudgiosync_resume_is_leftover (child_entry->name)))
+        {
+          /* Only entries whose contents are to be examined need a GFile. */
+          child_descriptor = g_file_get_child (descriptor, child_entry->name);
+          child_uri = g_file_get_uri (child_descriptor);
+
+          if (child_entry->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+            scan_directory (tree, child_entry, child_descriptor, child_uri, checksum_wanted, &ierror);
+          else
+            compute_checksum (tree, child_entry, child_descriptor, child_uri, &ierror);
+
+          g_free (child_uri);
+          g_object_unref (child_descriptor);
+        }
+      g_object_unref (child_info);
+
+      if (ierror != NULL)
+        {
+          g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
+
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+
+      rudgiosync_directory_entry_link (directory, child_entry);
+    }
+
+  g_object_unref (enumerator);
+  return TRUE;
 }
 
 RudgiosyncDirectoryEntry *
-rudgiosync_directory_entry_new (GFile *descriptor, gboolean checksum_wanted, GError **error)
+rudgiosync_directory_entry_new (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *parent, GFile *descriptor, gboolean checksum_wanted, GError **error)
 {
   RudgiosyncDirectoryEntry *retval;
 
-  gchar      *uri;
-  GFileInfo  *info;
-  GError     *ierror = NULL;
+  RudgiosyncTraceSpan  span;
+  gchar               *uri;
+  GFileInfo           *info;
+  GError              *ierror = NULL;
 
   uri = g_file_get_uri (descriptor);
+  rudgiosync_trace_begin (&span);
   info = g_file_query_info (descriptor,
-                            G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-                            G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                            G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","
-                            G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-                            G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                            ENTRY_ATTRIBUTES,
                             G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                             NULL,
                             &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, descriptor, -1);
   if (ierror != NULL)
     {
       g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the file `%s': ", uri);
@@ -202,37 +567,164 @@ rudgiosync_directory_entry_new (GFile *descriptor, gboolean checksum_wanted, GEr
       return NULL;
     }
 
-  retval = rudgiosync_directory_entry_new_internal (uri, descriptor, info, checksum_wanted, error);
-
+  retval = entry_new_from_info (tree, parent, info, &ierror);
   g_object_unref (info);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the file `%s': ", uri);
+
+      g_free (uri);
+      return NULL;
+    }
+
+  switch (retval->type)
+    {
+      case RUDGIOSYNC_DIR_ENTRY_FILE:
+        if (checksum_wanted)
+          compute_checksum (tree, retval, descriptor, uri, &ierror);
+        break;
+
+      case RUDGIOSYNC_DIR_ENTRY_DIR:
+        scan_directory (tree, retval, descriptor, uri, checksum_wanted, &ierror);
+        break;
+    }
   g_free (uri);
 
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return NULL;
+    }
+
   return retval;
 }
 
 
+RudgiosyncTree *
+rudgiosync_tree_new (GFile *descriptor, gboolean checksum_wanted, GError **error)
+{
+  RudgiosyncTree *retval;
+  GError *ierror = NULL;
+
+  retval = g_slice_new0 (RudgiosyncTree);
+  rudgiosync_arena_init (&(retval->arena));
+  retval->descriptor = g_object_ref (descriptor);
+
+  retval->root = rudgiosync_directory_entry_new (retval, NULL, descriptor, checksum_wanted, &ierror);
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+
+      rudgiosync_tree_free (retval);
+      return NULL;
+    }
+
+  return retval;
+}
+
+void
+rudgiosync_tree_free (RudgiosyncTree *tree)
+{
+  if (tree == NULL)
+    return;
+
+  g_object_unref (tree->descriptor);
+  rudgiosync_arena_clear (&(tree->arena));
+
+  g_slice_free (RudgiosyncTree, tree);
+}
+
+
 void
-rudgiosync_directory_entry_free (gpointer to_free_in)
+rudgiosync_directory_entry_link (RudgiosyncDirectoryEntry *directory, RudgiosyncDirectoryEntry *entry)
 {
-  RudgiosyncDirectoryEntry *to_free = (RudgiosyncDirectoryEntry *)to_free_in;
+  g_assert (directory->type == RUDGIOSYNC_DIR_ENTRY_DIR);
 
-  if (to_free == NULL)
+  entry->parent = directory;
+  entry->next = directory->data.directory.entries;
+  directory->data.directory.entries = entry;
+}
+
+void
+rudgiosync_directory_entry_unlink (RudgiosyncDirectoryEntry *entry)
+{
+  RudgiosyncDirectoryEntry **link;
+
+  if (entry->parent == NULL)
     return;
 
-  if (to_free->descriptor != NULL)
+  for (link = &(entry->parent->data.directory.entries);
+       *link != NULL;
+       link = &((*link)->next))
+    {
+      if (*link == entry)
+        {
+          *link = entry->next;
+          break;
+        }
+    }
+  entry->next = NULL;
+}
+
+gchar *
+rudgiosync_directory_entry_get_path (RudgiosyncDirectoryEntry *entry)
+{
+  RudgiosyncDirectoryEntry *iter;
+  gchar *retval;
+  gsize  length = 0;
+  gsize  name_length;
+  gsize  position;
+
+  /* Entries only know their parents, so the path is built from the end. */
+  for (iter = entry; iter->parent != NULL; iter = iter->parent)
     {
-      g_object_unref (to_free->descriptor);
+      length += strlen (iter->name) + 1;
     }
+  if (length == 0)
+    return g_strdup ("");
 
-  g_free (to_free->name);
-  g_free (to_free->display_name);
+  retval = g_malloc (length);
+  position = length - 1;
+  retval[position] = '\0';
 
-  switch (to_free->type)
+  for (iter = entry; iter->parent != NULL; iter = iter->parent)
     {
-      case RUDGIOSYNC_DIR_ENTRY_DIR:
-        g_slist_free_full (to_free->data.directory.entries, rudgiosync_directory_entry_free);
-        break;
+      name_length = strlen (iter->name);
+      position -= name_length;
+      memcpy (retval + position, iter->name, name_length);
+
+      if (position > 0)
+        retval[--position] = '/';
     }
 
-  g_slice_free (RudgiosyncDirectoryEntry, to_free);
+  return retval;
+}
+
+GFile *
+rudgiosync_directory_entry_get_descriptor (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *entry)
+{
+  GFile *retval;
+  gchar *path;
+
+  if (entry->parent == NULL)
+    return g_object_ref (tree->descriptor);
+
+  path = rudgiosync_directory_entry_get_path (entry);
+  retval = g_file_resolve_relative_path (tree->descriptor, path);
+  g_free (path);
+
+  return retval;
+}
+
+gchar *
+rudgiosync_directory_entry_get_uri (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *entry)
+{
+  GFile *descriptor;
+  gchar *retval;
+
+  descriptor = rudgiosync_directory_entry_get_descriptor (tree, entry);
+  retval = g_file_get_uri (descriptor);
+  g_object_unref (descriptor);
+
+  return retval;
 }
@@ -21,21 +21,23 @@
 
 #include "boiler.h"
 #include "checksum.h"
+#include "arena.h"
 
 
 typedef struct RudgiosyncFile_ RudgiosyncFile;
 typedef struct RudgiosyncDirectory_ RudgiosyncDirectory;
 typedef struct RudgiosyncDirectoryEntry_ RudgiosyncDirectoryEntry;
+typedef struct RudgiosyncTree_ RudgiosyncTree;
 
 struct RudgiosyncFile_
 {
   guint64 size;
-  RudgiosyncChecksum checksum;
+  RudgiosyncChecksum *checksum;   /* NULL unless a checksum was wanted. */
 };
 
 struct RudgiosyncDirectory_
 {
-  GSList *entries;   /* of type RudgiosyncDirectoryEntry */
+  RudgiosyncDirectoryEntry *entries;   /* Linked through the `next' field. */
 };
 
 enum
@@ -45,13 +47,22 @@ enum
   RUDGIOSYNC_DIR_ENTRY_OTHER
 };
 
+/**
+ * Directory entries are allocated from the arena of the tree they belong to,
+ * and are never freed individually.  No GFile is kept around for them, one
+ * may be obtained on demand with rudgiosync_directory_entry_get_descriptor.
+ *
+ * The display name points to the same storage as the name unless the two
+ * differ.
+ */
 struct RudgiosyncDirectoryEntry_
 {
-  guint   type;
-  GFile  *descriptor;
-  gchar  *name;
-  gchar  *display_name;
-  guint64 modified_time;
+  RudgiosyncDirectoryEntry *parent;
+  RudgiosyncDirectoryEntry *next;
+  const gchar *name;
+  const gchar *display_name;
+  guint64      modified_time;
+  guint        type;
 
   union
     {
@@ -60,10 +71,41 @@ struct RudgiosyncDirectoryEntry_
     } data;
 };
 
+struct RudgiosyncTree_
+{
+  GFile                    *descriptor;   /* Of the root entry. */
+  RudgiosyncDirectoryEntry *root;
+  RudgiosyncArena           arena;
+};
+
+
+/* Examine the file or directory tree at the given location. */
+RudgiosyncTree *rudgiosync_tree_new (GFile *descriptor, gboolean checksum_wanted, GError **error);
+
+/* Release a tree, along with all of its entries. */
+void rudgiosync_tree_free (RudgiosyncTree *tree);
+
+
+/**
+ * Examine the given location, allocating the resulting entry from the tree,
+ * with the given parent, but without linking it into the parent's entries.
+ */
+RudgiosyncDirectoryEntry *rudgiosync_directory_entry_new (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *parent, GFile *descriptor, gboolean checksum_wanted, GError **error);
+
+/* Add an entry to the entries of a directory. */
+void rudgiosync_directory_entry_link (RudgiosyncDirectoryEntry *directory, RudgiosyncDirectoryEntry *entry);
+
+/* Remove an entry from the entries of its parent directory, if it has one. */
+void rudgiosync_directory_entry_unlink (RudgiosyncDirectoryEntry *entry);
+
+/* Return the path of an entry relative to the root of its tree. */
+gchar *rudgiosync_directory_entry_get_path (RudgiosyncDirectoryEntry *entry);
 
-RudgiosyncDirectoryEntry *rudgiosync_directory_entry_new (GFile *descriptor, gboolean checksum_wanted, GError **error);
+/* Create a GFile for the given entry of the given tree. */
+GFile *rudgiosync_directory_entry_get_descriptor (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *entry);
 
-void rudgiosync_directory_entry_free (gpointer to_free);
+/* Return the URI of the given entry of the given tree. */
+gchar *rudgiosync_directory_entry_get_uri (RudgiosyncTree *tree, RudgiosyncDirectoryEntry *entry);
 
 
 #endif /* _RUDGIOSYNC_DESCRIPTIONS_H_ */
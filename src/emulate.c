@@ -0,0 +1,869 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "emulate.h"
+#include "stats.h"
+
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+
+/* Listings arrive in batches of this many entries a round trip, as in gvfs. */
+#define EMULATE_LISTING_BATCH 100
+
+
+struct RudgiosyncEmulation_
+{
+  gint64   latency;           /* Of a round trip, in microseconds. */
+  guint64  bandwidth;         /* In bytes per second, 0 for unlimited. */
+  gboolean serial;            /* Operations take turns. */
+  guint64  granularity;       /* Of modification times, in seconds. */
+
+  GMutex   turn;              /* Held through operations, when serial. */
+  GMutex   link_lock;
+  gint64   link_free;         /* When the transfers so far will be done. */
+};
+
+typedef struct
+{
+  const gchar *name;
+  gint64       latency;       /* In milliseconds. */
+  guint64      bandwidth;
+  gboolean     serial;
+  guint64      granularity;
+} EmulateProfile;
+
+static const EmulateProfile emulate_profiles[] =
+{
+  /* name    latency  bandwidth           serial  granularity */
+  { "none",  0,       0,                  FALSE,  0 },
+  { "mtp",   30,      16 * 1024 * 1024,   TRUE,   1 },
+  { "sftp",  20,      8 * 1024 * 1024,    FALSE,  1 },
+  { "fat",   1,       32 * 1024 * 1024,   FALSE,  2 },
+  { NULL }
+};
+
+
+/* Parse a number with an optional K, M or G (binary) suffix. */
+static gboolean
+emulate_parse_number (const gchar *value, gboolean suffixed, guint64 *number)
+{
+  gchar   *suffix;
+  guint64  multiplier = 1;
+
+  *number = g_ascii_strtoull (value, &suffix, 10);
+  if (suffixed && *suffix != '\0')
+    {
+      switch (g_ascii_toupper (*suffix))
+        {
+          case 'K': multiplier = 1024;               break;
+          case 'M': multiplier = 1024 * 1024;        break;
+          case 'G': multiplier = 1024 * 1024 * 1024; break;
+          default:  return FALSE;
+        }
+      suffix++;
+    }
+
+  *number *= multiplier;
+  return suffix != value && *suffix == '\0';
+}
+
+/* The value of a KEY=VALUE setting, if it's for the given key. */
+static const gchar *
+emulate_setting (const gchar *field, const gchar *key)
+{
+  gsize length = strlen (key);
+
+  return (strncmp (field, key, length) == 0 && field[length] == '=') ? field + length + 1 : NULL;
+}
+
+RudgiosyncEmulation *
+rudgiosync_emulation_new (const gchar *spec, GError **error)
+{
+  RudgiosyncEmulation  *retval;
+  const EmulateProfile *profile;
+  gchar               **fields;
+  const gchar          *value;
+  guint64               number;
+  guint                 iter;
+  gboolean              valid;
+
+  fields = g_strsplit (spec, ",", -1);
+  for (profile = emulate_profiles; profile->name != NULL; profile++)
+    {
+      if (fields[0] != NULL && strcmp (fields[0], profile->name) == 0)
+        break;
+    }
+  if (profile->name == NULL)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Unknown backend `%s' to emulate, expected mtp, sftp, fat or none",
+                   fields[0] != NULL ? fields[0] : "");
+      g_strfreev (fields);
+      return NULL;
+    }
+
+  retval = g_new0 (RudgiosyncEmulation, 1);
+  retval->latency = profile->latency * 1000;
+  retval->bandwidth = profile->bandwidth;
+  retval->serial = profile->serial;
+  retval->granularity = profile->granularity;
+  g_mutex_init (&(retval->turn));
+  g_mutex_init (&(retval->link_lock));
+
+  for (iter = 1; fields[iter] != NULL; iter++)
+    {
+      if ((value = emulate_setting (fields[iter], "latency")) != NULL)
+        {
+          valid = emulate_parse_number (value, FALSE, &number);
+          retval->latency = (gint64)number * 1000;
+        }
+      else if ((value = emulate_setting (fields[iter], "bandwidth")) != NULL)
+        valid = emulate_parse_number (value, TRUE, &(retval->bandwidth));
+      else if ((value = emulate_setting (fields[iter], "mtime")) != NULL)
+        valid = emulate_parse_number (value, FALSE, &(retval->granularity));
+      else if ((value = emulate_setting (fields[iter], "serial")) != NULL)
+        {
+          valid = (strcmp (value, "yes") == 0 || strcmp (value, "no") == 0);
+          retval->serial = (strcmp (value, "yes") == 0);
+        }
+      else
+        valid = FALSE;
+
+      if (!valid)
+        {
+          g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                       "Invalid emulation setting `%s'", fields[iter]);
+          g_strfreev (fields);
+          g_mutex_clear (&(retval->turn));
+          g_mutex_clear (&(retval->link_lock));
+          g_free (retval);
+          return NULL;
+        }
+    }
+
+  g_strfreev (fields);
+  return retval;
+}
+
+
+/* Start an operation, waiting for its turn and for the round trip. */
+static void
+emulate_begin (RudgiosyncEmulation *emulation)
+{
+  if (emulation->serial)
+    g_mutex_lock (&(emulation->turn));
+  if (emulation->latency > 0)
+    g_usleep (emulation->latency);
+
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_ROUND_TRIPS, 1);
+}
+
+/* Finish an operation which moved the given amount of data, which waits
+   behind whatever else is being moved, however many threads are at it. */
+static void
+emulate_end (RudgiosyncEmulation *emulation, guint64 bytes)
+{
+  gint64 now;
+  gint64 done;
+
+  if (emulation->bandwidth > 0 && bytes > 0)
+    {
+      g_mutex_lock (&(emulation->link_lock));
+      now = g_get_monotonic_time ();
+      done = MAX (now, emulation->link_free) + (gint64)(bytes * G_USEC_PER_SEC / emulation->bandwidth);
+      emulation->link_free = done;
+      g_mutex_unlock (&(emulation->link_lock));
+
+      g_usleep (done - now);
+    }
+
+  if (emulation->serial)
+    g_mutex_unlock (&(emulation->turn));
+}
+
+/* Drop the precision of the modification time the backend can't keep. */
+static GFileInfo *
+emulate_info (RudgiosyncEmulation *emulation, GFileInfo *info)
+{
+  guint64 modified;
+
+  if (info != NULL && emulation->granularity > 1
+      && g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    {
+      modified = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                        modified - modified % emulation->granularity);
+    }
+  if (info != NULL && emulation->granularity > 0)
+    g_file_info_remove_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+  return info;
+}
+
+
+/* Input streams, paying for every read. */
+
+typedef struct
+{
+  GFileInputStream     parent;
+  GInputStream        *real;
+  RudgiosyncEmulation *emulation;
+} EmulatedInputStream;
+
+typedef struct
+{
+  GFileInputStreamClass parent_class;
+} EmulatedInputStreamClass;
+
+G_DEFINE_TYPE (EmulatedInputStream, emulated_input_stream, G_TYPE_FILE_INPUT_STREAM)
+
+static gssize
+emulated_input_stream_read (GInputStream *stream, void *buffer, gsize count,
+                            GCancellable *cancellable, GError **error)
+{
+  EmulatedInputStream *self = (EmulatedInputStream *)stream;
+  gssize               retval;
+
+  emulate_begin (self->emulation);
+  retval = g_input_stream_read (self->real, buffer, count, cancellable, error);
+  emulate_end (self->emulation, MAX (retval, 0));
+
+  return retval;
+}
+
+static gboolean
+emulated_input_stream_close (GInputStream *stream, GCancellable *cancellable, GError **error)
+{
+  EmulatedInputStream *self = (EmulatedInputStream *)stream;
+  gboolean             retval;
+
+  emulate_begin (self->emulation);
+  retval = g_input_stream_close (self->real, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static GFileInfo *
+emulated_input_stream_query_info (GFileInputStream *stream, const char *attributes,
+                                  GCancellable *cancellable, GError **error)
+{
+  EmulatedInputStream *self = (EmulatedInputStream *)stream;
+  GFileInfo           *retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_input_stream_query_info (G_FILE_INPUT_STREAM (self->real), attributes, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return emulate_info (self->emulation, retval);
+}
+
+static void
+emulated_input_stream_finalize (GObject *object)
+{
+  g_object_unref (((EmulatedInputStream *)object)->real);
+
+  G_OBJECT_CLASS (emulated_input_stream_parent_class)->finalize (object);
+}
+
+static void
+emulated_input_stream_class_init (EmulatedInputStreamClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = emulated_input_stream_finalize;
+  G_INPUT_STREAM_CLASS (klass)->read_fn = emulated_input_stream_read;
+  G_INPUT_STREAM_CLASS (klass)->close_fn = emulated_input_stream_close;
+  G_FILE_INPUT_STREAM_CLASS (klass)->query_info = emulated_input_stream_query_info;
+}
+
+static void
+emulated_input_stream_init (EmulatedInputStream *self)
+{
+}
+
+
+/* Output streams, paying for every write.  Seeking costs nothing, since it
+   only moves where the next write goes. */
+
+typedef struct
+{
+  GFileOutputStream    parent;
+  GOutputStream       *real;
+  RudgiosyncEmulation *emulation;
+} EmulatedOutputStream;
+
+typedef struct
+{
+  GFileOutputStreamClass parent_class;
+} EmulatedOutputStreamClass;
+
+G_DEFINE_TYPE (EmulatedOutputStream, emulated_output_stream, G_TYPE_FILE_OUTPUT_STREAM)
+
+static gssize
+emulated_output_stream_write (GOutputStream *stream, const void *buffer, gsize count,
+                              GCancellable *cancellable, GError **error)
+{
+  EmulatedOutputStream *self = (EmulatedOutputStream *)stream;
+  gssize                retval;
+
+  emulate_begin (self->emulation);
+  retval = g_output_stream_write (self->real, buffer, count, cancellable, error);
+  emulate_end (self->emulation, MAX (retval, 0));
+
+  return retval;
+}
+
+static gboolean
+emulated_output_stream_flush (GOutputStream *stream, GCancellable *cancellable, GError **error)
+{
+  return g_output_stream_flush (((EmulatedOutputStream *)stream)->real, cancellable, error);
+}
+
+static gboolean
+emulated_output_stream_close (GOutputStream *stream, GCancellable *cancellable, GError **error)
+{
+  EmulatedOutputStream *self = (EmulatedOutputStream *)stream;
+  gboolean              retval;
+
+  emulate_begin (self->emulation);
+  retval = g_output_stream_close (self->real, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static goffset
+emulated_output_stream_tell (GFileOutputStream *stream)
+{
+  return g_seekable_tell (G_SEEKABLE (((EmulatedOutputStream *)stream)->real));
+}
+
+static gboolean
+emulated_output_stream_can_seek (GFileOutputStream *stream)
+{
+  return g_seekable_can_seek (G_SEEKABLE (((EmulatedOutputStream *)stream)->real));
+}
+
+static gboolean
+emulated_output_stream_seek (GFileOutputStream *stream, goffset offset, GSeekType type,
+                             GCancellable *cancellable, GError **error)
+{
+  return g_seekable_seek (G_SEEKABLE (((EmulatedOutputStream *)stream)->real), offset, type, cancellable, error);
+}
+
+static gboolean
+emulated_output_stream_can_truncate (GFileOutputStream *stream)
+{
+  return g_seekable_can_truncate (G_SEEKABLE (((EmulatedOutputStream *)stream)->real));
+}
+
+static gboolean
+emulated_output_stream_truncate (GFileOutputStream *stream, goffset size,
+                                 GCancellable *cancellable, GError **error)
+{
+  EmulatedOutputStream *self = (EmulatedOutputStream *)stream;
+  gboolean              retval;
+
+  emulate_begin (self->emulation);
+  retval = g_seekable_truncate (G_SEEKABLE (self->real), size, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static void
+emulated_output_stream_finalize (GObject *object)
+{
+  g_object_unref (((EmulatedOutputStream *)object)->real);
+
+  G_OBJECT_CLASS (emulated_output_stream_parent_class)->finalize (object);
+}
+
+static void
+emulated_output_stream_class_init (EmulatedOutputStreamClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = emulated_output_stream_finalize;
+  G_OUTPUT_STREAM_CLASS (klass)->write_fn = emulated_output_stream_write;
+  G_OUTPUT_STREAM_CLASS (klass)->flush = emulated_output_stream_flush;
+  G_OUTPUT_STREAM_CLASS (klass)->close_fn = emulated_output_stream_close;
+  G_FILE_OUTPUT_STREAM_CLASS (klass)->tell = emulated_output_stream_tell;
+  G_FILE_OUTPUT_STREAM_CLASS (klass)->can_seek = emulated_output_stream_can_seek;
+  G_FILE_OUTPUT_STREAM_CLASS (klass)->seek = emulated_output_stream_seek;
+  G_FILE_OUTPUT_STREAM_CLASS (klass)->can_truncate = emulated_output_stream_can_truncate;
+  G_FILE_OUTPUT_STREAM_CLASS (klass)->truncate_fn = emulated_output_stream_truncate;
+}
+
+static void
+emulated_output_stream_init (EmulatedOutputStream *self)
+{
+}
+
+
+/* Directory listings, paying a round trip a batch. */
+
+typedef struct
+{
+  GFileEnumerator      parent;
+  GFileEnumerator     *real;
+  RudgiosyncEmulation *emulation;
+  guint                listed;
+} EmulatedEnumerator;
+
+typedef struct
+{
+  GFileEnumeratorClass parent_class;
+} EmulatedEnumeratorClass;
+
+G_DEFINE_TYPE (EmulatedEnumerator, emulated_enumerator, G_TYPE_FILE_ENUMERATOR)
+
+static GFileInfo *
+emulated_enumerator_next_file (GFileEnumerator *enumerator, GCancellable *cancellable, GError **error)
+{
+  EmulatedEnumerator *self = (EmulatedEnumerator *)enumerator;
+  GFileInfo          *retval;
+  gboolean            batch;
+
+  batch = (self->listed++ % EMULATE_LISTING_BATCH == 0);
+  if (batch)
+    emulate_begin (self->emulation);
+  retval = g_file_enumerator_next_file (self->real, cancellable, error);
+  if (batch)
+    emulate_end (self->emulation, 0);
+
+  return emulate_info (self->emulation, retval);
+}
+
+static gboolean
+emulated_enumerator_close (GFileEnumerator *enumerator, GCancellable *cancellable, GError **error)
+{
+  return g_file_enumerator_close (((EmulatedEnumerator *)enumerator)->real, cancellable, error);
+}
+
+static void
+emulated_enumerator_finalize (GObject *object)
+{
+  /* The parent would close it only once the real one is gone. */
+  if (!g_file_enumerator_is_closed (G_FILE_ENUMERATOR (object)))
+    g_file_enumerator_close (G_FILE_ENUMERATOR (object), NULL, NULL);
+  g_object_unref (((EmulatedEnumerator *)object)->real);
+
+  G_OBJECT_CLASS (emulated_enumerator_parent_class)->finalize (object);
+}
+
+static void
+emulated_enumerator_class_init (EmulatedEnumeratorClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = emulated_enumerator_finalize;
+  G_FILE_ENUMERATOR_CLASS (klass)->next_file = emulated_enumerator_next_file;
+  G_FILE_ENUMERATOR_CLASS (klass)->close_fn = emulated_enumerator_close;
+}
+
+static void
+emulated_enumerator_init (EmulatedEnumerator *self)
+{
+}
+
+
+/* The files themselves.  Being remote, they have no local path, so that the
+   program takes the same way as it would on a real slow backend. */
+
+typedef struct
+{
+  GObject              parent;
+  GFile               *real;
+  RudgiosyncEmulation *emulation;
+} EmulatedFile;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} EmulatedFileClass;
+
+static void emulated_file_iface_init (GFileIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmulatedFile, emulated_file, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_FILE, emulated_file_iface_init))
+
+#define EMULATED_FILE(object) ((EmulatedFile *)(object))
+
+/* Wrap the file, taking over the reference to it. */
+static GFile *
+emulated_file_new (GFile *real, RudgiosyncEmulation *emulation)
+{
+  EmulatedFile *retval;
+
+  retval = g_object_new (emulated_file_get_type (), NULL);
+  retval->real = real;
+  retval->emulation = emulation;
+
+  return G_FILE (retval);
+}
+
+/* Wrap a file on the same backend as the given one, if there's any. */
+static GFile *
+emulated_file_wrap (GFile *relative, GFile *real)
+{
+  if (real == NULL)
+    return NULL;
+
+  return emulated_file_new (real, EMULATED_FILE (relative)->emulation);
+}
+
+static GFile *
+emulated_file_dup (GFile *file)
+{
+  return emulated_file_wrap (file, g_file_dup (EMULATED_FILE (file)->real));
+}
+
+static guint
+emulated_file_hash (GFile *file)
+{
+  return g_file_hash (EMULATED_FILE (file)->real);
+}
+
+static gboolean
+emulated_file_equal (GFile *file1, GFile *file2)
+{
+  return g_file_equal (EMULATED_FILE (file1)->real, EMULATED_FILE (file2)->real);
+}
+
+static gboolean
+emulated_file_is_native (GFile *file)
+{
+  return FALSE;
+}
+
+static gboolean
+emulated_file_has_uri_scheme (GFile *file, const char *uri_scheme)
+{
+  return g_file_has_uri_scheme (EMULATED_FILE (file)->real, uri_scheme);
+}
+
+static char *
+emulated_file_get_uri_scheme (GFile *file)
+{
+  return g_file_get_uri_scheme (EMULATED_FILE (file)->real);
+}
+
+static char *
+emulated_file_get_basename (GFile *file)
+{
+  return g_file_get_basename (EMULATED_FILE (file)->real);
+}
+
+static char *
+emulated_file_get_path (GFile *file)
+{
+  return NULL;
+}
+
+static char *
+emulated_file_get_uri (GFile *file)
+{
+  return g_file_get_uri (EMULATED_FILE (file)->real);
+}
+
+static char *
+emulated_file_get_parse_name (GFile *file)
+{
+  return g_file_get_parse_name (EMULATED_FILE (file)->real);
+}
+
+static GFile *
+emulated_file_get_parent (GFile *file)
+{
+  return emulated_file_wrap (file, g_file_get_parent (EMULATED_FILE (file)->real));
+}
+
+static gboolean
+emulated_file_prefix_matches (GFile *prefix, GFile *file)
+{
+  return g_file_has_prefix (EMULATED_FILE (file)->real, EMULATED_FILE (prefix)->real);
+}
+
+static char *
+emulated_file_get_relative_path (GFile *parent, GFile *descendant)
+{
+  return g_file_get_relative_path (EMULATED_FILE (parent)->real, EMULATED_FILE (descendant)->real);
+}
+
+static GFile *
+emulated_file_resolve_relative_path (GFile *file, const char *relative_path)
+{
+  return emulated_file_wrap (file, g_file_resolve_relative_path (EMULATED_FILE (file)->real, relative_path));
+}
+
+static GFile *
+emulated_file_get_child_for_display_name (GFile *file, const char *display_name, GError **error)
+{
+  return emulated_file_wrap (file, g_file_get_child_for_display_name (EMULATED_FILE (file)->real,
+                                                                      display_name, error));
+}
+
+static GFileEnumerator *
+emulated_file_enumerate_children (GFile *file, const char *attributes, GFileQueryInfoFlags flags,
+                                  GCancellable *cancellable, GError **error)
+{
+  EmulatedFile       *self = EMULATED_FILE (file);
+  EmulatedEnumerator *retval;
+  GFileEnumerator    *real;
+
+  emulate_begin (self->emulation);
+  real = g_file_enumerate_children (self->real, attributes, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+  if (real == NULL)
+    return NULL;
+
+  retval = g_object_new (emulated_enumerator_get_type (), "container", file, NULL);
+  retval->real = real;
+  retval->emulation = self->emulation;
+
+  return G_FILE_ENUMERATOR (retval);
+}
+
+static GFileInfo *
+emulated_file_query_info (GFile *file, const char *attributes, GFileQueryInfoFlags flags,
+                          GCancellable *cancellable, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (file);
+  GFileInfo    *retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_query_info (self->real, attributes, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return emulate_info (self->emulation, retval);
+}
+
+static GFileInfo *
+emulated_file_query_filesystem_info (GFile *file, const char *attributes,
+                                     GCancellable *cancellable, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (file);
+  GFileInfo    *retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_query_filesystem_info (self->real, attributes, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static gboolean
+emulated_file_set_attribute (GFile *file, const char *attribute, GFileAttributeType type,
+                             gpointer value_p, GFileQueryInfoFlags flags,
+                             GCancellable *cancellable, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (file);
+  gboolean      retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_set_attribute (self->real, attribute, type, value_p, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static GFileInputStream *
+emulated_file_read (GFile *file, GCancellable *cancellable, GError **error)
+{
+  EmulatedFile        *self = EMULATED_FILE (file);
+  EmulatedInputStream *retval;
+  GFileInputStream    *real;
+
+  emulate_begin (self->emulation);
+  real = g_file_read (self->real, cancellable, error);
+  emulate_end (self->emulation, 0);
+  if (real == NULL)
+    return NULL;
+
+  retval = g_object_new (emulated_input_stream_get_type (), NULL);
+  retval->real = G_INPUT_STREAM (real);
+  retval->emulation = self->emulation;
+
+  return G_FILE_INPUT_STREAM (retval);
+}
+
+/* Wrap a freshly opened output stream. */
+static GFileOutputStream *
+emulated_file_output (EmulatedFile *self, GFileOutputStream *real)
+{
+  EmulatedOutputStream *retval;
+
+  if (real == NULL)
+    return NULL;
+
+  retval = g_object_new (emulated_output_stream_get_type (), NULL);
+  retval->real = G_OUTPUT_STREAM (real);
+  retval->emulation = self->emulation;
+
+  return G_FILE_OUTPUT_STREAM (retval);
+}
+
+static GFileOutputStream *
+emulated_file_create (GFile *file, GFileCreateFlags flags,
+                      GCancellable *cancellable, GError **error)
+{
+  EmulatedFile      *self = EMULATED_FILE (file);
+  GFileOutputStream *real;
+
+  emulate_begin (self->emulation);
+  real = g_file_create (self->real, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return emulated_file_output (self, real);
+}
+
+static GFileOutputStream *
+emulated_file_append_to (GFile *file, GFileCreateFlags flags,
+                         GCancellable *cancellable, GError **error)
+{
+  EmulatedFile      *self = EMULATED_FILE (file);
+  GFileOutputStream *real;
+
+  emulate_begin (self->emulation);
+  real = g_file_append_to (self->real, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return emulated_file_output (self, real);
+}
+
+static GFileOutputStream *
+emulated_file_replace (GFile *file, const char *etag, gboolean make_backup, GFileCreateFlags flags,
+                       GCancellable *cancellable, GError **error)
+{
+  EmulatedFile      *self = EMULATED_FILE (file);
+  GFileOutputStream *real;
+
+  emulate_begin (self->emulation);
+  real = g_file_replace (self->real, etag, make_backup, flags, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return emulated_file_output (self, real);
+}
+
+static gboolean
+emulated_file_delete (GFile *file, GCancellable *cancellable, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (file);
+  gboolean      retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_delete (self->real, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+/* A rename on the backend, between two of its files. */
+static gboolean
+emulated_file_move (GFile *source, GFile *destination, GFileCopyFlags flags,
+                    GCancellable *cancellable, GFileProgressCallback progress_callback,
+                    gpointer progress_callback_data, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (source);
+  gboolean      retval;
+
+  if (G_OBJECT_TYPE (destination) != G_OBJECT_TYPE (source))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Operation not supported");
+      return FALSE;
+    }
+
+  emulate_begin (self->emulation);
+  retval = g_file_move (self->real, EMULATED_FILE (destination)->real, flags,
+                        cancellable, progress_callback, progress_callback_data, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static gboolean
+emulated_file_make_directory (GFile *file, GCancellable *cancellable, GError **error)
+{
+  EmulatedFile *self = EMULATED_FILE (file);
+  gboolean      retval;
+
+  emulate_begin (self->emulation);
+  retval = g_file_make_directory (self->real, cancellable, error);
+  emulate_end (self->emulation, 0);
+
+  return retval;
+}
+
+static void
+emulated_file_finalize (GObject *object)
+{
+  g_object_unref (EMULATED_FILE (object)->real);
+
+  G_OBJECT_CLASS (emulated_file_parent_class)->finalize (object);
+}
+
+/* The asynchronous operations are left to GIO, which runs the above in
+   threads of its own. */
+static void
+emulated_file_iface_init (GFileIface *iface)
+{
+  iface->dup = emulated_file_dup;
+  iface->hash = emulated_file_hash;
+  iface->equal = emulated_file_equal;
+  iface->is_native = emulated_file_is_native;
+  iface->has_uri_scheme = emulated_file_has_uri_scheme;
+  iface->get_uri_scheme = emulated_file_get_uri_scheme;
+  iface->get_basename = emulated_file_get_basename;
+  iface->get_path = emulated_file_get_path;
+  iface->get_uri = emulated_file_get_uri;
+  iface->get_parse_name = emulated_file_get_parse_name;
+  iface->get_parent = emulated_file_get_parent;
+  iface->prefix_matches = emulated_file_prefix_matches;
+  iface->get_relative_path = emulated_file_get_relative_path;
+  iface->resolve_relative_path = emulated_file_resolve_relative_path;
+  iface->get_child_for_display_name = emulated_file_get_child_for_display_name;
+  iface->enumerate_children = emulated_file_enumerate_children;
+  iface->query_info = emulated_file_query_info;
+  iface->query_filesystem_info = emulated_file_query_filesystem_info;
+  iface->set_attribute = emulated_file_set_attribute;
+  iface->read_fn = emulated_file_read;
+  iface->append_to = emulated_file_append_to;
+  iface->create = emulated_file_create;
+  iface->replace = emulated_file_replace;
+  iface->delete_file = emulated_file_delete;
+  iface->move = emulated_file_move;
+  iface->make_directory = emulated_file_make_directory;
+}
+
+static void
+emulated_file_class_init (EmulatedFileClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = emulated_file_finalize;
+}
+
+static void
+emulated_file_init (EmulatedFile *self)
+{
+}
+
+
+GFile *
+rudgiosync_emulate (GFile *descriptor, RudgiosyncEmulation *emulation)
+{
+  if (emulation == NULL)
+    return descriptor;
+
+  return emulated_file_new (descriptor, emulation);
+}
+
+#endif /* RUDGIOSYNC_EMULATE_ENABLED */
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Emulation of slow backends.
+ *
+ * To see how the program fares on MTP devices, sftp servers or FAT media
+ * without one at hand, a location can be wrapped so that every operation on
+ * it pays for a round trip, its transfers share a limited bandwidth, its
+ * operations take turns, and its modification times lose precision.  The
+ * files underneath are accessed as usual.
+ *
+ * This is a testing aid for the benchmarks, and is only built on request.
+ */
+
+#ifndef _RUDGIOSYNC_EMULATE_H_
+#define _RUDGIOSYNC_EMULATE_H_
+
+#include "boiler.h"
+
+
+typedef struct RudgiosyncEmulation_ RudgiosyncEmulation;
+
+
+/* Parse a specification of the form PROFILE[,KEY=VALUE]..., where the profile
+   is one of mtp, sftp, fat or none, and the keys, which override it, are
+   latency (in milliseconds), bandwidth (in bytes per second, with an optional
+   K, M or G suffix), serial (yes or no) and mtime (the precision of
+   modification times, in seconds). */
+RudgiosyncEmulation *rudgiosync_emulation_new (const gchar *spec,
+                                               GError **error);
+
+/* Wrap the location in the emulation, taking over the reference to it. */
+GFile *rudgiosync_emulate (GFile *descriptor,
+                           RudgiosyncEmulation *emulation);
+
+
+#endif /* _RUDGIOSYNC_EMULATE_H_ */
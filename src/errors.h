@@ -29,7 +29,8 @@ GQuark rudgiosync_error_quark (void);
 enum RudgiosyncError
 {
   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
-  RUDGIOSYNC_DIR_PROTECTION_ERROR
+  RUDGIOSYNC_DIR_PROTECTION_ERROR,
+  RUDGIOSYNC_PLAN_FORMAT_ERROR
 };
 
 #endif /* _RUDGIOSYNC_ERRORS_H_ */
@@ -0,0 +1,311 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "fanout.h"
+#include "operations.h"
+#include "buffers.h"
+#include "sparse.h"
+#include "trace.h"
+
+#define FANOUT_DEPTH 4   /* Buffers read ahead of the slowest destination. */
+
+typedef struct
+{
+  gchar *data;
+  gsize  length;
+  guint  refs;           /* Destinations which have yet to write it. */
+} FanoutChunk;
+
+typedef struct
+{
+  GMutex lock;
+  GCond  released;
+  guint  in_flight;      /* Chunks read, but not written everywhere yet. */
+} FanoutState;
+
+typedef struct
+{
+  FanoutState           *state;
+  GFile                 *destination;
+  GFileOutputStream     *output;
+  RudgiosyncSparseWriter writer;
+  GAsyncQueue           *queue;    /* Chunks to write, up to the end marker. */
+  GThread               *thread;
+  GError                *error;
+} FanoutTarget;
+
+/* Marks the end of the chunks queued for a destination. */
+static FanoutChunk fanout_end;
+
+
+static void
+fanout_release (FanoutState *state, FanoutChunk *chunk)
+{
+  g_mutex_lock (&(state->lock));
+  if (--chunk->refs == 0)
+    {
+      rudgiosync_buffer_release (chunk->data);
+      g_slice_free (FanoutChunk, chunk);
+
+      state->in_flight--;
+      g_cond_signal (&(state->released));
+    }
+  g_mutex_unlock (&(state->lock));
+}
+
+/* A destination which failed only has its chunks released from then on. */
+static void
+fanout_write (FanoutTarget *target, FanoutChunk *chunk)
+{
+  if (target->error == NULL)
+    rudgiosync_sparse_writer_write (&(target->writer), chunk->data, chunk->length, &(target->error));
+
+  fanout_release (target->state, chunk);
+}
+
+static gpointer
+fanout_writer (gpointer data)
+{
+  FanoutTarget *target = data;
+  FanoutChunk  *chunk;
+
+  while ((chunk = g_async_queue_pop (target->queue)) != &fanout_end)
+    fanout_write (target, chunk);
+
+  return NULL;
+}
+
+/* Open a destination for writing, leaving the error with it on failure. */
+static void
+fanout_open (FanoutTarget *target, GFile *source, guint64 size)
+{
+  RudgiosyncTraceSpan span;
+
+  rudgiosync_trace_begin (&span);
+  target->output = g_file_replace (target->destination,
+                                   NULL,
+                                   FALSE,
+                                   G_FILE_CREATE_NONE,
+                                   NULL,
+                                   &(target->error));
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, target->destination, -1);
+  if (target->output == NULL)
+    return;
+
+  rudgiosync_preallocate (G_OUTPUT_STREAM (target->output), size, &(target->error));
+  rudgiosync_sparse_writer_init (&(target->writer), G_OUTPUT_STREAM (target->output),
+                                 !g_file_is_native (source), NULL);
+}
+
+/* Read the source through, handing every buffer to the open destinations. */
+static gboolean
+fanout_transfer (GInputStream *input,
+                 FanoutState *state,
+                 FanoutTarget *targets,
+                 guint count,
+                 gboolean threaded,
+                 RudgiosyncHashContext *hash,
+                 GError **error)
+{
+  RudgiosyncTraceSpan  span;
+  FanoutChunk         *chunk;
+  gchar               *buffer;
+  gssize               read_count;
+  guint                refs;
+  guint                iter;
+
+  while (TRUE)
+    {
+      g_mutex_lock (&(state->lock));
+      while (state->in_flight >= FANOUT_DEPTH)
+        g_cond_wait (&(state->released), &(state->lock));
+      g_mutex_unlock (&(state->lock));
+
+      buffer = rudgiosync_buffer_acquire ();
+      rudgiosync_trace_begin (&span);
+      read_count = g_input_stream_read (input, buffer, RUDGIOSYNC_TRANSFER_BUF_SIZE, NULL, error);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_READ, NULL, MAX (read_count, 0));
+      if (read_count <= 0)
+        {
+          rudgiosync_buffer_release (buffer);
+          return read_count == 0;
+        }
+
+      if (hash != NULL)
+        rudgiosync_hash_data (hash, (gsize)read_count, buffer);
+
+      for (iter = 0, refs = 0; iter < count; iter++)
+        refs += (targets[iter].output != NULL);
+
+      chunk = g_slice_new (FanoutChunk);
+      chunk->data = buffer;
+      chunk->length = (gsize)read_count;
+      chunk->refs = refs;
+
+      g_mutex_lock (&(state->lock));
+      state->in_flight++;
+      g_mutex_unlock (&(state->lock));
+
+      for (iter = 0; iter < count; iter++)
+        {
+          if (targets[iter].output == NULL)
+            continue;
+
+          if (threaded)
+            g_async_queue_push (targets[iter].queue, chunk);
+          else
+            fanout_write (&(targets[iter]), chunk);
+        }
+    }
+}
+
+gboolean
+rudgiosync_fanout_copy (GFile *source,
+                        GFile **destinations,
+                        guint count,
+                        guint64 size,
+                        guint64 modified_time,
+                        RudgiosyncChecksum *checksum,
+                        GError **error)
+{
+  GFileInputStream     *input_stream;
+  FanoutState           state;
+  FanoutTarget         *targets;
+  FanoutTarget         *target;
+  RudgiosyncTraceSpan   span;
+  RudgiosyncHashContext hash_context;
+  RudgiosyncHashContext *hash = NULL;
+
+  gboolean threaded;
+  gboolean success = TRUE;
+  guint    open_count = 0;
+  guint    iter;
+
+  GError *ierror = NULL;
+
+
+  rudgiosync_trace_begin (&span);
+  input_stream = g_file_read (source, NULL, &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, source, -1);
+  if (ierror != NULL)
+    {
+      rudgiosync_propagate_copy_error (error, ierror, destinations[0], source);
+      return FALSE;
+    }
+
+  g_mutex_init (&(state.lock));
+  g_cond_init (&(state.released));
+  state.in_flight = 0;
+
+  targets = g_new0 (FanoutTarget, count);
+  for (iter = 0; iter < count; iter++)
+    {
+      target = &(targets[iter]);
+      target->state = &state;
+      target->destination = destinations[iter];
+      fanout_open (target, source, size);
+      if (target->output != NULL)
+        open_count++;
+    }
+
+  /* A single buffer is written out as quickly without threads. */
+  threaded = open_count > 1 && size > RUDGIOSYNC_TRANSFER_BUF_SIZE;
+  for (iter = 0; iter < count && threaded; iter++)
+    {
+      target = &(targets[iter]);
+      if (target->output == NULL)
+        continue;
+
+      target->queue = g_async_queue_new ();
+      target->thread = g_thread_new ("rudgiosync-fanout", fanout_writer, target);
+    }
+
+  if (checksum != NULL)
+    {
+      hash = &hash_context;
+      rudgiosync_hash_init (hash);
+    }
+
+  if (open_count > 0)
+    success = fanout_transfer (G_INPUT_STREAM (input_stream), &state, targets, count, threaded, hash, &ierror);
+
+  for (iter = 0; iter < count; iter++)
+    {
+      target = &(targets[iter]);
+      if (target->thread != NULL)
+        {
+          g_async_queue_push (target->queue, &fanout_end);
+          g_thread_join (target->thread);
+          g_async_queue_unref (target->queue);
+        }
+    }
+
+  rudgiosync_trace_begin (&span);
+  g_object_unref (input_stream);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_CLOSE, source, -1);
+  if (!success)
+    rudgiosync_propagate_copy_error (error, ierror, destinations[0], source);
+
+  /* Only complete copies take the place of the destinations. */
+  for (iter = 0; iter < count; iter++)
+    {
+      target = &(targets[iter]);
+      if (target->output == NULL)
+        continue;
+
+      if (success && target->error == NULL)
+        rudgiosync_sparse_writer_finish (&(target->writer), &(target->error));
+
+      rudgiosync_trace_begin (&span);
+      if (success && target->error == NULL)
+        {
+          g_output_stream_close (G_OUTPUT_STREAM (target->output), NULL, &(target->error));
+          g_object_unref (target->output);
+        }
+      else
+        rudgiosync_abandon_output (target->output);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_CLOSE, target->destination, -1);
+
+      if (success && target->error == NULL)
+        {
+          rudgiosync_cache_drop (target->destination, TRUE);
+          set_modified_time (target->destination, modified_time, NULL);
+        }
+    }
+  rudgiosync_cache_drop (source, FALSE);
+
+  for (iter = 0; iter < count; iter++)
+    {
+      target = &(targets[iter]);
+      if (target->error == NULL)
+        continue;
+
+      if (success)
+        rudgiosync_propagate_copy_error (error, target->error, target->destination, source);
+      else
+        g_error_free (target->error);
+      success = FALSE;
+    }
+  g_free (targets);
+  g_cond_clear (&(state.released));
+  g_mutex_clear (&(state.lock));
+
+  if (success && hash != NULL)
+    rudgiosync_hash_finish (hash, checksum);
+
+  return success;
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Copying a file to several destinations at once.
+ *
+ * The source is read only once, a buffer at a time, and each buffer is handed
+ * to a thread per destination to write out.  Reading runs ahead of the
+ * slowest destination by a few buffers at most, so a slow destination holds
+ * the others up only once its backlog is full.  Files which fit a single
+ * buffer are written out to one destination after another instead.
+ *
+ * A destination which fails is left behind, while the others are finished.
+ */
+
+#ifndef _RUDGIOSYNC_FANOUT_H_
+#define _RUDGIOSYNC_FANOUT_H_
+
+#include "boiler.h"
+#include "checksum.h"
+
+
+/**
+ * Replace the contents of the destination files, expected to be of the given
+ * size, with that of the source, and give them the wanted modification time.
+ * If `checksum' isn't NULL, it's set to that of the data read.  The failure
+ * of any destination is reported, the first one if several fail.
+ */
+gboolean rudgiosync_fanout_copy (GFile *source,
+                                 GFile **destinations,
+                                 guint count,
+                                 guint64 size,
+                                 guint64 modified_time,
+                                 RudgiosyncChecksum *checksum,
+                                 GError **error);
+
+
+#endif /* _RUDGIOSYNC_FANOUT_H_ */
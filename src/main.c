@@ -17,43 +17,467 @@
 #include "boiler.h"
 #include "descriptions.h"
 #include "operations.h"
+#include "spill.h"
+#include "plan.h"
+#include "schedule.h"
+#include "buffers.h"
+#include "stats.h"
+#include "trace.h"
+#include "emulate.h"
+#include "progress.h"
+#include "resume.h"
+#include "verify.h"
 
 static gboolean opt_delete    = FALSE;
 static gboolean opt_checksum  = FALSE;
+static gboolean opt_verify    = FALSE;
 static gboolean opt_size_only = FALSE;
 static gboolean opt_version   = FALSE;
+static guint64  opt_memory_limit = 0;
+static gboolean opt_dry_run   = FALSE;
+static gboolean opt_drop_cache = FALSE;
+static gboolean opt_resume    = TRUE;
+static gboolean opt_stats     = FALSE;
+static gboolean opt_verbose   = FALSE;
+static gboolean opt_quiet     = FALSE;
+static gint     opt_progress_fd = -1;
+static gchar   *opt_write_plan = NULL;
+static gchar   *opt_apply_plan = NULL;
+static gchar  **opt_destinations = NULL;
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+static gchar   *opt_trace     = NULL;
+#endif
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+static RudgiosyncEmulation *opt_emulate_source = NULL;
+static RudgiosyncEmulation *opt_emulate_destination = NULL;
+#endif
+static RudgiosyncSchedule opt_schedule;
+
+/* Parse a size with an optional K, M, G or T (binary) suffix. */
+static gboolean
+parse_size (const gchar *option_name, const gchar *value, guint64 *size, GError **error)
+{
+  gchar   *suffix;
+  guint64  multiplier;
+
+  *size = g_ascii_strtoull (value, &suffix, 10);
+  switch (g_ascii_toupper (*suffix))
+    {
+      case '\0': multiplier = 1;                          break;
+      case 'K':  multiplier = 1024;                       break;
+      case 'M':  multiplier = 1024 * 1024;                break;
+      case 'G':  multiplier = 1024 * 1024 * 1024;         break;
+      case 'T':  multiplier = (guint64)1024 * 1024 * 1024 * 1024; break;
+      default:   multiplier = 0;                          break;
+    }
+  if (suffix == value || multiplier == 0 || (*suffix != '\0' && suffix[1] != '\0'))
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Invalid size `%s' for %s", value, option_name);
+      return FALSE;
+    }
+
+  *size *= multiplier;
+  return TRUE;
+}
+
+static gboolean
+opt_memory_limit_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  return parse_size (option_name, value, &opt_memory_limit, error);
+}
+
+static gboolean
+opt_jobs_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  guint *jobs;
+
+  jobs = (strcmp (option_name, "--large-jobs") == 0) ? &(opt_schedule.large_jobs) : &(opt_schedule.small_jobs);
+  if (!rudgiosync_schedule_parse_jobs (value, jobs))
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Invalid number of jobs `%s' for %s", value, option_name);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+opt_large_size_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  return parse_size (option_name, value, &(opt_schedule.large_threshold), error);
+}
+
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+static gboolean
+opt_emulate_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  RudgiosyncEmulation *emulation;
+
+  emulation = rudgiosync_emulation_new (value, error);
+  if (emulation == NULL)
+    return FALSE;
+
+  if (strcmp (option_name, "--emulate-source") == 0)
+    opt_emulate_source = emulation;
+  else
+    opt_emulate_destination = emulation;
+  return TRUE;
+}
+#endif
+
+static gboolean
+opt_delete_timing_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  static gboolean given = FALSE;
+  guint           timing;
+
+  if (strcmp (option_name, "--delete-during") == 0)
+    timing = RUDGIOSYNC_DELETE_DURING;
+  else if (strcmp (option_name, "--delete-after") == 0)
+    timing = RUDGIOSYNC_DELETE_AFTER;
+  else
+    timing = RUDGIOSYNC_DELETE_BEFORE;
+
+  if (given && timing != opt_schedule.delete_timing)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                   "The --delete-before, --delete-during and --delete-after options are mutually exclusive");
+      return FALSE;
+    }
+
+  given = TRUE;
+  opt_schedule.delete_timing = timing;
+  opt_delete = TRUE;
+  return TRUE;
+}
+
+static gboolean
+opt_order_cb (const gchar *option_name, const gchar *value, gpointer data, GError **error)
+{
+  if (!rudgiosync_schedule_parse_order (value, &(opt_schedule.order)))
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   "Unknown order `%s' for %s", value, option_name);
+      return FALSE;
+    }
+
+  return TRUE;
+}
 
 static GOptionEntry opt_entries[] =
 {
   { "size-only", 's', 0, G_OPTION_ARG_NONE, &opt_size_only, "Skip files that match in size", NULL },
   { "checksum",  'c', 0, G_OPTION_ARG_NONE, &opt_checksum,  "Skip files based on checksum, not size and modified time", NULL },
+  { "verify",    0, 0, G_OPTION_ARG_NONE, &opt_verify,    "Read every file copied back, and copy it again if it differs from what was written", NULL },
   { "delete",    'd', 0, G_OPTION_ARG_NONE, &opt_delete,    "Delete extraneous files from destination directories", NULL },
+  { "delete-before", 0, G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, opt_delete_timing_cb, "Delete extraneous files before copying anything (default for --delete)", NULL },
+  { "delete-during", 0, G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, opt_delete_timing_cb, "Delete extraneous files while copying", NULL },
+  { "delete-after", 0, G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, opt_delete_timing_cb, "Delete extraneous files once everything has been copied", NULL },
+  { "memory-limit", 0, 0, G_OPTION_ARG_CALLBACK, opt_memory_limit_cb, "Keep directory listings within SIZE bytes of memory, spilling the rest to temporary files", "SIZE" },
+  { "dry-run",   'n', 0, G_OPTION_ARG_NONE, &opt_dry_run,   "Show what would be done, without making any changes", NULL },
+  { "write-plan", 0, 0, G_OPTION_ARG_FILENAME, &opt_write_plan, "Write what would be done to FILE, without making any changes", "FILE" },
+  { "apply-plan", 0, 0, G_OPTION_ARG_FILENAME, &opt_apply_plan, "Carry out a plan written by --write-plan, instead of comparing locations", "FILE" },
+  { "destination", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_destinations, "Synchronize LOCATION with the source as well, reading the files copied to several destinations only once; may be repeated", "LOCATION" },
+  { "large-jobs", 0, 0, G_OPTION_ARG_CALLBACK, opt_jobs_cb, "Copy up to N large files at once, or tune it for the backends with `auto' (default)", "N" },
+  { "small-jobs", 0, 0, G_OPTION_ARG_CALLBACK, opt_jobs_cb, "Copy up to N small files at once, or tune it for the backends with `auto' (default)", "N" },
+  { "large-size", 0, 0, G_OPTION_ARG_CALLBACK, opt_large_size_cb, "Treat files of at least SIZE bytes as large (default: 8M)", "SIZE" },
+  { "order",     0, 0, G_OPTION_ARG_CALLBACK, opt_order_cb,   "Copy files in the given ORDER: default, newest-first, oldest-first, largest-first or smallest-first", "ORDER" },
+  { "no-space-check", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &(opt_schedule.check_space), "Start copying even if the destination looks too small for it", NULL },
+  { "no-resume", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &opt_resume, "Write large files in place, rather than to a partial file which a later run can resume", NULL },
+  { "drop-cache", 0, 0, G_OPTION_ARG_NONE, &opt_drop_cache, "Keep the local files read and written out of the page cache, where possible", NULL },
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+  { "trace",     0, 0, G_OPTION_ARG_FILENAME, &opt_trace,     "Record the duration of every operation on the files to FILE, in the Chrome trace format", "FILE" },
+#endif
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+  { "emulate-source", 0, 0, G_OPTION_ARG_CALLBACK, opt_emulate_cb, "Make the source behave like a slow backend: mtp, sftp, fat or none, followed by any of ,latency=MS ,bandwidth=SIZE ,serial=yes|no ,mtime=SECONDS", "SPEC" },
+  { "emulate-destination", 0, 0, G_OPTION_ARG_CALLBACK, opt_emulate_cb, "Make the destination behave like a slow backend, as above", "SPEC" },
+#endif
+  { "verbose",   'v', 0, G_OPTION_ARG_NONE, &opt_verbose,   "Also list the files which are already up to date", NULL },
+  { "quiet",     'q', 0, G_OPTION_ARG_NONE, &opt_quiet,     "Don't list the changes made, only report errors and summaries", NULL },
+  { "progress-fd", 0, 0, G_OPTION_ARG_INT,  &opt_progress_fd, "Write a line of JSON about the progress of copying to file descriptor FD every second", "FD" },
+  { "stats",     0, 0, G_OPTION_ARG_NONE, &opt_stats,     "Show how long each phase took and what was done, once finished", NULL },
   { "version",   'V', 0, G_OPTION_ARG_NONE, &opt_version,   "Show the program's version and quit", NULL },
   { NULL }
 };
 
-int
-main (int argc, char **argv)
+/* Print how the scanning is going, unless asked to be quiet. */
+static void
+print_status (const gchar *message)
+{
+  if (rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_NORMAL)
+    g_print ("%s", message);
+}
+
+/* How files are compared, as recorded in a plan. */
+static guint
+plan_comparison (void)
+{
+  if (opt_checksum)
+    return RUDGIOSYNC_PLAN_COMPARE_CHECKSUMS;
+  if (opt_size_only)
+    return RUDGIOSYNC_PLAN_COMPARE_SIZES;
+
+  return RUDGIOSYNC_PLAN_COMPARE_TIMES;
+}
+
+/* Carrying out actions while comparing spilled listings. */
+typedef struct
+{
+  RudgiosyncPlan       *plan;
+  RudgiosyncStatsTimer *timer;  /* Of the comparison, paused meanwhile. */
+} SpilledExecution;
+
+/* Keep the time taken by an action out of the comparison's. */
+static gboolean
+execute_spilled_cb (RudgiosyncAction *action, gpointer user_data, GError **error)
+{
+  SpilledExecution *execution = user_data;
+  gboolean          retval;
+
+  rudgiosync_stats_stop (execution->timer, RUDGIOSYNC_PHASE_COMPARE);
+  retval = rudgiosync_plan_execute_cb (action, execution->plan, error);
+  rudgiosync_stats_start (execution->timer);
+
+  return retval;
+}
+
+/* Synchronize using listings which are spilled to disk beyond the memory limit. */
+static int
+synchronize_spilled (GFile *src_descriptor, GFile *dest_descriptor)
+{
+  RudgiosyncSpillList  *source;
+  RudgiosyncSpillList  *destination;
+  RudgiosyncPlan       *plan;
+  RudgiosyncPlanWriter *writer;
+  RudgiosyncStatsTimer  timer;
+  SpilledExecution      execution;
+
+  GError *ierror = NULL;
+
+
+  print_status ("Examining source directory tree... ");
+  rudgiosync_stats_start (&timer);
+  source = rudgiosync_spill_list_new (src_descriptor, opt_checksum, opt_memory_limit, &ierror);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_SCAN);
+  print_status ("done.\n");
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Failed to investigate the source: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      return 1;
+    }
+  print_status ("Examining destination directory tree... ");
+  rudgiosync_stats_start (&timer);
+  destination = rudgiosync_spill_list_new (dest_descriptor, opt_checksum, opt_memory_limit, &ierror);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_SCAN);
+  print_status ("done.\n");
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Failed to investigate the destination: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      rudgiosync_spill_list_free (source);
+      return 1;
+    }
+
+  plan = rudgiosync_plan_new (src_descriptor, dest_descriptor, rudgiosync_spill_list_get_display_name (destination));
+  plan->comparison = plan_comparison ();
+  execution.plan = plan;
+  execution.timer = &timer;
+
+  /* The actions are carried out as they come, rather than collected. */
+  rudgiosync_stats_start (&timer);
+  if (opt_write_plan != NULL)
+    {
+      writer = rudgiosync_plan_writer_new (plan, opt_write_plan, &ierror);
+      if (writer != NULL)
+        {
+          rudgiosync_spill_plan (destination, source, !(opt_size_only || opt_checksum), opt_checksum, opt_delete,
+                                 rudgiosync_plan_writer_add, writer,
+                                 &ierror);
+          rudgiosync_plan_writer_close (writer, (ierror == NULL) ? &ierror : NULL);
+        }
+    }
+  else
+    {
+      /* What's to be copied is only known once it has been. */
+      if (!opt_dry_run)
+        rudgiosync_progress_begin (-1, -1);
+      rudgiosync_spill_plan (destination, source, !(opt_size_only || opt_checksum), opt_checksum, opt_delete,
+                             opt_dry_run ? rudgiosync_plan_print_cb : execute_spilled_cb,
+                             opt_dry_run ? (gpointer) plan : (gpointer) &execution,
+                             &ierror);
+      rudgiosync_progress_end ();
+      /* Nothing was collected, so only the totals are shown. */
+      if (ierror == NULL && opt_dry_run)
+        rudgiosync_plan_print (plan);
+    }
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_COMPARE);
+  rudgiosync_plan_free (plan);
+  rudgiosync_spill_list_free (source);
+  rudgiosync_spill_list_free (destination);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Synchronization failed: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      return 1;
+    }
+
+  rudgiosync_stats_report ();
+  return 0;
+}
+
+/* A source location, as given on the command line. */
+static GFile *
+source_new (const gchar *location)
+{
+  GFile *retval;
+
+  retval = g_file_new_for_commandline_arg (location);
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+  retval = rudgiosync_emulate (retval, opt_emulate_source);
+#endif
+
+  return retval;
+}
+
+/* A destination location, as given on the command line. */
+static GFile *
+destination_new (const gchar *location)
+{
+  GFile *retval;
+
+  retval = g_file_new_for_commandline_arg (location);
+#ifdef RUDGIOSYNC_EMULATE_ENABLED
+  retval = rudgiosync_emulate (retval, opt_emulate_destination);
+#endif
+
+  return retval;
+}
+
+/* Scan a destination, and plan making it match the sources merged into it. */
+static RudgiosyncPlan *
+plan_destination (RudgiosyncTree **sources, guint source_count, const gchar *location, GError **error)
+{
+  RudgiosyncTree       *destination;
+  RudgiosyncPlan       *plan;
+  RudgiosyncStatsTimer  timer;
+  GFile                *dest_descriptor;
+  guint                 iter;
+
+  GError *ierror = NULL;
+
+
+  dest_descriptor = destination_new (location);
+
+  print_status ("Examining destination directory tree... ");
+  rudgiosync_stats_start (&timer);
+  destination = rudgiosync_tree_new (dest_descriptor, opt_checksum, &ierror);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_SCAN);
+  print_status ("done.\n");
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to investigate the destination: ");
+      g_object_unref (dest_descriptor);
+
+      return NULL;
+    }
+
+  plan = rudgiosync_plan_new (sources[0]->descriptor, dest_descriptor, destination->root->display_name);
+  plan->comparison = plan_comparison ();
+  for (iter = 1; iter < source_count; iter++)
+    rudgiosync_plan_add_source (plan, sources[iter]->descriptor);
+  g_object_unref (dest_descriptor);
+
+  rudgiosync_stats_start (&timer);
+  rudgiosync_plan_merged (destination, sources, source_count,
+                          !(opt_size_only || opt_checksum), opt_checksum, opt_delete,
+                          rudgiosync_plan_append, plan,
+                          &ierror);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_COMPARE);
+  rudgiosync_tree_free (destination);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Synchronization failed: ");
+      rudgiosync_plan_free (plan);
+
+      return NULL;
+    }
+
+  return plan;
+}
+
+/* Carry out, or show, a previously written plan. */
+static int
+apply_plan (void)
+{
+  RudgiosyncPlan *plan;
+
+  GError *ierror = NULL;
+
+
+  plan = rudgiosync_plan_read (opt_apply_plan, &ierror);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Failed to load the plan: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      return 1;
+    }
+
+  if (opt_dry_run)
+    rudgiosync_plan_print (plan);
+  else
+    rudgiosync_schedule_execute (&opt_schedule, plan, TRUE, &ierror);
+  rudgiosync_plan_free (plan);
+  if (ierror != NULL)
+    {
+      g_printerr ("%s: Synchronization failed: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      return 1;
+    }
+
+  rudgiosync_stats_report ();
+  return 0;
+}
+
+/* Everything but finishing off the trace. */
+static int
+run (int argc, char **argv)
 {
-  GOptionContext *opt_context;
-  RudgiosyncDirectoryEntry *source;
-  RudgiosyncDirectoryEntry *destination;
+  GOptionContext  *opt_context;
+  RudgiosyncTree **sources;
+  RudgiosyncPlan  *plan;
+  GPtrArray       *plans;
+
+  RudgiosyncStatsTimer timer;
 
   GFile *src_descriptor;
   GFile *dest_descriptor;
 
   GError *ierror = NULL;
+  int     retval;
+  guint   source_count;
+  guint   dest_count;
+  guint   iter;
 
 
   g_type_init();
-  opt_context = g_option_context_new ("<source> <destination>");
+  rudgiosync_schedule_init (&opt_schedule);
+  opt_context = g_option_context_new ("<source>... <destination>");
   g_option_context_set_summary (opt_context,
                                "rudgiosync is a simplistic file synchronizing utility, inspired heavily by\n"
                                "rsync, which uses GIO as its I/O library, and can therefore natively access\n"
                                "and synchronize gvfs-based filesystems.\n"
                                "\n"
                                "The <source> and <destination> location arguments can be either file names, or\n"
-                               "GIO-supported URIs.");
+                               "GIO-supported URIs.  Several source directories may be given, which are merged\n"
+                               "into the destination, the first of them winning wherever they overlap.");
   g_option_context_add_main_entries (opt_context, opt_entries, NULL);
   g_option_context_parse (opt_context, &argc, &argv, &ierror);
   g_option_context_free (opt_context);
@@ -69,6 +493,57 @@ main (int argc, char **argv)
       g_print ("%s\n", PACKAGE_STRING);
       return 0;
     }
+  if (opt_verbose && opt_quiet)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The --verbose and --quiet options are mutually exclusive");
+      return 1;
+    }
+#ifndef RUDGIOSYNC_CHECKSUM_ENABLED
+  if (opt_verify)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The --verify option cannot be used, since checksum support was disabled at compile time");
+      return 1;
+    }
+#endif
+  if (opt_progress_fd >= 0 && fcntl (opt_progress_fd, F_GETFL) == -1)
+    {
+      g_printerr ("%s: Command line option parsing failed: The file descriptor %d given to --progress-fd isn't open.\n", g_get_prgname (), opt_progress_fd);
+      return 1;
+    }
+  rudgiosync_progress_init (opt_quiet ? RUDGIOSYNC_VERBOSITY_QUIET
+                            : opt_verbose ? RUDGIOSYNC_VERBOSITY_VERBOSE
+                            : RUDGIOSYNC_VERBOSITY_NORMAL,
+                            opt_progress_fd);
+  rudgiosync_cache_set_dropping (opt_drop_cache);
+  rudgiosync_resume_set_enabled (opt_resume);
+  rudgiosync_verify_set_enabled (opt_verify);
+  if (opt_stats)
+    rudgiosync_stats_enable ();
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+  if (opt_trace != NULL && !rudgiosync_trace_open (opt_trace, &ierror))
+    {
+      g_printerr ("%s: %s.\n", g_get_prgname (), ierror->message);
+
+      g_clear_error (&ierror);
+      return 1;
+    }
+#endif
+
+  if (opt_write_plan != NULL && opt_dry_run)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The --write-plan and --dry-run options are mutually exclusive");
+      return 1;
+    }
+  if (opt_apply_plan != NULL)
+    {
+      if (argc > 1 || opt_destinations != NULL)
+        {
+          g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "No locations may be given along with --apply-plan, they are stored in the plan");
+          return 1;
+        }
+
+      return apply_plan ();
+    }
 
   if (argc < 2)
     {
@@ -80,9 +555,30 @@ main (int argc, char **argv)
       g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "Destination location missing");
       return 1;
     }
-  if (argc > 3)
+
+  /* All but the last argument are sources, merged into the destination. */
+  source_count = argc - 2;
+  if (source_count > 1 && opt_write_plan != NULL)
     {
-      g_printerr ("%s: Command line option parsing failed: Unknown option `%s'.\n", g_get_prgname (), argv[3]);
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "Only a single source can be given with --write-plan, a plan is for a single source");
+      return 1;
+    }
+  if (source_count > 1 && opt_memory_limit > 0)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "Only a single source can be given with --memory-limit");
+      return 1;
+    }
+
+  /* Further destinations, beyond the one given as an argument. */
+  dest_count = (opt_destinations != NULL) ? g_strv_length (opt_destinations) : 0;
+  if (dest_count > 0 && opt_write_plan != NULL)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The --destination option cannot be used with --write-plan, a plan is for a single destination");
+      return 1;
+    }
+  if (dest_count > 0 && opt_memory_limit > 0)
+    {
+      g_printerr ("%s: Command line option parsing failed: %s.\n", g_get_prgname (), "The --destination and --memory-limit options are mutually exclusive");
       return 1;
     }
 
@@ -99,59 +595,111 @@ main (int argc, char **argv)
       return 1;
     }
 
-  src_descriptor = g_file_new_for_commandline_arg (argv[1]);
-  dest_descriptor = g_file_new_for_commandline_arg (argv[2]);
+  /* A single source file gains nothing from spilling, the trees will do. */
+  if (opt_memory_limit > 0)
+    {
+      src_descriptor = source_new (argv[1]);
+      if (g_file_query_file_type (src_descriptor, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY)
+        {
+          dest_descriptor = destination_new (argv[2]);
+          retval = synchronize_spilled (src_descriptor, dest_descriptor);
+
+          g_object_unref (src_descriptor);
+          g_object_unref (dest_descriptor);
+
+          return retval;
+        }
+      g_object_unref (src_descriptor);
+    }
+
+  sources = g_new0 (RudgiosyncTree *, source_count);
+  for (iter = 0; iter < source_count && ierror == NULL; iter++)
+    {
+      src_descriptor = source_new (argv[iter + 1]);
 
-  g_print ("Examining source directory tree... ");
-  source = rudgiosync_directory_entry_new (src_descriptor, opt_checksum, &ierror);
-  g_print ("done.\n");
+      print_status ("Examining source directory tree... ");
+      rudgiosync_stats_start (&timer);
+      sources[iter] = rudgiosync_tree_new (src_descriptor, opt_checksum, &ierror);
+      rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_SCAN);
+      print_status ("done.\n");
+      g_object_unref (src_descriptor);
+    }
   if (ierror != NULL)
     {
       g_printerr ("%s: Failed to investigate the source: %s.\n", g_get_prgname (), ierror->message);
 
       g_clear_error (&ierror);
-      g_object_unref (src_descriptor);
-      g_object_unref (dest_descriptor);
+      for (iter = 0; iter < source_count; iter++)
+        rudgiosync_tree_free (sources[iter]);
+      g_free (sources);
 
       return 1;
     }
 
-  g_print ("Examining destination directory tree... ");
-  destination = rudgiosync_directory_entry_new (dest_descriptor, opt_checksum, &ierror);
-  g_print ("done.\n");
+  /* The sources are scanned once, whatever the number of destinations. */
+  plans = g_ptr_array_new_with_free_func ((GDestroyNotify) rudgiosync_plan_free);
+  for (iter = 0; ierror == NULL && iter <= dest_count; iter++)
+    {
+      plan = plan_destination (sources, source_count,
+                               (iter == 0) ? argv[argc - 1] : opt_destinations[iter - 1],
+                               &ierror);
+      if (plan != NULL)
+        g_ptr_array_add (plans, plan);
+    }
+
+  /* The plans are all that's needed from here on. */
+  for (iter = 0; iter < source_count; iter++)
+    rudgiosync_tree_free (sources[iter]);
+  g_free (sources);
+
+  if (ierror == NULL)
+    {
+      if (opt_write_plan != NULL)
+        rudgiosync_plan_write (g_ptr_array_index (plans, 0), opt_write_plan, &ierror);
+      else if (opt_dry_run)
+        g_ptr_array_foreach (plans, (GFunc) rudgiosync_plan_print, NULL);
+      else
+        rudgiosync_schedule_execute_many (&opt_schedule, (RudgiosyncPlan **) plans->pdata, plans->len,
+                                          FALSE, &ierror);
+
+      if (ierror != NULL)
+        g_prefix_error (&ierror, "Synchronization failed: ");
+    }
+  g_ptr_array_free (plans, TRUE);
   if (ierror != NULL)
     {
-      g_printerr ("%s: Failed to investigate the destination: %s.\n", g_get_prgname (), ierror->message);
+      g_printerr ("%s: %s.\n", g_get_prgname (), ierror->message);
 
       g_clear_error (&ierror);
-      rudgiosync_directory_entry_free (source);
-      g_object_unref (src_descriptor);
-      g_object_unref (dest_descriptor);
-
       return 1;
     }
 
-  g_object_unref (src_descriptor);
-  g_object_unref (dest_descriptor);
+  rudgiosync_stats_report ();
+  return 0;
+}
 
-  rudgiosync_synchronize (&destination, &source, !(opt_size_only || opt_checksum), opt_checksum, opt_delete, &ierror);
-  if (ierror != NULL)
+int
+main (int argc, char **argv)
+{
+  int retval;
+
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+  GError *ierror = NULL;
+#endif
+
+
+  retval = run (argc, argv);
+
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+  /* A trace cut short would pass for a complete one. */
+  if (!rudgiosync_trace_close (&ierror))
     {
-      g_printerr ("%s: Synchronization failed: %s.\n", g_get_prgname (), ierror->message);
+      g_printerr ("%s: %s.\n", g_get_prgname (), ierror->message);
 
       g_clear_error (&ierror);
-      rudgiosync_directory_entry_free (source);
-      rudgiosync_directory_entry_free (destination);
-
-      return 1;
+      retval = 1;
     }
-  /*
-  traverse_directory_tree (source, NULL);
-  traverse_directory_tree (destination, NULL);
-  */
-
-  rudgiosync_directory_entry_free (source);
-  rudgiosync_directory_entry_free (destination);
+#endif
 
-  return 0;
+  return retval;
 }
@@ -17,25 +17,23 @@
 #include "boiler.h"
 #include "operations.h"
 #include "checksum.h"
+#include "resume.h"
 #include "errors.h"
+#include "stats.h"
+#include "trace.h"
+#include "progress.h"
 
 #include <string.h>
 
-#define TRANSFER_BUF_SIZE ((gsize)(2 * 1024 * 1024)) /* 2 MiB */
+#if HAVE_GIO_UNIX
+#include <gio/gfiledescriptorbased.h>
+#endif
 
 
-static void
-traverse_directory_tree_p (gpointer entry_in, gpointer prefix_in)
-{
-  RudgiosyncDirectoryEntry *entry = (RudgiosyncDirectoryEntry *)entry_in;
-  const gchar *prefix = (const gchar *)prefix_in;
-
-  traverse_directory_tree (entry, prefix);
-}
-
 void
 traverse_directory_tree (RudgiosyncDirectoryEntry *entry, const gchar *prefix)
 {
+  RudgiosyncDirectoryEntry *child_entry;
   gchar *printed_name;
 
   if (prefix != NULL)
@@ -51,19 +49,27 @@ traverse_directory_tree (RudgiosyncDirectoryEntry *entry, const gchar *prefix)
   switch (entry->type)
     {
       case RUDGIOSYNC_DIR_ENTRY_FILE:
-        #ifdef RUDGIOSYNC_CHECKSUM_ENABLED
-          g_print (" (file, size: %" G_GUINT64_FORMAT ", modified: %" G_GUINT64_FORMAT ", checksum: ", entry->data.file.size, entry->modified_time);
-          rudgiosync_checksum_display (&(entry->data.file.checksum));
-          g_print (")\n");
-        #else
-          g_print (" (file, size: %" G_GUINT64_FORMAT ", modified: %" G_GUINT64_FORMAT ")\n", entry->data.file.size, entry->modified_time);
-        #endif
+        if (entry->data.file.checksum != NULL)
+          {
+            g_print (" (file, size: %" G_GUINT64_FORMAT ", modified: %" G_GUINT64_FORMAT ", checksum: ", entry->data.file.size, entry->modified_time);
+            rudgiosync_checksum_display (entry->data.file.checksum);
+            g_print (")\n");
+          }
+        else
+          {
+            g_print (" (file, size: %" G_GUINT64_FORMAT ", modified: %" G_GUINT64_FORMAT ")\n", entry->data.file.size, entry->modified_time);
+          }
         break;
 
       case RUDGIOSYNC_DIR_ENTRY_DIR:
         g_print ("/ (directory, modified: %" G_GUINT64_FORMAT ")\n", entry->modified_time);
 
-        g_slist_foreach (entry->data.directory.entries, traverse_directory_tree_p, printed_name);
+        for (child_entry = entry->data.directory.entries;
+             child_entry != NULL;
+             child_entry = child_entry->next)
+          {
+            traverse_directory_tree (child_entry, printed_name);
+          }
         break;
 
       default:
@@ -76,159 +82,308 @@ traverse_directory_tree (RudgiosyncDirectoryEntry *entry, const gchar *prefix)
 gboolean
 set_modified_time (GFile *descriptor, guint64 modified_time, GError **error)
 {
-  GFileInfo *info;
-  GError *ierror = NULL;
+  RudgiosyncTraceSpan span;
+  gboolean            retval;
+
+  /* A single call, which is a single round trip on remote backends. */
+  rudgiosync_trace_begin (&span);
+  retval = g_file_set_attribute_uint64 (descriptor,
+                                        G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                        modified_time,
+                                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                        NULL,
+                                        error);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_SET_ATTRIBUTES, descriptor, -1);
 
-  info = g_file_query_info (descriptor,
-                            G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                            NULL,
-                            &ierror);
-  if (ierror != NULL)
-    {
-      g_propagate_error (error, ierror);
-      return FALSE;
-    }
-  g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                    modified_time);
-  g_file_set_attributes_from_info (descriptor, info,
-                                   G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                   NULL,
-                                   &ierror);
-  g_object_unref (info);
-  if (ierror != NULL)
-    {
-      g_propagate_error (error, ierror);
-      return FALSE;
-    }
-  return TRUE;
+  return retval;
+}
+
+void
+rudgiosync_propagate_copy_error (GError **error, GError *ierror, GFile *destination, GFile *source)
+{
+  gchar *src_uri;
+  gchar *dest_uri;
+
+  src_uri = g_file_get_uri (source);
+  dest_uri = g_file_get_uri (destination);
+  g_propagate_prefixed_error (error, ierror, "Failed to update `%s' with `%s': ", dest_uri, src_uri);
+  g_free (src_uri);
+  g_free (dest_uri);
+}
+
+void
+rudgiosync_abandon_output (GFileOutputStream *output)
+{
+  GCancellable *cancellable;
+
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  g_output_stream_close (G_OUTPUT_STREAM (output), cancellable, NULL);
+  g_object_unref (cancellable);
+  g_object_unref (output);
 }
 
 gboolean
-rudgiosync_directory_entry_delete (RudgiosyncDirectoryEntry *entry,
-                                   GError **error)
+rudgiosync_copy_stream (GInputStream *input,
+                        GOutputStream *output,
+                        gboolean sparse,
+                        gchar *buffer,
+                        gsize buffer_size,
+                        RudgiosyncHashContext *hash,
+                        GError **error)
 {
-  RudgiosyncDirectoryEntry *child_entry;
-  GSList *list_iter;
-  gchar  *entry_uri;
-  GError *ierror = NULL;
-  
+  RudgiosyncSparseWriter writer;
+  RudgiosyncTraceSpan    span;
+  gssize                 read_count;
 
-  if (entry->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+  rudgiosync_sparse_writer_init (&writer, output, sparse, hash);
+  while (TRUE)
     {
-      for (list_iter = entry->data.directory.entries;
-           list_iter != NULL;
-           list_iter = list_iter->next)
-        {
-          child_entry = (RudgiosyncDirectoryEntry *)(list_iter->data);
-          rudgiosync_directory_entry_delete (child_entry, &ierror);
-          list_iter->data = NULL;
+      rudgiosync_trace_begin (&span);
+      read_count = g_input_stream_read (input, buffer, buffer_size, NULL, error);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_READ, NULL, MAX (read_count, 0));
+      if (read_count <= 0)
+        break;
 
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-              rudgiosync_directory_entry_free (entry);
-              return FALSE;
-            }
-        }
+      if (!rudgiosync_sparse_writer_write (&writer, buffer, (gsize)read_count, error))
+        return FALSE;
     }
 
-  entry_uri = g_file_get_uri (entry->descriptor);
-  g_file_delete (entry->descriptor, NULL, &ierror);
-  rudgiosync_directory_entry_free (entry);
+  return read_count == 0 && rudgiosync_sparse_writer_finish (&writer, error);
+}
 
-  if (ierror != NULL)
+gboolean
+rudgiosync_preallocate (GOutputStream *output, guint64 size, GError **error)
+{
+#if HAVE_GIO_UNIX && HAVE_FALLOCATE
+  int saved_errno;
+
+  if (size == 0 || !G_IS_FILE_DESCRIPTOR_BASED (output))
+    return TRUE;
+
+  /* The size grows with the writes, in case the source turns out shorter. */
+  if (fallocate (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (output)),
+                 FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0)
+    return TRUE;
+
+  saved_errno = errno;
+  if (saved_errno == ENOSPC)
     {
-      g_propagate_prefixed_error (error, ierror, "Failed to delete `%s': ", entry_uri);
-      g_free (entry_uri);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                   "Error allocating space for file: %s", g_strerror (saved_errno));
       return FALSE;
     }
+#endif
 
-  g_print ("Deleted `%s'.\n", entry_uri);
-  g_free (entry_uri);
   return TRUE;
 }
 
-static gboolean
-delete_non_present_entries_from_dest (RudgiosyncDirectoryEntry *destination,
-                                      RudgiosyncDirectoryEntry *source,
-                                      GError **error)
+gboolean
+rudgiosync_copy_file (GFile *destination,
+                      GFile *source,
+                      guint64 size,
+                      guint64 modified_time,
+                      RudgiosyncChecksum *checksum,
+                      GError **error)
 {
-  RudgiosyncDirectoryEntry *dest_entry;
-  RudgiosyncDirectoryEntry *src_entry;
-
-  GSList *dest_entry_li;
-  GSList *src_entry_li;
+  GFileInputStream *input_stream;
+  GFileOutputStream *output_stream;
+  RudgiosyncTraceSpan span;
+  RudgiosyncHashContext hash_context;
+  RudgiosyncHashContext *hash = NULL;
 
-  gboolean found;
+  gchar   *transfer_buf;
+  int      sparse_fd;
+  gboolean partial;
+  guint64  offset = 0;
 
   GError *ierror = NULL;
 
 
-  g_assert (destination->type == RUDGIOSYNC_DIR_ENTRY_DIR);
-  g_assert (source->type == RUDGIOSYNC_DIR_ENTRY_DIR);
+  rudgiosync_trace_begin (&span);
+  input_stream = g_file_read (source, NULL, &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, source, -1);
+  if (ierror != NULL)
+    {
+      rudgiosync_propagate_copy_error (error, ierror, destination, source);
+      return FALSE;
+    }
 
-  for (dest_entry_li = destination->data.directory.entries;
-       dest_entry_li != NULL;
-       dest_entry_li = dest_entry_li->next)
+  partial = rudgiosync_resume_wanted (size);
+  if (partial)
     {
-      dest_entry = (RudgiosyncDirectoryEntry *)(dest_entry_li->data);
-      found = FALSE;
+      output_stream = rudgiosync_resume_open (destination, source, &input_stream,
+                                              size, modified_time, &offset,
+                                              &ierror);
+    }
+  else
+    {
+      rudgiosync_trace_begin (&span);
+      output_stream = g_file_replace (destination,
+                                      NULL,
+                                      FALSE,
+                                      G_FILE_CREATE_NONE,
+                                      NULL,
+                                      &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, destination, -1);
+    }
+  if (ierror != NULL)
+    {
+      if (input_stream != NULL)
+        g_object_unref (input_stream);
 
-      for (src_entry_li = source->data.directory.entries;
-           src_entry_li != NULL && !found;
-           src_entry_li = src_entry_li->next)
-        {
-          src_entry = (RudgiosyncDirectoryEntry *)(src_entry_li->data);
+      rudgiosync_propagate_copy_error (error, ierror, destination, source);
+      return FALSE;
+    }
 
-          if (strcmp (src_entry->name, dest_entry->name) == 0)
-            found = TRUE;
+  if (checksum != NULL)
+    {
+      hash = &hash_context;
+      rudgiosync_hash_init (hash);
+    }
+
+  /* Local files are copied by their data, others have their zeroes skipped,
+     and an interrupted copy carries on from where it stopped. */
+  if (offset > 0)
+    {
+      rudgiosync_resume_transfer (source, input_stream, output_stream, size, offset, hash, &ierror);
+    }
+  else
+    {
+      transfer_buf = rudgiosync_buffer_acquire ();
+      sparse_fd = rudgiosync_sparse_open (source, G_OUTPUT_STREAM (output_stream));
+      if (sparse_fd >= 0)
+        {
+          rudgiosync_sparse_copy (sparse_fd, G_OUTPUT_STREAM (output_stream),
+                                  transfer_buf, RUDGIOSYNC_TRANSFER_BUF_SIZE,
+                                  hash, &ierror);
+          close (sparse_fd);
         }
-      if (!found)
+      else if (rudgiosync_preallocate (G_OUTPUT_STREAM (output_stream), size, &ierror))
         {
-          rudgiosync_directory_entry_delete (dest_entry, &ierror);
-          dest_entry_li->data = NULL;
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-              destination->data.directory.entries = g_slist_remove_all (destination->data.directory.entries, NULL);
-              return FALSE;
-            }
+          rudgiosync_copy_stream (G_INPUT_STREAM (input_stream), G_OUTPUT_STREAM (output_stream),
+                                  !g_file_is_native (source),
+                                  transfer_buf, RUDGIOSYNC_TRANSFER_BUF_SIZE,
+                                  hash, &ierror);
         }
+      rudgiosync_buffer_release (transfer_buf);
     }
 
-  destination->data.directory.entries = g_slist_remove_all (destination->data.directory.entries, NULL);
+  /* Dropping the last references closes the streams. */
+  rudgiosync_trace_begin (&span);
+  g_object_unref (input_stream);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_CLOSE, source, -1);
+  rudgiosync_trace_begin (&span);
+  g_object_unref (output_stream);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_CLOSE, destination, -1);
+
+  if (ierror == NULL && partial)
+    rudgiosync_resume_complete (destination, &ierror);
+  if (ierror != NULL)
+    {
+      rudgiosync_propagate_copy_error (error, ierror, destination, source);
+      return FALSE;
+    }
+  rudgiosync_cache_drop (source, FALSE);
+  rudgiosync_cache_drop (destination, TRUE);
+
+  if (hash != NULL)
+    rudgiosync_hash_finish (hash, checksum);
+  set_modified_time (destination, modified_time, NULL);
+
   return TRUE;
 }
 
-static RudgiosyncDirectoryEntry *
-create_empty_file (GFile *descriptor, gboolean checksum_wanted, GError **error)
+/* Return the path of a child entry, given the path of its directory. */
+static gchar *
+child_path (const gchar *path, const gchar *name)
 {
-  RudgiosyncDirectoryEntry *retval;
-  GFileOutputStream        *output_stream;
+  if (path[0] == '\0')
+    return g_strdup (name);
+  else
+    return g_strconcat (path, "/", name, NULL);
+}
 
-  GError *ierror = NULL;
+typedef struct
+{
+  RudgiosyncTree  *dest_tree;
+  RudgiosyncTree **src_trees;      /* Merged in order, the first one wins. */
+  gboolean         check_timestamp;
+  gboolean        checksum_only;
+  gboolean        delete_unwanted;
+
+  RudgiosyncActionFunc func;
+  gpointer             user_data;
+} PlanState;
+
+/* An entry of one of the source trees. */
+typedef struct
+{
+  RudgiosyncDirectoryEntry *entry;
+  guint                     tree;
+} PlanSource;
 
+static gboolean
+plan_emit (PlanState *state,
+           guint type,
+           guint entry_type,
+           gboolean announce,
+           guint64 size,
+           guint64 modified_time,
+           const gchar *path,
+           const gchar *src_path,
+           guint source,
+           RudgiosyncDirectoryEntry *replaced,
+           GError **error)
+{
+  RudgiosyncAction action;
+
+  action.type          = type;
+  action.entry_type    = entry_type;
+  action.announce      = announce;
+  action.size          = size;
+  action.modified_time = modified_time;
+  action.path          = path;
+  action.src_path      = src_path;
+  action.source        = source;
+  action.replaces      = replaced != NULL;
+  action.replaced_size = (replaced != NULL) ? replaced->data.file.size : 0;
+  action.replaced_modified_time = (replaced != NULL) ? replaced->modified_time : 0;
+
+  return state->func (&action, state->user_data, error);
+}
 
-  output_stream = g_file_create (descriptor,
-                                 G_FILE_CREATE_REPLACE_DESTINATION,
-                                 NULL,
-                                 &ierror);
-  if (ierror != NULL)
-    {
-      g_propagate_error (error, ierror);
-      return NULL;
-    }
-  g_object_unref (output_stream);
+/* Plan the removal of a destination entry, children first. */
+static gboolean
+plan_deletion (PlanState *state,
+               RudgiosyncDirectoryEntry *entry,
+               const gchar *path,
+               GError **error)
+{
+  RudgiosyncDirectoryEntry *child_entry;
+  gchar    *entry_path;
+  gboolean  success;
 
-  retval = rudgiosync_directory_entry_new (descriptor, checksum_wanted, &ierror);
-  if (ierror != NULL)
+  if (entry->type == RUDGIOSYNC_DIR_ENTRY_DIR)
     {
-      g_propagate_error (error, ierror);
-      return NULL;
+      for (child_entry = entry->data.directory.entries;
+           child_entry != NULL;
+           child_entry = child_entry->next)
+        {
+          entry_path = child_path (path, child_entry->name);
+          success = plan_deletion (state, child_entry, entry_path, error);
+          g_free (entry_path);
+
+          if (!success)
+            return FALSE;
+        }
     }
 
-  return retval;
+  return plan_emit (state, RUDGIOSYNC_ACTION_DELETE, entry->type, FALSE,
+                    entry->type == RUDGIOSYNC_DIR_ENTRY_FILE ? entry->data.file.size : 0,
+                    entry->modified_time,
+                    path, NULL, 0, NULL,
+                    error);
 }
 
 static gboolean
@@ -238,8 +393,12 @@ files_differ (RudgiosyncDirectoryEntry *destination,
 {
   if (checksum_only)
     {
-      return rudgiosync_checksums_differ (&(destination->data.file.checksum),
-                                          &(source->data.file.checksum));
+      /* Leftovers of interrupted copies aren't hashed. */
+      if (destination->data.file.checksum == NULL || source->data.file.checksum == NULL)
+        return TRUE;
+
+      return rudgiosync_checksums_differ (destination->data.file.checksum,
+                                          source->data.file.checksum);
     }
   if (!check_timestamp)
     {
@@ -252,445 +411,414 @@ files_differ (RudgiosyncDirectoryEntry *destination,
     }
 }
 
-/* Forward declaration. */
-static gboolean rudgiosync_synchronize_internal (RudgiosyncDirectoryEntry **destination,
-                                                 RudgiosyncDirectoryEntry **source,
-                                                 gboolean check_timestamp,
-                                                 gboolean checksum_only,
-                                                 gboolean delete_unwanted,
-                                                 const gchar *prefix,
-                                                 GError **error);
-
-
+/**
+ * Whether a destination entry is a leftover of an interrupted copy which this
+ * plan resumes, and so not to be deleted.  The source entries are looked up
+ * by name, as groups when several source trees are merged.
+ */
 static gboolean
-sync_file (RudgiosyncDirectoryEntry *destination,
-           RudgiosyncDirectoryEntry *source,
-           gboolean check_timestamp,
-           gboolean checksum_only,
-           const gchar *prefix,
-           gboolean already_modified,
-           GError **error)
+plan_resumes_leftover (PlanState *state,
+                       GHashTable *src_names,
+                       gboolean merged,
+                       GHashTable *dest_entries,
+                       RudgiosyncDirectoryEntry *leftover)
 {
-  GFileInputStream *input_stream;
-  GFileOutputStream *output_stream;
-
-  gchar *src_uri;
-  gchar *dest_uri;
-
-  gchar *transfer_buf;
-  gboolean modified;
-
-  gssize read_count;
-  gsize wrote_count;
-
-  GError *ierror = NULL;
-
-
-  g_assert (source->type == RUDGIOSYNC_DIR_ENTRY_FILE);
-  g_assert (destination->type == RUDGIOSYNC_DIR_ENTRY_FILE);
-
-  modified = already_modified
-             || files_differ (destination, source, check_timestamp, checksum_only);
-
-  if (modified)
+  RudgiosyncDirectoryEntry *source = NULL;
+  RudgiosyncDirectoryEntry *destination;
+  GArray                   *group;
+  gchar                    *target;
+  gboolean                  retval;
+
+  if (leftover->type != RUDGIOSYNC_DIR_ENTRY_FILE)
+    return FALSE;
+  target = rudgiosync_resume_leftover_target (leftover->name);
+  if (target == NULL)
+    return FALSE;
+
+  if (merged)
     {
-      if (prefix != NULL)
-        g_print ("%s/%s\n", prefix, destination->display_name);
-      else
-        g_print ("%s\n", destination->display_name);
+      group = g_hash_table_lookup (src_names, target);
+      if (group != NULL)
+        source = g_array_index (group, PlanSource, 0).entry;
+    }
+  else
+    {
+      source = g_hash_table_lookup (src_names, target);
+    }
+  destination = g_hash_table_lookup (dest_entries, target);
+  g_free (target);
 
-      input_stream = g_file_read (source->descriptor, NULL, &ierror);
-      if (ierror != NULL)
-        {
-          src_uri = g_file_get_uri (source->descriptor);
-          dest_uri = g_file_get_uri (destination->descriptor);
-          g_propagate_prefixed_error (error, ierror, "Failed to update `%s' with `%s': ", dest_uri, src_uri);
-          g_free (src_uri);
-          g_free (dest_uri);
+  retval = source != NULL
+           && source->type == RUDGIOSYNC_DIR_ENTRY_FILE
+           && rudgiosync_resume_wanted (source->data.file.size)
+           && (destination == NULL
+               || destination->type != RUDGIOSYNC_DIR_ENTRY_FILE
+               || files_differ (destination, source, state->check_timestamp, state->checksum_only));
 
-          return FALSE;
-        }
+  return retval;
+}
 
-      output_stream = g_file_replace (destination->descriptor,
-                                      NULL,
-                                      FALSE,
-                                      G_FILE_CREATE_NONE,
-                                      NULL,
-                                      &ierror);
-      if (ierror != NULL)
-        {
-          src_uri = g_file_get_uri (source->descriptor);
-          dest_uri = g_file_get_uri (destination->descriptor);
-          g_propagate_prefixed_error (error, ierror, "Failed to update `%s' with `%s': ", dest_uri, src_uri);
-          g_free (src_uri);
-          g_free (dest_uri);
+/* Forward declaration. */
+static gboolean plan_entry (PlanState *state,
+                            RudgiosyncDirectoryEntry *destination,
+                            const PlanSource *sources,
+                            guint source_count,
+                            const gchar *path,
+                            const gchar *src_path,
+                            gboolean *parent_modified,
+                            GError **error);
 
-          return FALSE;
-        }
+/**
+ * Merge the entries of the same directory in several source trees, grouped
+ * by name in the order they're come across.  The first entry of a name takes
+ * precedence, later ones are merged into it if they're all directories, and
+ * are left out otherwise.
+ */
+static GPtrArray *
+plan_merge (const PlanSource *sources, guint source_count, GHashTable *names)
+{
+  RudgiosyncDirectoryEntry *src_entry;
+  PlanSource                child;
+  GPtrArray                *retval;
+  GArray                   *group;
+  guint                     iter;
 
-      transfer_buf = g_new (gchar, TRANSFER_BUF_SIZE);
-      while (TRUE)
+  retval = g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+  for (iter = 0; iter < source_count; iter++)
+    {
+      for (src_entry = sources[iter].entry->data.directory.entries;
+           src_entry != NULL;
+           src_entry = src_entry->next)
         {
-          read_count = g_input_stream_read (G_INPUT_STREAM (input_stream),
-                                            transfer_buf, TRANSFER_BUF_SIZE,
-                                            NULL, &ierror);
-          if (ierror != NULL)
+          group = g_hash_table_lookup (names, src_entry->name);
+          if (group == NULL)
             {
-              g_free (transfer_buf);
-              g_object_unref (input_stream);
-              g_object_unref (output_stream);
-
-              src_uri = g_file_get_uri (source->descriptor);
-              dest_uri = g_file_get_uri (destination->descriptor);
-              g_propagate_prefixed_error (error, ierror, "Failed to update `%s' with `%s': ", dest_uri, src_uri);
-              g_free (src_uri);
-              g_free (dest_uri);
-
-              return FALSE;
+              group = g_array_new (FALSE, FALSE, sizeof (PlanSource));
+              g_hash_table_insert (names, (gpointer)src_entry->name, group);
+              g_ptr_array_add (retval, group);
             }
-
-          if (read_count == 0)
-            break;
-
-          g_output_stream_write_all (G_OUTPUT_STREAM (output_stream),
-                                     transfer_buf, (gsize)read_count,
-                                     &wrote_count,
-                                     NULL,
-                                     &ierror);
-          if (ierror != NULL)
+          else if (src_entry->type != RUDGIOSYNC_DIR_ENTRY_DIR
+                   || g_array_index (group, PlanSource, 0).entry->type != RUDGIOSYNC_DIR_ENTRY_DIR)
             {
-              g_free (transfer_buf);
-              g_object_unref (input_stream);
-              g_object_unref (output_stream);
-
-              src_uri = g_file_get_uri (source->descriptor);
-              dest_uri = g_file_get_uri (destination->descriptor);
-              g_propagate_prefixed_error (error, ierror, "Failed to update `%s' with `%s': ", dest_uri, src_uri);
-              g_free (src_uri);
-              g_free (dest_uri);
-
-              return FALSE;
+              continue;
             }
-        }
-      g_free (transfer_buf);
-      g_object_unref (input_stream);
-      g_object_unref (output_stream);
 
-      set_modified_time (destination->descriptor, source->modified_time, NULL);
+          child.entry = src_entry;
+          child.tree = sources[iter].tree;
+          g_array_append_val (group, child);
+        }
     }
 
-  return FALSE;
+  return retval;
 }
 
+/**
+ * Plan the contents of a directory.  The destination is NULL if the directory
+ * is yet to be created.  Entries are matched up by name through hash tables,
+ * as directories with a great many entries are not unusual.  The directory
+ * may be there in several of the source trees, whose entries are merged.
+ *
+ * Whether any entries are to be created, replaced or removed, and thus the
+ * directory's time of modification disturbed, is stored in `modified'.
+ */
 static gboolean
-sync_directory (RudgiosyncDirectoryEntry *destination,
-                RudgiosyncDirectoryEntry *source,
-                gboolean check_timestamp,
-                gboolean checksum_only,
-                gboolean delete_unwanted,
-                const gchar *prefix,
-                gboolean already_modified,
+plan_directory (PlanState *state,
+                RudgiosyncDirectoryEntry *destination,
+                const PlanSource *sources,
+                guint source_count,
+                const gchar *path,
+                const gchar *src_path,
+                gboolean *modified,
                 GError **error)
 {
   RudgiosyncDirectoryEntry *src_entry;
   RudgiosyncDirectoryEntry *dest_entry;
+  PlanSource                child;
+  GArray                   *group;
 
-  GSList *src_entry_li;
-  GSList *dest_entry_li;
+  GHashTable *dest_entries = NULL;
+  GHashTable *src_names = NULL;
+  GPtrArray  *groups = NULL;
 
-  gchar *src_uri;
-  gboolean found;
+  gchar    *entry_path;
+  gchar    *src_entry_path;
+  gboolean  success = TRUE;
+  guint     iter;
 
-  GFile *temp_descriptor;
-  gchar *dest_entry_prefix;
 
-  GError *ierror = NULL;
+  g_assert (sources[0].entry->type == RUDGIOSYNC_DIR_ENTRY_DIR);
 
-
-  g_assert (source->type == RUDGIOSYNC_DIR_ENTRY_DIR);
-  g_assert (destination->type == RUDGIOSYNC_DIR_ENTRY_DIR);
-
-  if (prefix != NULL)
-    dest_entry_prefix = g_strdup_printf ("%s/%s", prefix, destination->display_name);
-  else
-    dest_entry_prefix = g_strdup (destination->display_name);
-
-  if (already_modified
-      || (check_timestamp
-          && (destination->modified_time != source->modified_time)))
+  if (source_count > 1)
     {
-      g_print ("%s/\n", dest_entry_prefix);
+      src_names = g_hash_table_new (g_str_hash, g_str_equal);
+      groups = plan_merge (sources, source_count, src_names);
     }
 
-  for (src_entry_li = source->data.directory.entries;
-       src_entry_li != NULL;
-       src_entry_li = src_entry_li->next)
+  if (destination != NULL)
     {
-      src_entry = (RudgiosyncDirectoryEntry *)(src_entry_li->data);
-      found = FALSE;
+      g_assert (destination->type == RUDGIOSYNC_DIR_ENTRY_DIR);
 
-      for (dest_entry_li = destination->data.directory.entries;
-           dest_entry_li != NULL && !found;
-           dest_entry_li = dest_entry_li->next)
+      dest_entries = g_hash_table_new (g_str_hash, g_str_equal);
+      for (dest_entry = destination->data.directory.entries;
+           dest_entry != NULL;
+           dest_entry = dest_entry->next)
         {
-          dest_entry = (RudgiosyncDirectoryEntry *)(dest_entry_li->data);
+          g_hash_table_insert (dest_entries, (gpointer)dest_entry->name, dest_entry);
+        }
 
-          if (strcmp (src_entry->name, dest_entry->name) == 0)
+      if (state->delete_unwanted)
+        {
+          if (src_names == NULL)
             {
-              rudgiosync_synchronize_internal (&dest_entry, &src_entry,
-                                               check_timestamp, checksum_only, delete_unwanted,
-                                               dest_entry_prefix,
-                                               &ierror);
-
-              dest_entry_li->data = (gpointer)dest_entry;
-              src_entry_li->data  = (gpointer)src_entry;
-
-              if (ierror != NULL)
+              src_names = g_hash_table_new (g_str_hash, g_str_equal);
+              for (src_entry = sources[0].entry->data.directory.entries;
+                   src_entry != NULL;
+                   src_entry = src_entry->next)
                 {
-                  g_propagate_error (error, ierror);
-                  g_free (dest_entry_prefix);
-                  return FALSE;
+                  g_hash_table_insert (src_names, (gpointer)src_entry->name, src_entry);
                 }
+            }
+
+          for (dest_entry = destination->data.directory.entries;
+               dest_entry != NULL && success;
+               dest_entry = dest_entry->next)
+            {
+              if (g_hash_table_lookup (src_names, dest_entry->name) == NULL
+                  && !plan_resumes_leftover (state, src_names, groups != NULL, dest_entries, dest_entry))
+                {
+                  entry_path = child_path (path, dest_entry->name);
+                  success = plan_deletion (state, dest_entry, entry_path, error);
+                  g_free (entry_path);
 
-              found = TRUE;
+                  *modified = TRUE;
+                }
             }
         }
-      if (!found)
+    }
+
+  if (groups == NULL)
+    {
+      child.tree = sources[0].tree;
+      for (src_entry = sources[0].entry->data.directory.entries;
+           src_entry != NULL && success;
+           src_entry = src_entry->next)
         {
-          temp_descriptor = g_file_get_child (destination->descriptor, src_entry->name);
-          switch (src_entry->type)
-            {
-              case RUDGIOSYNC_DIR_ENTRY_FILE:
-                dest_entry = create_empty_file (temp_descriptor, checksum_only, &ierror);
-                g_object_unref (temp_descriptor);
-                if (ierror != NULL)
-                  {
-                    g_propagate_error (error, ierror);
-                    g_free (dest_entry_prefix);
-                    return FALSE;
-                  }
-                sync_file (dest_entry, src_entry,
-                           check_timestamp, checksum_only,
-                           dest_entry_prefix,
-                           TRUE,
-                           &ierror);
-
-                if (ierror != NULL)
-                  {
-                    g_propagate_error (error, ierror);
-                    rudgiosync_directory_entry_free (dest_entry);
-                    g_free (dest_entry_prefix);
-                    return FALSE;
-                  }
-
-                destination->data.directory.entries = g_slist_prepend (destination->data.directory.entries, dest_entry);
-                break;
-
-              case RUDGIOSYNC_DIR_ENTRY_DIR:
-                g_file_make_directory (temp_descriptor, NULL, &ierror);
-                if (ierror != NULL)
-                  {
-                    g_propagate_error (error, ierror);
-                    g_object_unref (temp_descriptor);
-                    g_free (dest_entry_prefix);
-                    return FALSE;
-                  }
-                dest_entry = rudgiosync_directory_entry_new (temp_descriptor, checksum_only, &ierror);
-                g_object_unref (temp_descriptor);
-                if (ierror != NULL)
-                  {
-                    g_propagate_error (error, ierror);
-                    g_free (dest_entry_prefix);
-                    return FALSE;
-                  }
-                sync_directory (dest_entry, src_entry,
-                                check_timestamp, checksum_only, delete_unwanted,
-                                dest_entry_prefix,
-                                TRUE,
-                                &ierror);
-
-                if (ierror != NULL)
-                  {
-                    g_propagate_error (error, ierror);
-                    rudgiosync_directory_entry_free (dest_entry);
-                    g_free (dest_entry_prefix);
-                    return FALSE;
-                  }
-
-                destination->data.directory.entries = g_slist_prepend (destination->data.directory.entries, dest_entry);
-                break;
-
-              default:
-                g_object_unref (temp_descriptor);
-
-                src_uri = g_file_get_uri (src_entry->descriptor);
-                g_print ("Skipping non-regular file `%s'.\n", src_uri);
-                g_free (src_uri);
-                break;
-            }
+          dest_entry = NULL;
+          if (dest_entries != NULL)
+            dest_entry = g_hash_table_lookup (dest_entries, src_entry->name);
+
+          child.entry = src_entry;
+          entry_path = child_path (path, src_entry->name);
+          src_entry_path = child_path (src_path, src_entry->name);
+          success = plan_entry (state, dest_entry, &child, 1, entry_path, src_entry_path, modified, error);
+          g_free (entry_path);
+          g_free (src_entry_path);
         }
     }
-  set_modified_time (destination->descriptor, source->modified_time, NULL);
+  else
+    {
+      for (iter = 0; iter < groups->len && success; iter++)
+        {
+          group = g_ptr_array_index (groups, iter);
+          src_entry = g_array_index (group, PlanSource, 0).entry;
+
+          dest_entry = NULL;
+          if (dest_entries != NULL)
+            dest_entry = g_hash_table_lookup (dest_entries, src_entry->name);
+
+          entry_path = child_path (path, src_entry->name);
+          src_entry_path = child_path (src_path, src_entry->name);
+          success = plan_entry (state, dest_entry, (PlanSource *)group->data, group->len,
+                                entry_path, src_entry_path, modified, error);
+          g_free (entry_path);
+          g_free (src_entry_path);
+        }
+      g_ptr_array_free (groups, TRUE);
+    }
 
-  g_free (dest_entry_prefix);
-  return TRUE;
+  if (src_names != NULL)
+    g_hash_table_destroy (src_names);
+  if (dest_entries != NULL)
+    g_hash_table_destroy (dest_entries);
+
+  return success;
 }
 
+/**
+ * Plan the synchronization of an entry, the destination may be NULL.  If the
+ * entry is to be created, replaced or removed, `parent_modified' is set.  The
+ * first of the sources is the one synchronized, the rest are directories of
+ * the same path in later source trees, merged into it.
+ */
 static gboolean
-rudgiosync_synchronize_internal (RudgiosyncDirectoryEntry **destination,
-                                 RudgiosyncDirectoryEntry **source,
-                                 gboolean check_timestamp,
-                                 gboolean checksum_only,
-                                 gboolean delete_unwanted,
-                                 const gchar *prefix,
-                                 GError **error)
+plan_entry (PlanState *state,
+            RudgiosyncDirectoryEntry *destination,
+            const PlanSource *sources,
+            guint source_count,
+            const gchar *path,
+            const gchar *src_path,
+            gboolean *parent_modified,
+            GError **error)
 {
-  GError *ierror = NULL;
-  GFile *temp_descriptor;
+  RudgiosyncDirectoryEntry *source = sources[0].entry;
+  RudgiosyncTree           *src_tree = state->src_trees[sources[0].tree];
+
   gchar *src_uri;
   gchar *dest_uri;
 
-  gboolean already_modified = FALSE;
+  gboolean announce = FALSE;
+  gboolean modified = FALSE;
 
 
-  if ((*source)->type == RUDGIOSYNC_DIR_ENTRY_OTHER)
+  if (source->type == RUDGIOSYNC_DIR_ENTRY_OTHER)
     {
-      src_uri = g_file_get_uri ((*source)->descriptor);
-      g_print ("Skipping non-regular file `%s'.\n", src_uri);
-      g_free (src_uri);
+      if (rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_NORMAL)
+        {
+          src_uri = rudgiosync_directory_entry_get_uri (src_tree, source);
+          g_print ("Skipping non-regular file `%s'.\n", src_uri);
+          g_free (src_uri);
+        }
 
       return TRUE;
     }
-  else if ((*source)->type == RUDGIOSYNC_DIR_ENTRY_FILE)
+  else if (source->type == RUDGIOSYNC_DIR_ENTRY_FILE)
     {
-      if (!delete_unwanted && (*destination)->type == RUDGIOSYNC_DIR_ENTRY_DIR)
-        {
-          src_uri = g_file_get_uri ((*source)->descriptor);
-          dest_uri = g_file_get_uri ((*destination)->descriptor);
-
-          g_set_error (error, RUDGIOSYNC_ERROR,
-                       RUDGIOSYNC_DIR_PROTECTION_ERROR,
-                       "Refusing to replace the directory `%s' with "
-                       "the file `%s': %s",
-                       dest_uri,
-                       src_uri,
-                       "Could cause major data loss if the request was not "
-                       "intentional, use the --delete argument to override "
-                       "this behavior");
-
-          g_free (dest_uri);
-          g_free (src_uri);
-
-          return FALSE;
-        }
-      if ((*destination)->type != RUDGIOSYNC_DIR_ENTRY_FILE)
+      if (destination != NULL)
         {
-          dest_uri = g_file_get_uri ((*destination)->descriptor);
-
-          rudgiosync_directory_entry_delete (*destination, &ierror);
-          *destination = NULL;
-
-          if (ierror != NULL)
+          if (!state->delete_unwanted && destination->type == RUDGIOSYNC_DIR_ENTRY_DIR)
             {
-              g_propagate_error (error, ierror);
+              src_uri = rudgiosync_directory_entry_get_uri (src_tree, source);
+              dest_uri = rudgiosync_directory_entry_get_uri (state->dest_tree, destination);
+
+              g_set_error (error, RUDGIOSYNC_ERROR,
+                           RUDGIOSYNC_DIR_PROTECTION_ERROR,
+                           "Refusing to replace the directory `%s' with "
+                           "the file `%s': %s",
+                           dest_uri,
+                           src_uri,
+                           "Could cause major data loss if the request was not "
+                           "intentional, use the --delete argument to override "
+                           "this behavior");
 
               g_free (dest_uri);
+              g_free (src_uri);
+
               return FALSE;
             }
-
-          temp_descriptor = g_file_new_for_uri (dest_uri);
-          g_free (dest_uri);
-
-          *destination = create_empty_file (temp_descriptor, checksum_only, &ierror);
-          g_object_unref (temp_descriptor);
-          if (ierror != NULL)
+          if (destination->type != RUDGIOSYNC_DIR_ENTRY_FILE)
             {
-              g_propagate_error (error, ierror);
-              return FALSE;
+              if (!plan_deletion (state, destination, path, error))
+                return FALSE;
+
+              destination = NULL;
             }
-          already_modified = TRUE;
         }
-      g_assert (*destination != NULL);
-      g_assert ((*destination)->type == RUDGIOSYNC_DIR_ENTRY_FILE);
 
-      sync_file (*destination, *source, check_timestamp, checksum_only, prefix, already_modified, &ierror);
-      if (ierror != NULL)
+      if (destination == NULL
+          || files_differ (destination, source, state->check_timestamp, state->checksum_only))
         {
-          g_propagate_error (error, ierror);
-          return FALSE;
+          *parent_modified = TRUE;
+          return plan_emit (state, RUDGIOSYNC_ACTION_COPY, RUDGIOSYNC_DIR_ENTRY_FILE, TRUE,
+                            source->data.file.size, source->modified_time,
+                            path, src_path, sources[0].tree, destination,
+                            error);
+        }
+
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_SKIPPED, 1);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SKIPPED, source->data.file.size);
+      if (rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_VERBOSE)
+        {
+          src_uri = rudgiosync_directory_entry_get_uri (src_tree, source);
+          g_print ("Up to date: `%s'.\n", src_uri);
+          g_free (src_uri);
         }
     }
-  else if ((*source)->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+  else if (source->type == RUDGIOSYNC_DIR_ENTRY_DIR)
     {
-      if ((*destination)->type != RUDGIOSYNC_DIR_ENTRY_DIR)
+      if (destination != NULL && destination->type != RUDGIOSYNC_DIR_ENTRY_DIR)
         {
-          temp_descriptor = g_object_ref ((*destination)->descriptor);
+          if (!plan_deletion (state, destination, path, error))
+            return FALSE;
 
-          rudgiosync_directory_entry_delete (*destination, &ierror);
-          *destination = NULL;
-
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-
-              g_object_unref (temp_descriptor);
-              return FALSE;
-            }
-
-          g_file_make_directory (temp_descriptor, NULL, &ierror);
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-
-              g_object_unref (temp_descriptor);
-              return FALSE;
-            }
-          *destination = rudgiosync_directory_entry_new (temp_descriptor, checksum_only, &ierror);
-          g_object_unref (temp_descriptor);
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-              return FALSE;
-            }
-          already_modified = TRUE;
+          destination = NULL;
         }
-      g_assert (*destination != NULL);
-      g_assert ((*destination)->type == RUDGIOSYNC_DIR_ENTRY_DIR);
 
-      if (delete_unwanted)
+      if (destination == NULL)
         {
-          delete_non_present_entries_from_dest (*destination, *source, &ierror);
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-              return FALSE;
-            }
+          *parent_modified = TRUE;
+          if (!plan_emit (state, RUDGIOSYNC_ACTION_MKDIR, RUDGIOSYNC_DIR_ENTRY_DIR, TRUE,
+                          0, source->modified_time,
+                          path, src_path, sources[0].tree, NULL,
+                          error))
+            return FALSE;
         }
-
-      sync_directory (*destination, *source, check_timestamp, checksum_only, delete_unwanted, prefix, already_modified, &ierror);
-      if (ierror != NULL)
+      else
         {
-          g_propagate_error (error, ierror);
-          return FALSE;
+          announce = state->check_timestamp
+                     && destination->modified_time != source->modified_time;
         }
+
+      if (!plan_directory (state, destination, sources, source_count, path, src_path, &modified, error))
+        return FALSE;
+
+      /* Leave the times of untouched, matching directories alone. */
+      if (destination != NULL && !modified
+          && destination->modified_time == source->modified_time)
+        return TRUE;
+
+      return plan_emit (state, RUDGIOSYNC_ACTION_TOUCH, RUDGIOSYNC_DIR_ENTRY_DIR, announce,
+                        0, source->modified_time,
+                        path, src_path, sources[0].tree, NULL,
+                        error);
     }
 
   return TRUE;
 }
 
 gboolean
-rudgiosync_synchronize (RudgiosyncDirectoryEntry **destination,
-                        RudgiosyncDirectoryEntry **source,
+rudgiosync_plan_trees (RudgiosyncTree *destination,
+                       RudgiosyncTree *source,
+                       gboolean check_timestamp,
+                       gboolean checksum_only,
+                       gboolean delete_unwanted,
+                       RudgiosyncActionFunc func,
+                       gpointer user_data,
+                       GError **error)
+{
+  return rudgiosync_plan_merged (destination, &source, 1,
+                                 check_timestamp, checksum_only, delete_unwanted,
+                                 func, user_data,
+                                 error);
+}
+
+gboolean
+rudgiosync_plan_merged (RudgiosyncTree *destination,
+                        RudgiosyncTree **sources,
+                        guint source_count,
                         gboolean check_timestamp,
                         gboolean checksum_only,
                         gboolean delete_unwanted,
+                        RudgiosyncActionFunc func,
+                        gpointer user_data,
                         GError **error)
 {
   RudgiosyncDirectoryEntry *subdir_entry;
-  RudgiosyncDirectoryEntry **subdir_entry_loc;
-  GSList *subdir_entry_li;
-  GFile *subdir_entry_descriptor;
-  GError *ierror = NULL;
+  RudgiosyncTree *source = sources[0];
+  PlanSource      file_root;
+  PlanSource     *roots;
+  PlanState       state;
+  gchar          *uri;
+  gboolean        root_modified = FALSE;
+  gboolean        retval;
+  guint           iter;
+
+  state.dest_tree       = destination;
+  state.src_trees       = sources;
+  state.check_timestamp = check_timestamp;
+  state.checksum_only   = checksum_only;
+  state.delete_unwanted = delete_unwanted;
+  state.func            = func;
+  state.user_data       = user_data;
 
   /**
    * If on the top level, the user requests us to synchronize a source file
@@ -700,47 +828,50 @@ rudgiosync_synchronize (RudgiosyncDirectoryEntry **destination,
    * Note: This behavior only applies to the highest level; deeper within the
    *       directory tree, files will replace directories with the same names.
    */
-  if ((*source)->type == RUDGIOSYNC_DIR_ENTRY_FILE
-      && (*destination)->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+  if (source_count == 1
+      && source->root->type == RUDGIOSYNC_DIR_ENTRY_FILE
+      && destination->root->type == RUDGIOSYNC_DIR_ENTRY_DIR)
     {
-      subdir_entry_loc = NULL;
-
-      for (subdir_entry_li = (*destination)->data.directory.entries;
-           subdir_entry_li != NULL && subdir_entry_loc == NULL;
-           subdir_entry_li = subdir_entry_li->next)
-        {
-          subdir_entry_loc = (RudgiosyncDirectoryEntry **)(&(subdir_entry_li->data));
-          if (strcmp ((*subdir_entry_loc)->name, (*source)->name) != 0)
-            {
-              subdir_entry_loc = NULL;
-            }
-        }
-      if (subdir_entry_loc == NULL)
+      for (subdir_entry = destination->root->data.directory.entries;
+           subdir_entry != NULL;
+           subdir_entry = subdir_entry->next)
         {
-          subdir_entry_descriptor = g_file_get_child ((*destination)->descriptor, (*source)->name);
-          subdir_entry = create_empty_file (subdir_entry_descriptor,
-                                            checksum_only,
-                                            &ierror);
-          g_object_unref (subdir_entry_descriptor);
-          if (ierror != NULL)
-            {
-              g_propagate_error (error, ierror);
-              return FALSE;
-            }
-          (*destination)->data.directory.entries = g_slist_prepend ((*destination)->data.directory.entries, subdir_entry);
-          subdir_entry_loc = (RudgiosyncDirectoryEntry **)(&((*destination)->data.directory.entries->data));
+          if (strcmp (subdir_entry->name, source->root->name) == 0)
+            break;
         }
 
-      return rudgiosync_synchronize_internal (subdir_entry_loc, source,
-                                              check_timestamp, checksum_only, delete_unwanted,
-                                              (*destination)->name,
-                                              error);
+      file_root.entry = source->root;
+      file_root.tree = 0;
+      return plan_entry (&state, subdir_entry, &file_root, 1,
+                         source->root->name, "",
+                         &root_modified,
+                         error);
     }
-  else
+
+  roots = g_new (PlanSource, source_count);
+  for (iter = 0; iter < source_count; iter++)
     {
-      return rudgiosync_synchronize_internal (destination, source,
-                                              check_timestamp, checksum_only, delete_unwanted,
-                                              NULL,
-                                              error);
+      if (source_count > 1 && sources[iter]->root->type != RUDGIOSYNC_DIR_ENTRY_DIR)
+        {
+          uri = g_file_get_uri (sources[iter]->descriptor);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                       "Only directories can be merged into one destination, which `%s' is not",
+                       uri);
+          g_free (uri);
+          g_free (roots);
+
+          return FALSE;
+        }
+
+      roots[iter].entry = sources[iter]->root;
+      roots[iter].tree = iter;
     }
+
+  retval = plan_entry (&state, destination->root, roots, source_count,
+                       "", "",
+                       &root_modified,
+                       error);
+  g_free (roots);
+
+  return retval;
 }
@@ -20,20 +20,94 @@
 #define _RUDGIOSYNC_OPERATIONS_H_
 
 #include "boiler.h"
+#include "buffers.h"
+#include "sparse.h"
+#include "checksum.h"
 #include "descriptions.h"
+#include "plan.h"
 
 void traverse_directory_tree (RudgiosyncDirectoryEntry *entry,
                               const gchar *prefix);
 
-/* Delete the given directory entry.  May fail, but entry is always freed. */
-gboolean rudgiosync_directory_entry_delete (RudgiosyncDirectoryEntry *entry, 
-                                            GError **error);
+/* Set the time of last modification of the given file. */
+gboolean set_modified_time (GFile *descriptor,
+                            guint64 modified_time,
+                            GError **error);
 
-gboolean rudgiosync_synchronize (RudgiosyncDirectoryEntry **destination,
-                                 RudgiosyncDirectoryEntry **source,
+/* Prefix an error with the locations of the copy it happened during. */
+void rudgiosync_propagate_copy_error (GError **error,
+                                      GError *ierror,
+                                      GFile *destination,
+                                      GFile *source);
+
+/**
+ * Give up on a stream replacing a destination.  Merely dropping it would
+ * close it, putting what was written in place of the old contents, while a
+ * cancelled close keeps an existing destination as it was.  One which didn't
+ * exist is left behind, empty or partly written.
+ */
+void rudgiosync_abandon_output (GFileOutputStream *output);
+
+/**
+ * Copy everything from the input to the output stream, using the buffer.
+ * If `sparse', long runs of zeroes are left as holes where possible.  The data
+ * is hashed along the way if a hashing state is given.
+ */
+gboolean rudgiosync_copy_stream (GInputStream *input,
+                                 GOutputStream *output,
+                                 gboolean sparse,
+                                 gchar *buffer,
+                                 gsize buffer_size,
+                                 RudgiosyncHashContext *hash,
+                                 GError **error);
+
+/**
+ * Reserve space for the given size of data in a local output stream, so the
+ * file is laid out in one piece, and a lack of space shows up front.  Other
+ * streams, and filesystems which can't do it, are left be.
+ */
+gboolean rudgiosync_preallocate (GOutputStream *output,
+                                 guint64 size,
+                                 GError **error);
+
+/**
+ * Replace the contents of a file, expected to be of the given size, and give
+ * it the wanted modification time.  If `checksum' isn't NULL, it's set to
+ * that of the data written.
+ */
+gboolean rudgiosync_copy_file (GFile *destination,
+                               GFile *source,
+                               guint64 size,
+                               guint64 modified_time,
+                               RudgiosyncChecksum *checksum,
+                               GError **error);
+
+/**
+ * Compare two trees, passing the actions which would make the destination
+ * match the source to the given function.  No changes are made.
+ */
+gboolean rudgiosync_plan_trees (RudgiosyncTree *destination,
+                                RudgiosyncTree *source,
+                                gboolean check_timestamp,
+                                gboolean checksum_only,
+                                gboolean delete_unwanted,
+                                RudgiosyncActionFunc func,
+                                gpointer user_data,
+                                GError **error);
+
+/**
+ * Compare several source trees, all of them directories, with a destination
+ * they're merged into, as above.  Where the same path is in several sources,
+ * the first one wins, unless they're all directories, which are merged.
+ */
+gboolean rudgiosync_plan_merged (RudgiosyncTree *destination,
+                                 RudgiosyncTree **sources,
+                                 guint source_count,
                                  gboolean check_timestamp,
                                  gboolean checksum_only,
                                  gboolean delete_unwanted,
+                                 RudgiosyncActionFunc func,
+                                 gpointer user_data,
                                  GError **error);
 
 #endif /* _RUDGIOSYNC_OPERATIONS_H_ */
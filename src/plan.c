@@ -0,0 +1,1112 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "plan.h"
+#include "descriptions.h"
+#include "operations.h"
+#include "copier.h"
+#include "fanout.h"
+#include "resume.h"
+#include "verify.h"
+#include "errors.h"
+#include "stats.h"
+#include "trace.h"
+#include "progress.h"
+
+#include <string.h>
+
+#define PLAN_FILE_MAGIC "rudgiosync-plan\t2"
+
+
+static const gchar *action_names[] =
+{
+  "delete",   /* RUDGIOSYNC_ACTION_DELETE */
+  "mkdir",    /* RUDGIOSYNC_ACTION_MKDIR */
+  "copy",     /* RUDGIOSYNC_ACTION_COPY */
+  "touch"     /* RUDGIOSYNC_ACTION_TOUCH */
+};
+
+static const gchar *comparison_names[] =
+{
+  "times",     /* RUDGIOSYNC_PLAN_COMPARE_TIMES */
+  "sizes",     /* RUDGIOSYNC_PLAN_COMPARE_SIZES */
+  "checksums"  /* RUDGIOSYNC_PLAN_COMPARE_CHECKSUMS */
+};
+
+static const gchar entry_type_chars[] =
+{
+  'f',        /* RUDGIOSYNC_DIR_ENTRY_FILE */
+  'd',        /* RUDGIOSYNC_DIR_ENTRY_DIR */
+  'o'         /* RUDGIOSYNC_DIR_ENTRY_OTHER */
+};
+
+
+RudgiosyncPlan *
+rudgiosync_plan_new (GFile *source,
+                     GFile *destination,
+                     const gchar *display_name)
+{
+  RudgiosyncPlan *retval;
+
+  retval = g_slice_new0 (RudgiosyncPlan);
+  retval->source = g_object_ref (source);
+  retval->sources = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (retval->sources, g_object_ref (source));
+  retval->destination = g_object_ref (destination);
+  retval->display_name = g_strdup (display_name);
+  retval->actions = g_ptr_array_new ();
+  rudgiosync_arena_init (&(retval->arena));
+
+  return retval;
+}
+
+void
+rudgiosync_plan_free (RudgiosyncPlan *plan)
+{
+  if (plan == NULL)
+    return;
+
+  g_ptr_array_free (plan->actions, TRUE);
+  rudgiosync_arena_clear (&(plan->arena));
+  g_free (plan->display_name);
+  g_ptr_array_free (plan->sources, TRUE);
+  g_object_unref (plan->source);
+  g_object_unref (plan->destination);
+
+  g_slice_free (RudgiosyncPlan, plan);
+}
+
+void
+rudgiosync_plan_add_source (RudgiosyncPlan *plan, GFile *source)
+{
+  g_ptr_array_add (plan->sources, g_object_ref (source));
+}
+
+static void
+plan_count (RudgiosyncPlan *plan, RudgiosyncAction *action)
+{
+  switch (action->type)
+    {
+      case RUDGIOSYNC_ACTION_COPY:
+        plan->copy_count++;
+        plan->copy_bytes += action->size;
+        break;
+
+      case RUDGIOSYNC_ACTION_MKDIR:
+        plan->mkdir_count++;
+        break;
+
+      case RUDGIOSYNC_ACTION_DELETE:
+        plan->delete_count++;
+        break;
+    }
+}
+
+gboolean
+rudgiosync_plan_append (RudgiosyncAction *action, gpointer plan, GError **error)
+{
+  RudgiosyncPlan   *self = plan;
+  RudgiosyncAction *copy;
+
+  copy = rudgiosync_arena_alloc (&(self->arena), sizeof (RudgiosyncAction));
+  *copy = *action;
+  copy->path = rudgiosync_arena_strdup (&(self->arena), action->path);
+
+  if (action->src_path == NULL)
+    copy->src_path = NULL;
+  else if (strcmp (action->src_path, action->path) == 0)
+    copy->src_path = copy->path;
+  else
+    copy->src_path = rudgiosync_arena_strdup (&(self->arena), action->src_path);
+
+  g_ptr_array_add (self->actions, copy);
+  plan_count (self, copy);
+
+  return TRUE;
+}
+
+
+/* Execution. */
+
+static GFile *
+plan_resolve (GFile *root, const gchar *path)
+{
+  if (path[0] == '\0')
+    return g_object_ref (root);
+
+  return g_file_resolve_relative_path (root, path);
+}
+
+/* The source file of a copy. */
+static GFile *
+plan_resolve_source (RudgiosyncPlan *plan, RudgiosyncAction *action)
+{
+  return plan_resolve (g_ptr_array_index (plan->sources, action->source), action->src_path);
+}
+
+static void
+plan_print_path (RudgiosyncPlan *plan, const gchar *path, gboolean is_directory)
+{
+  gchar *display_path;
+
+  if (path[0] == '\0')
+    {
+      g_print ("%s%s\n", plan->display_name, is_directory ? "/" : "");
+      return;
+    }
+
+  display_path = g_filename_display_name (path);
+  g_print ("%s/%s%s\n", plan->display_name, display_path, is_directory ? "/" : "");
+  g_free (display_path);
+}
+
+/* List the path of an action being carried out, if it's to be listed. */
+static void
+plan_announce (RudgiosyncPlan *plan, RudgiosyncAction *action, gboolean is_directory)
+{
+  if (action->announce && rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_NORMAL)
+    plan_print_path (plan, action->path, is_directory);
+}
+
+static void
+plan_print_changed (GFile *descriptor)
+{
+  gchar *uri;
+
+  if (rudgiosync_progress_verbosity () < RUDGIOSYNC_VERBOSITY_NORMAL)
+    return;
+
+  uri = g_file_get_uri (descriptor);
+  g_print ("Skipping `%s', which has changed since the plan was made.\n", uri);
+  g_free (uri);
+}
+
+/* Whether a validated deletion should still go ahead. */
+static gboolean
+plan_delete_wanted (RudgiosyncAction *action, GFile *descriptor)
+{
+  RudgiosyncTraceSpan span;
+  GFileType           type;
+
+  rudgiosync_trace_begin (&span);
+  type = g_file_query_file_type (descriptor, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, descriptor, -1);
+  if (type == G_FILE_TYPE_UNKNOWN)
+    return FALSE;
+
+  if ((type == G_FILE_TYPE_DIRECTORY) != (action->entry_type == RUDGIOSYNC_DIR_ENTRY_DIR))
+    {
+      plan_print_changed (descriptor);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+plan_delete (RudgiosyncAction *action, GFile *descriptor, gboolean validate, GError **error)
+{
+  RudgiosyncTraceSpan  span;
+  gchar               *uri;
+  GError              *ierror = NULL;
+
+  if (validate && !plan_delete_wanted (action, descriptor))
+    return TRUE;
+
+  uri = g_file_get_uri (descriptor);
+  rudgiosync_trace_begin (&span);
+  g_file_delete (descriptor, NULL, &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_DELETE, descriptor, -1);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to delete `%s': ", uri);
+      g_free (uri);
+      return FALSE;
+    }
+
+  if (rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_NORMAL)
+    g_print ("Deleted `%s'.\n", uri);
+  g_free (uri);
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_ENTRIES_DELETED, 1);
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_DELETED, action->size);
+  return TRUE;
+}
+
+/* Finish making a directory, given the outcome of the attempt. */
+static gboolean
+plan_made_directory (RudgiosyncPlan *plan,
+                     RudgiosyncAction *action,
+                     GFile *descriptor,
+                     gboolean validate,
+                     GError *ierror,
+                     GError **error)
+{
+  if (ierror != NULL)
+    {
+      /* An earlier, interrupted, application of the plan may have made it. */
+      if (!validate
+          || !g_error_matches (ierror, G_IO_ERROR, G_IO_ERROR_EXISTS)
+          || g_file_query_file_type (descriptor, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) != G_FILE_TYPE_DIRECTORY)
+        {
+          g_propagate_error (error, ierror);
+          return FALSE;
+        }
+      g_clear_error (&ierror);
+      return TRUE;
+    }
+
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_DIRECTORIES_MADE, 1);
+  plan_announce (plan, action, TRUE);
+
+  return TRUE;
+}
+
+static gboolean
+plan_make_directory (RudgiosyncPlan *plan, RudgiosyncAction *action, GFile *descriptor, gboolean validate, GError **error)
+{
+  RudgiosyncTraceSpan span;
+  GError *ierror = NULL;
+
+  rudgiosync_trace_begin (&span);
+  g_file_make_directory (descriptor, NULL, &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_MKDIR, descriptor, -1);
+  return plan_made_directory (plan, action, descriptor, validate, ierror, error);
+}
+
+static gboolean
+plan_copy (RudgiosyncPlan *plan,
+           RudgiosyncAction *action,
+           GFile *descriptor,
+           gboolean validate,
+           RudgiosyncCopier *copier,
+           GError **error)
+{
+  GFile     *src_descriptor;
+  GFileInfo *info;
+  gchar     *uri;
+  gboolean   retval;
+  guint64    size;
+  guint64    modified_time;
+  RudgiosyncTraceSpan span;
+  RudgiosyncChecksum  checksum;
+
+  GError *ierror = NULL;
+
+
+  src_descriptor = plan_resolve_source (plan, action);
+
+  if (validate)
+    {
+      rudgiosync_trace_begin (&span);
+      info = g_file_query_info (src_descriptor,
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                NULL,
+                                &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, src_descriptor, -1);
+      if (ierror != NULL)
+        {
+          uri = g_file_get_uri (src_descriptor);
+          g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the file `%s': ", uri);
+          g_free (uri);
+          g_object_unref (src_descriptor);
+
+          return FALSE;
+        }
+
+      if ((guint64)g_file_info_get_size (info) != action->size
+          || g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) != action->modified_time)
+        {
+          plan_print_changed (src_descriptor);
+          rudgiosync_progress_file (action->size);
+
+          g_object_unref (info);
+          g_object_unref (src_descriptor);
+          return TRUE;
+        }
+      g_object_unref (info);
+
+      /**
+       * Re-applying an interrupted plan shouldn't copy everything again.  A
+       * destination matching the source in size and time is taken as copied
+       * when that's how the plan compares files.  Otherwise, such as when the
+       * plan is to replace files which only differ in content, the destination
+       * also has to have changed since the plan was made.
+       */
+      rudgiosync_trace_begin (&span);
+      info = g_file_query_info (descriptor,
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                NULL,
+                                NULL);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, descriptor, -1);
+      if (info != NULL)
+        {
+          size = (guint64)g_file_info_get_size (info);
+          modified_time = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+          g_object_unref (info);
+
+          retval = size == action->size
+                   && modified_time == action->modified_time
+                   && (plan->comparison == RUDGIOSYNC_PLAN_COMPARE_TIMES
+                       || !action->replaces
+                       || size != action->replaced_size
+                       || modified_time != action->replaced_modified_time);
+
+          if (retval)
+            {
+              rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_SKIPPED, 1);
+              rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SKIPPED, action->size);
+              rudgiosync_progress_file (action->size);
+              g_object_unref (src_descriptor);
+              return TRUE;
+            }
+        }
+    }
+
+  plan_announce (plan, action, FALSE);
+
+  /* Copies made one at a time, as the comparison goes, are checked right away,
+     before the time of their directory gets set. */
+  if (copier != NULL)
+    retval = rudgiosync_copier_copy (copier, descriptor, src_descriptor, action->size, action->modified_time, error);
+  else if (!rudgiosync_verify_enabled ())
+    retval = rudgiosync_copy_file (descriptor, src_descriptor, action->size, action->modified_time, NULL, error);
+  else
+    retval = rudgiosync_copy_file (descriptor, src_descriptor, action->size, action->modified_time, &checksum, error)
+             && rudgiosync_verify_file (descriptor, src_descriptor, &checksum, action->size, action->modified_time, error);
+  g_object_unref (src_descriptor);
+
+  if (retval)
+    {
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_COPIED, 1);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_COPIED, action->size);
+      rudgiosync_progress_file (0);
+    }
+
+  return retval;
+}
+
+gboolean
+rudgiosync_plan_execute_action (RudgiosyncPlan *plan,
+                                RudgiosyncAction *action,
+                                gboolean validate,
+                                RudgiosyncCopier *copier,
+                                GError **error)
+{
+  GFile    *descriptor;
+  gboolean  retval = TRUE;
+
+  descriptor = plan_resolve (plan->destination, action->path);
+
+  switch (action->type)
+    {
+      case RUDGIOSYNC_ACTION_DELETE:
+        retval = plan_delete (action, descriptor, validate, error);
+        break;
+
+      case RUDGIOSYNC_ACTION_MKDIR:
+        retval = plan_make_directory (plan, action, descriptor, validate, error);
+        break;
+
+      case RUDGIOSYNC_ACTION_COPY:
+        retval = plan_copy (plan, action, descriptor, validate, copier, error);
+        break;
+
+      case RUDGIOSYNC_ACTION_TOUCH:
+        plan_announce (plan, action, TRUE);
+
+        set_modified_time (descriptor, action->modified_time, NULL);
+        break;
+    }
+
+  g_object_unref (descriptor);
+  return retval;
+}
+
+gboolean
+rudgiosync_plan_execute_fanout (RudgiosyncPlan **plans,
+                                RudgiosyncAction **actions,
+                                guint count,
+                                GError **error)
+{
+  GFile              *src_descriptor;
+  GFile             **descriptors;
+  RudgiosyncChecksum  checksum;
+  gboolean            verify;
+  gboolean            retval;
+  guint               iter;
+
+  descriptors = g_new (GFile *, count);
+  for (iter = 0; iter < count; iter++)
+    {
+      descriptors[iter] = plan_resolve (plans[iter]->destination, actions[iter]->path);
+      plan_announce (plans[iter], actions[iter], FALSE);
+    }
+  src_descriptor = plan_resolve_source (plans[0], actions[0]);
+
+  verify = rudgiosync_verify_enabled ();
+  retval = rudgiosync_fanout_copy (src_descriptor, descriptors, count,
+                                   actions[0]->size, actions[0]->modified_time,
+                                   verify ? &checksum : NULL, error);
+
+  for (iter = 0; iter < count; iter++)
+    {
+      if (retval && verify)
+        rudgiosync_verify_queue (descriptors[iter], src_descriptor, &checksum,
+                                 actions[0]->size, actions[0]->modified_time);
+      g_object_unref (descriptors[iter]);
+    }
+  g_free (descriptors);
+  g_object_unref (src_descriptor);
+
+  if (retval)
+    {
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_COPIED, count);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_COPIED, actions[0]->size * count);
+      for (iter = 0; iter < count; iter++)
+        rudgiosync_progress_file (0);
+    }
+
+  return retval;
+}
+
+gboolean
+rudgiosync_plan_execute_cb (RudgiosyncAction *action, gpointer plan, GError **error)
+{
+  static const guint phases[] =
+    {
+      [RUDGIOSYNC_ACTION_DELETE] = RUDGIOSYNC_PHASE_DELETE,
+      [RUDGIOSYNC_ACTION_MKDIR]  = RUDGIOSYNC_PHASE_MKDIR,
+      [RUDGIOSYNC_ACTION_COPY]   = RUDGIOSYNC_PHASE_COPY,
+      [RUDGIOSYNC_ACTION_TOUCH]  = RUDGIOSYNC_PHASE_MTIME
+    };
+  RudgiosyncStatsTimer timer;
+  gboolean             retval;
+
+  rudgiosync_stats_start (&timer);
+  retval = rudgiosync_plan_execute_action (plan, action, FALSE, NULL, error);
+  rudgiosync_stats_stop (&timer, phases[action->type]);
+
+  return retval;
+}
+
+void
+rudgiosync_plan_prefetch (RudgiosyncPlan *plan,
+                          RudgiosyncAction *action,
+                          gboolean validate,
+                          RudgiosyncCopier *copier)
+{
+  GFile *descriptor;
+  GFile *src_descriptor;
+
+  if (action->type != RUDGIOSYNC_ACTION_COPY)
+    return;
+
+  descriptor = plan_resolve (plan->destination, action->path);
+  src_descriptor = plan_resolve_source (plan, action);
+
+  /* A validated copy may yet be skipped, so its destination must stay, and
+     a large file's partial file is only opened once it's known what to keep.
+     Opening a new file creates it, which would leave it empty if the copy
+     never came, so only existing destinations are opened ahead. */
+  rudgiosync_copier_prefetch (copier, descriptor, src_descriptor,
+                              !validate && action->replaces
+                              && !rudgiosync_resume_wanted (action->size));
+
+  g_object_unref (descriptor);
+  g_object_unref (src_descriptor);
+}
+
+
+/* Concurrent execution of independent actions. */
+
+#define PLAN_BATCH_OUTPUT_MAX 65536  /* Output collected before printing it. */
+
+typedef struct
+{
+  RudgiosyncPlan *plan;
+  GPtrArray      *actions;
+  gboolean        validate;
+  GMainContext   *context;
+  guint           next;
+  guint           pending;
+  GError         *error;       /* The first failure, stops starting more. */
+  GString        *output;      /* Deletions, printed a bunch at a time. */
+} PlanBatch;
+
+typedef struct
+{
+  PlanBatch          *batch;
+  RudgiosyncAction   *action;
+  GFile              *descriptor;
+  RudgiosyncTraceSpan span;
+} PlanBatchItem;
+
+static void
+plan_batch_item_done (PlanBatchItem *item)
+{
+  item->batch->pending--;
+
+  g_object_unref (item->descriptor);
+  g_free (item);
+}
+
+static void
+plan_batch_fail (PlanBatch *batch, GError *ierror)
+{
+  if (batch->error == NULL)
+    g_propagate_error (&(batch->error), ierror);
+  else
+    g_error_free (ierror);
+}
+
+static void
+plan_batch_flush (PlanBatch *batch)
+{
+  if (batch->output->len > 0)
+    {
+      g_print ("%s", batch->output->str);
+      g_string_truncate (batch->output, 0);
+    }
+}
+
+static void
+plan_batch_directory_made (GObject *object, GAsyncResult *result, gpointer data)
+{
+  PlanBatchItem *item = data;
+  PlanBatch     *batch = item->batch;
+
+  GError *ierror = NULL;
+  GError *made_error = NULL;
+
+
+  g_file_make_directory_finish (G_FILE (object), result, &ierror);
+  rudgiosync_trace_end (&(item->span), RUDGIOSYNC_TRACE_MKDIR, item->descriptor, -1);
+  if (!plan_made_directory (batch->plan, item->action, item->descriptor, batch->validate, ierror, &made_error))
+    plan_batch_fail (batch, made_error);
+
+  plan_batch_item_done (item);
+}
+
+static void
+plan_batch_deleted (GObject *object, GAsyncResult *result, gpointer data)
+{
+  PlanBatchItem *item = data;
+  PlanBatch     *batch = item->batch;
+  gchar         *uri;
+
+  GError *ierror = NULL;
+
+
+  rudgiosync_trace_end (&(item->span), RUDGIOSYNC_TRACE_DELETE, item->descriptor, -1);
+  uri = g_file_get_uri (item->descriptor);
+  if (!g_file_delete_finish (G_FILE (object), result, &ierror))
+    {
+      g_prefix_error (&ierror, "Failed to delete `%s': ", uri);
+      plan_batch_fail (batch, ierror);
+    }
+  else
+    {
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_ENTRIES_DELETED, 1);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_DELETED, item->action->size);
+      if (rudgiosync_progress_verbosity () >= RUDGIOSYNC_VERBOSITY_NORMAL)
+        g_string_append_printf (batch->output, "Deleted `%s'.\n", uri);
+      if (batch->output->len >= PLAN_BATCH_OUTPUT_MAX)
+        plan_batch_flush (batch);
+    }
+  g_free (uri);
+
+  plan_batch_item_done (item);
+}
+
+static void
+plan_batch_time_set (GObject *object, GAsyncResult *result, gpointer data)
+{
+  PlanBatchItem *item = data;
+
+  /* As with a single action, the time is merely a hint for later runs. */
+  g_file_set_attributes_finish (G_FILE (object), result, NULL, NULL);
+  rudgiosync_trace_end (&(item->span), RUDGIOSYNC_TRACE_SET_ATTRIBUTES, item->descriptor, -1);
+  plan_batch_item_done (item);
+}
+
+static void
+plan_batch_start (PlanBatch *batch, guint max_pending)
+{
+  PlanBatchItem *item;
+  GFileInfo     *info;
+
+  while (batch->error == NULL && batch->pending < max_pending && batch->next < batch->actions->len)
+    {
+      item = g_new (PlanBatchItem, 1);
+      item->batch = batch;
+      item->action = g_ptr_array_index (batch->actions, batch->next++);
+      item->descriptor = plan_resolve (batch->plan->destination, item->action->path);
+      batch->pending++;
+
+      if (item->action->type == RUDGIOSYNC_ACTION_DELETE)
+        {
+          if (batch->validate && !plan_delete_wanted (item->action, item->descriptor))
+            {
+              plan_batch_item_done (item);
+              continue;
+            }
+
+          rudgiosync_trace_begin (&(item->span));
+          g_file_delete_async (item->descriptor,
+                               G_PRIORITY_DEFAULT,
+                               NULL,
+                               plan_batch_deleted,
+                               item);
+        }
+      else if (item->action->type == RUDGIOSYNC_ACTION_MKDIR)
+        {
+          rudgiosync_trace_begin (&(item->span));
+          g_file_make_directory_async (item->descriptor,
+                                       G_PRIORITY_DEFAULT,
+                                       NULL,
+                                       plan_batch_directory_made,
+                                       item);
+        }
+      else
+        {
+          plan_announce (batch->plan, item->action, TRUE);
+
+          info = g_file_info_new ();
+          g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED, item->action->modified_time);
+          rudgiosync_trace_begin (&(item->span));
+          g_file_set_attributes_async (item->descriptor,
+                                       info,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       G_PRIORITY_DEFAULT,
+                                       NULL,
+                                       plan_batch_time_set,
+                                       item);
+          g_object_unref (info);
+        }
+    }
+}
+
+gboolean
+rudgiosync_plan_execute_batch (RudgiosyncPlan *plan,
+                               GPtrArray *actions,
+                               gboolean validate,
+                               guint max_pending,
+                               GError **error)
+{
+  PlanBatch batch;
+
+  memset (&batch, 0, sizeof (batch));
+  batch.plan = plan;
+  batch.actions = actions;
+  batch.validate = validate;
+  batch.context = g_main_context_new ();
+  batch.output = g_string_new (NULL);
+  g_main_context_push_thread_default (batch.context);
+
+  plan_batch_start (&batch, max_pending);
+  while (batch.pending > 0)
+    {
+      g_main_context_iteration (batch.context, TRUE);
+      plan_batch_start (&batch, max_pending);
+    }
+
+  g_main_context_pop_thread_default (batch.context);
+  g_main_context_unref (batch.context);
+
+  plan_batch_flush (&batch);
+  g_string_free (batch.output, TRUE);
+
+  if (batch.error != NULL)
+    {
+      g_propagate_error (error, batch.error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Display. */
+
+static void
+plan_print_action (RudgiosyncPlan *plan, RudgiosyncAction *action)
+{
+  /* Directories are touched after every sync, only show the changed ones. */
+  if (action->type == RUDGIOSYNC_ACTION_TOUCH && !action->announce)
+    return;
+
+  g_print ("%-6s ", action_names[action->type]);
+  plan_print_path (plan, action->path, action->entry_type == RUDGIOSYNC_DIR_ENTRY_DIR);
+}
+
+gboolean
+rudgiosync_plan_print_cb (RudgiosyncAction *action, gpointer plan, GError **error)
+{
+  plan_count (plan, action);
+  plan_print_action (plan, action);
+
+  return TRUE;
+}
+
+void
+rudgiosync_plan_print (RudgiosyncPlan *plan)
+{
+  guint iter;
+
+  for (iter = 0; iter < plan->actions->len; iter++)
+    plan_print_action (plan, g_ptr_array_index (plan->actions, iter));
+
+  g_print ("%" G_GUINT64_FORMAT " files (%" G_GUINT64_FORMAT " bytes) to copy, "
+           "%" G_GUINT64_FORMAT " directories to create, "
+           "%" G_GUINT64_FORMAT " entries to delete.\n",
+           plan->copy_count, plan->copy_bytes,
+           plan->mkdir_count,
+           plan->delete_count);
+}
+
+
+/**
+ * Plan files.
+ *
+ * A plan file is a text file, starting with a header naming the roots and
+ * how files were compared, and followed by one action per line, with
+ * tab-separated fields:
+ *
+ *   action  entry-type  announce  size  modified-time  path  source-path
+ *   replaced-size  replaced-modified-time
+ *
+ * The last two describe the destination file a copy replaces, and are `-'
+ * when there's none.
+ *
+ * Paths are escaped C-style, apart from bytes above 0x7f, so that UTF-8
+ * names stay readable.
+ */
+
+struct RudgiosyncPlanWriter_
+{
+  RudgiosyncPlan *plan;
+  FILE           *stream;
+  gchar          *filename;
+};
+
+static const gchar *
+plan_escape_exceptions (void)
+{
+  static gchar exceptions[129];
+  guint iter;
+
+  if (exceptions[0] == '\0')
+    {
+      for (iter = 0; iter < 128; iter++)
+        exceptions[iter] = (gchar)(0x80 + iter);
+    }
+
+  return exceptions;
+}
+
+static void
+plan_write_action (FILE *stream, RudgiosyncAction *action)
+{
+  gchar *path;
+  gchar *src_path;
+
+  path = g_strescape (action->path, plan_escape_exceptions ());
+  src_path = g_strescape (action->src_path != NULL ? action->src_path : "", plan_escape_exceptions ());
+
+  fprintf (stream, "%s\t%c\t%d\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\t%s\t%s",
+           action_names[action->type],
+           entry_type_chars[action->entry_type],
+           action->announce ? 1 : 0,
+           action->size,
+           action->modified_time,
+           path,
+           src_path);
+  if (action->replaces)
+    fprintf (stream, "\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\n",
+             action->replaced_size, action->replaced_modified_time);
+  else
+    fprintf (stream, "\t-\t-\n");
+
+  g_free (path);
+  g_free (src_path);
+}
+
+RudgiosyncPlanWriter *
+rudgiosync_plan_writer_new (RudgiosyncPlan *plan, const gchar *filename, GError **error)
+{
+  RudgiosyncPlanWriter *retval;
+  FILE  *stream;
+  gchar *source;
+  gchar *destination;
+  gchar *display_name;
+  gint   errsv;
+
+  stream = fopen (filename, "w");
+  if (stream == NULL)
+    {
+      errsv = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Failed to create the plan file `%s': %s",
+                   filename, g_strerror (errsv));
+      return NULL;
+    }
+
+  source = g_file_get_uri (plan->source);
+  destination = g_file_get_uri (plan->destination);
+  display_name = g_strescape (plan->display_name, plan_escape_exceptions ());
+  fprintf (stream, "%s\nsource\t%s\ndestination\t%s\ndisplay-name\t%s\ncomparison\t%s\n",
+           PLAN_FILE_MAGIC, source, destination, display_name,
+           comparison_names[plan->comparison]);
+  g_free (source);
+  g_free (destination);
+  g_free (display_name);
+
+  retval = g_slice_new (RudgiosyncPlanWriter);
+  retval->plan = plan;
+  retval->stream = stream;
+  retval->filename = g_strdup (filename);
+
+  return retval;
+}
+
+gboolean
+rudgiosync_plan_writer_add (RudgiosyncAction *action, gpointer writer, GError **error)
+{
+  RudgiosyncPlanWriter *self = writer;
+
+  plan_count (self->plan, action);
+  plan_write_action (self->stream, action);
+
+  return TRUE;
+}
+
+gboolean
+rudgiosync_plan_writer_close (RudgiosyncPlanWriter *writer, GError **error)
+{
+  gboolean failed;
+  gint     errsv = 0;
+
+  failed = ferror (writer->stream) != 0;
+  if (fclose (writer->stream) != 0 && !failed)
+    {
+      errsv = errno;
+      failed = TRUE;
+    }
+
+  if (failed)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv != 0 ? errsv : EIO),
+                   "Failed to write the plan file `%s': %s",
+                   writer->filename, g_strerror (errsv != 0 ? errsv : EIO));
+    }
+
+  g_free (writer->filename);
+  g_slice_free (RudgiosyncPlanWriter, writer);
+
+  return !failed;
+}
+
+gboolean
+rudgiosync_plan_write (RudgiosyncPlan *plan, const gchar *filename, GError **error)
+{
+  RudgiosyncPlanWriter *writer;
+  guint iter;
+
+  writer = rudgiosync_plan_writer_new (plan, filename, error);
+  if (writer == NULL)
+    return FALSE;
+
+  for (iter = 0; iter < plan->actions->len; iter++)
+    plan_write_action (writer->stream, g_ptr_array_index (plan->actions, iter));
+
+  return rudgiosync_plan_writer_close (writer, error);
+}
+
+/* Parse an action line, its fields are modified in place. */
+static gboolean
+plan_parse_action (gchar **fields, RudgiosyncAction *action)
+{
+  const gchar *found;
+  gchar       *end;
+  guint        iter;
+
+  if (g_strv_length (fields) != 9)
+    return FALSE;
+
+  for (iter = 0; iter < G_N_ELEMENTS (action_names); iter++)
+    {
+      if (strcmp (fields[0], action_names[iter]) == 0)
+        break;
+    }
+  if (iter == G_N_ELEMENTS (action_names))
+    return FALSE;
+  action->type = iter;
+
+  found = (fields[1][0] != '\0' && fields[1][1] == '\0')
+          ? memchr (entry_type_chars, fields[1][0], sizeof (entry_type_chars))
+          : NULL;
+  if (found == NULL)
+    return FALSE;
+  action->entry_type = (guint)(found - entry_type_chars);
+
+  if (strcmp (fields[2], "0") != 0 && strcmp (fields[2], "1") != 0)
+    return FALSE;
+  action->announce = fields[2][0] == '1';
+
+  action->size = g_ascii_strtoull (fields[3], &end, 10);
+  if (end == fields[3] || *end != '\0')
+    return FALSE;
+  action->modified_time = g_ascii_strtoull (fields[4], &end, 10);
+  if (end == fields[4] || *end != '\0')
+    return FALSE;
+
+  /* Compressing never makes a string longer, so it's done in place. */
+  end = g_strcompress (fields[5]);
+  strcpy (fields[5], end);
+  g_free (end);
+  end = g_strcompress (fields[6]);
+  strcpy (fields[6], end);
+  g_free (end);
+
+  action->path = fields[5];
+  action->src_path = fields[6];
+  action->source = 0;
+
+  action->replaces = strcmp (fields[7], "-") != 0;
+  action->replaced_size = 0;
+  action->replaced_modified_time = 0;
+  if (action->replaces)
+    {
+      action->replaced_size = g_ascii_strtoull (fields[7], &end, 10);
+      if (end == fields[7] || *end != '\0')
+        return FALSE;
+      action->replaced_modified_time = g_ascii_strtoull (fields[8], &end, 10);
+      if (end == fields[8] || *end != '\0')
+        return FALSE;
+    }
+  else if (strcmp (fields[8], "-") != 0)
+    {
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Return the value of a header line with the given key, or NULL. */
+static gchar *
+plan_parse_header (const gchar *line, const gchar *key)
+{
+  gsize length = strlen (key);
+
+  if (line == NULL || strncmp (line, key, length) != 0 || line[length] != '\t')
+    return NULL;
+
+  return g_strcompress (line + length + 1);
+}
+
+RudgiosyncPlan *
+rudgiosync_plan_read (const gchar *filename, GError **error)
+{
+  RudgiosyncPlan   *retval = NULL;
+  RudgiosyncAction  action;
+
+  gchar  *contents;
+  gchar **lines;
+  gchar **fields;
+  gchar  *source_uri = NULL;
+  gchar  *destination_uri = NULL;
+  gchar  *display_name = NULL;
+  gchar  *comparison = NULL;
+  guint   comparison_type = 0;
+  GFile  *source;
+  GFile  *destination;
+  guint   line = 0;
+  gboolean valid;
+
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", 0);
+  g_free (contents);
+
+  valid = lines[line] != NULL && strcmp (lines[line], PLAN_FILE_MAGIC) == 0;
+  if (valid)
+    valid = (source_uri = plan_parse_header (lines[++line], "source")) != NULL;
+  if (valid)
+    valid = (destination_uri = plan_parse_header (lines[++line], "destination")) != NULL;
+  if (valid)
+    valid = (display_name = plan_parse_header (lines[++line], "display-name")) != NULL;
+  if (valid)
+    valid = (comparison = plan_parse_header (lines[++line], "comparison")) != NULL;
+  if (valid)
+    {
+      for (comparison_type = 0; comparison_type < G_N_ELEMENTS (comparison_names); comparison_type++)
+        {
+          if (strcmp (comparison, comparison_names[comparison_type]) == 0)
+            break;
+        }
+      valid = comparison_type < G_N_ELEMENTS (comparison_names);
+    }
+
+  if (valid)
+    {
+      source = g_file_new_for_uri (source_uri);
+      destination = g_file_new_for_uri (destination_uri);
+      retval = rudgiosync_plan_new (source, destination, display_name);
+      retval->comparison = comparison_type;
+      g_object_unref (source);
+      g_object_unref (destination);
+
+      for (line++; valid && lines[line] != NULL; line++)
+        {
+          if (lines[line][0] == '\0')
+            continue;
+
+          fields = g_strsplit (lines[line], "\t", 0);
+          valid = plan_parse_action (fields, &action);
+          if (valid)
+            rudgiosync_plan_append (&action, retval, NULL);
+          g_strfreev (fields);
+        }
+      /* The loop has moved past the offending line. */
+      line--;
+    }
+
+  if (!valid)
+    {
+      g_set_error (error, RUDGIOSYNC_ERROR,
+                   RUDGIOSYNC_PLAN_FORMAT_ERROR,
+                   "The plan file `%s' is malformed at line %u",
+                   filename, line + 1);
+
+      rudgiosync_plan_free (retval);
+      retval = NULL;
+    }
+
+  g_free (source_uri);
+  g_free (destination_uri);
+  g_free (display_name);
+  g_free (comparison);
+  g_strfreev (lines);
+
+  return retval;
+}
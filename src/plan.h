@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Synchronization plans.
+ *
+ * Comparing the source and destination produces a sequence of actions, which
+ * can be executed right away, written out to be applied by a later run, or
+ * merely displayed.  Paths are relative to the roots the plan was made for.
+ *
+ * Several sources may be merged into the destination, in which case each copy
+ * is from the one it names.
+ */
+
+#ifndef _RUDGIOSYNC_PLAN_H_
+#define _RUDGIOSYNC_PLAN_H_
+
+#include "boiler.h"
+#include "arena.h"
+#include "copier.h"
+
+
+typedef struct RudgiosyncAction_ RudgiosyncAction;
+typedef struct RudgiosyncPlan_ RudgiosyncPlan;
+
+enum
+{
+  RUDGIOSYNC_ACTION_DELETE,   /* Remove an entry, its children come first. */
+  RUDGIOSYNC_ACTION_MKDIR,
+  RUDGIOSYNC_ACTION_COPY,
+  RUDGIOSYNC_ACTION_TOUCH     /* Set a directory's modification time. */
+};
+
+/* How files were compared when a plan was made. */
+enum
+{
+  RUDGIOSYNC_PLAN_COMPARE_TIMES,      /* Size and time of modification. */
+  RUDGIOSYNC_PLAN_COMPARE_SIZES,
+  RUDGIOSYNC_PLAN_COMPARE_CHECKSUMS
+};
+
+struct RudgiosyncAction_
+{
+  guint        type;
+  guint        entry_type;      /* RUDGIOSYNC_DIR_ENTRY_* being acted upon. */
+  gboolean     announce;        /* Whether to list the path when executed. */
+  guint64      size;
+  guint64      modified_time;
+  const gchar *path;            /* Below the destination root. */
+  const gchar *src_path;        /* Below the source root, for copies. */
+  guint        source;          /* Index of that root in the plan's sources. */
+
+  /* For copies, the destination file being replaced, if any, as planned. */
+  gboolean     replaces;
+  guint64      replaced_size;
+  guint64      replaced_modified_time;
+};
+
+/* Receives the actions produced when comparing trees or listings. */
+typedef gboolean (*RudgiosyncActionFunc) (RudgiosyncAction *action,
+                                          gpointer user_data,
+                                          GError **error);
+
+struct RudgiosyncPlan_
+{
+  GFile     *source;            /* The first of the sources. */
+  GPtrArray *sources;
+  GFile     *destination;
+  gchar     *display_name;      /* Of the destination root. */
+  guint      comparison;        /* RUDGIOSYNC_PLAN_COMPARE_*. */
+
+  GPtrArray       *actions;
+  RudgiosyncArena  arena;       /* Holds the actions and their paths. */
+
+  guint64    copy_count;
+  guint64    copy_bytes;
+  guint64    mkdir_count;
+  guint64    delete_count;
+};
+
+typedef struct RudgiosyncPlanWriter_ RudgiosyncPlanWriter;
+
+
+/* Create an empty plan for the given roots. */
+RudgiosyncPlan *rudgiosync_plan_new (GFile *source,
+                                     GFile *destination,
+                                     const gchar *display_name);
+
+void rudgiosync_plan_free (RudgiosyncPlan *plan);
+
+/* Add a source which is merged into the destination after the others. */
+void rudgiosync_plan_add_source (RudgiosyncPlan *plan,
+                                 GFile *source);
+
+/* An action receiver which appends a copy of the action to the plan. */
+gboolean rudgiosync_plan_append (RudgiosyncAction *action,
+                                 gpointer plan,
+                                 GError **error);
+
+/**
+ * Perform a single action.  When validating, the source and destination
+ * are checked to still be in the state the plan expects them to be in.
+ * Actions may be performed from several threads at once, each with its own
+ * copier, if any.
+ */
+gboolean rudgiosync_plan_execute_action (RudgiosyncPlan *plan,
+                                         RudgiosyncAction *action,
+                                         gboolean validate,
+                                         RudgiosyncCopier *copier,
+                                         GError **error);
+
+/**
+ * Perform the copies of the same source file to the destinations of several
+ * plans made for the same source, reading it only once.  The copies aren't
+ * validated, and are checked in the background if they're to be verified.
+ */
+gboolean rudgiosync_plan_execute_fanout (RudgiosyncPlan **plans,
+                                         RudgiosyncAction **actions,
+                                         guint count,
+                                         GError **error);
+
+/**
+ * Perform a set of deletions, directory creations or directory time updates,
+ * none of which may depend on another, with up to the given number of them in
+ * flight at once.
+ */
+gboolean rudgiosync_plan_execute_batch (RudgiosyncPlan *plan,
+                                        GPtrArray *actions,
+                                        gboolean validate,
+                                        guint max_pending,
+                                        GError **error);
+
+/* Let a copier prepare for performing the action next, if it's a copy. */
+void rudgiosync_plan_prefetch (RudgiosyncPlan *plan,
+                               RudgiosyncAction *action,
+                               gboolean validate,
+                               RudgiosyncCopier *copier);
+
+/* An action receiver which performs the action right away. */
+gboolean rudgiosync_plan_execute_cb (RudgiosyncAction *action,
+                                     gpointer plan,
+                                     GError **error);
+
+/* An action receiver which only displays the action. */
+gboolean rudgiosync_plan_print_cb (RudgiosyncAction *action,
+                                   gpointer plan,
+                                   GError **error);
+
+/* Display the actions of a plan, followed by its totals. */
+void rudgiosync_plan_print (RudgiosyncPlan *plan);
+
+
+/* Start writing a plan file for the roots of the given plan. */
+RudgiosyncPlanWriter *rudgiosync_plan_writer_new (RudgiosyncPlan *plan,
+                                                  const gchar *filename,
+                                                  GError **error);
+
+/* An action receiver which writes the action to the plan file. */
+gboolean rudgiosync_plan_writer_add (RudgiosyncAction *action,
+                                     gpointer writer,
+                                     GError **error);
+
+/* Finish the plan file, the writer is freed even on failure. */
+gboolean rudgiosync_plan_writer_close (RudgiosyncPlanWriter *writer,
+                                       GError **error);
+
+/* Write a whole plan to a file. */
+gboolean rudgiosync_plan_write (RudgiosyncPlan *plan,
+                                const gchar *filename,
+                                GError **error);
+
+/* Load a plan written by rudgiosync_plan_write. */
+RudgiosyncPlan *rudgiosync_plan_read (const gchar *filename,
+                                      GError **error);
+
+
+#endif /* _RUDGIOSYNC_PLAN_H_ */
@@ -0,0 +1,332 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "progress.h"
+
+#define PROGRESS_OUTPUT_MAX      (64 * 1024)
+#define PROGRESS_PRINT_INTERVAL  (G_USEC_PER_SEC / 4)
+#define PROGRESS_RECORD_INTERVAL G_USEC_PER_SEC
+
+
+static guint     progress_verbosity = RUDGIOSYNC_VERBOSITY_NORMAL;
+static GMutex    progress_lock;
+static GString  *progress_output;           /* Printed, yet to be written out. */
+static gboolean  progress_terminal = FALSE; /* Whether to show a status line. */
+static gboolean  progress_shown = FALSE;    /* Whether it's on the screen. */
+static gint      progress_fd = -1;
+static gint64    progress_recorded;         /* When the last record was written. */
+
+static gboolean  progress_active = FALSE;
+static gint64    progress_started;
+static gint64    progress_files_total;
+static gint64    progress_bytes_total;
+static guint64   progress_files_done;
+static guint64   progress_bytes_done;
+
+
+/* The rate of copying so far, in bytes per second. */
+static gdouble
+progress_rate (gint64 now)
+{
+  gdouble elapsed = (gdouble)(now - progress_started) / G_USEC_PER_SEC;
+
+  return (elapsed > 0) ? progress_bytes_done / elapsed : 0;
+}
+
+/* The seconds left, or a negative number if that can't be told. */
+static gdouble
+progress_eta (gint64 now)
+{
+  gdouble rate = progress_rate (now);
+
+  if (progress_bytes_total < 0 || rate <= 0)
+    return -1;
+
+  return MAX ((gdouble)progress_bytes_total - progress_bytes_done, 0) / rate;
+}
+
+static void
+progress_clear_status (void)
+{
+  if (!progress_shown)
+    return;
+
+  fputs ("\r\033[K", stdout);
+  progress_shown = FALSE;
+}
+
+static void
+progress_show_status (gint64 now)
+{
+  gchar   *done;
+  gchar   *total;
+  gchar   *rate;
+  gdouble  eta;
+  guint    seconds;
+
+  if (!progress_terminal || !progress_active)
+    return;
+
+  done = g_format_size (progress_bytes_done);
+  rate = g_format_size ((guint64) progress_rate (now));
+  eta = progress_eta (now);
+
+  fputs ("\r", stdout);
+  if (progress_bytes_total >= 0 && progress_files_total >= 0)
+    {
+      total = g_format_size (progress_bytes_total);
+      printf ("%s of %s, %" G_GUINT64_FORMAT " of %" G_GINT64_FORMAT " files, %s/s",
+              done, total, progress_files_done, progress_files_total, rate);
+      g_free (total);
+    }
+  else
+    {
+      printf ("%s, %" G_GUINT64_FORMAT " files, %s/s", done, progress_files_done, rate);
+    }
+  if (eta >= 0)
+    {
+      seconds = (guint) eta;
+      printf (", %u:%02u:%02u left", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    }
+  fputs ("\033[K", stdout);
+  progress_shown = TRUE;
+
+  g_free (done);
+  g_free (rate);
+}
+
+/* Write out what was printed, with the status line, if any, kept below it. */
+static void
+progress_flush (gint64 now)
+{
+  progress_clear_status ();
+  fwrite (progress_output->str, 1, progress_output->len, stdout);
+  g_string_truncate (progress_output, 0);
+  progress_show_status (now);
+  fflush (stdout);
+}
+
+static void
+progress_write_record (gint64 now, gboolean finished)
+{
+  GString *record;
+  gssize   written;
+  gsize    offset;
+  gdouble  eta;
+
+  record = g_string_new (NULL);
+  g_string_append_printf (record, "{\"elapsed\":%.1f,\"files_done\":%" G_GUINT64_FORMAT ",\"files_total\":",
+                          (gdouble)(now - progress_started) / G_USEC_PER_SEC, progress_files_done);
+  if (progress_files_total >= 0)
+    g_string_append_printf (record, "%" G_GINT64_FORMAT, progress_files_total);
+  else
+    g_string_append (record, "null");
+
+  g_string_append_printf (record, ",\"bytes_done\":%" G_GUINT64_FORMAT ",\"bytes_total\":", progress_bytes_done);
+  if (progress_bytes_total >= 0)
+    g_string_append_printf (record, "%" G_GINT64_FORMAT, progress_bytes_total);
+  else
+    g_string_append (record, "null");
+
+  g_string_append_printf (record, ",\"rate\":%.0f,\"eta\":", progress_rate (now));
+  eta = progress_eta (now);
+  if (eta >= 0 && !finished)
+    g_string_append_printf (record, "%.0f", eta);
+  else
+    g_string_append (record, finished ? "0" : "null");
+  g_string_append_printf (record, ",\"finished\":%s}\n", finished ? "true" : "false");
+
+  /* Whoever follows the records may have gone away, which changes nothing. */
+  for (offset = 0; offset < record->len; offset += written)
+    {
+      written = write (progress_fd, record->str + offset, record->len - offset);
+      if (written < 0 && errno != EINTR)
+        break;
+      written = MAX (written, 0);
+    }
+  g_string_free (record, TRUE);
+
+  progress_recorded = now;
+}
+
+static gpointer
+progress_ticker (gpointer data)
+{
+  gint64 now;
+
+  while (TRUE)
+    {
+      g_usleep (PROGRESS_PRINT_INTERVAL);
+
+      g_mutex_lock (&progress_lock);
+      now = g_get_monotonic_time ();
+      if (progress_output->len > 0 || progress_shown || progress_active)
+        progress_flush (now);
+      if (progress_fd >= 0 && progress_active && now - progress_recorded >= PROGRESS_RECORD_INTERVAL)
+        progress_write_record (now, FALSE);
+      g_mutex_unlock (&progress_lock);
+    }
+
+  return NULL;
+}
+
+/* Messages are in UTF-8, the output is in whatever the locale uses, as usual. */
+static gchar *
+progress_to_locale (const gchar *string)
+{
+  const gchar *charset;
+
+  if (g_get_charset (&charset))
+    return g_strdup (string);
+
+  return g_convert_with_fallback (string, -1, charset, "UTF-8", "?", NULL, NULL, NULL);
+}
+
+/**
+ * Whole lines are held back until there's a bunch of them, or until the
+ * ticker comes around, but the start of a line is shown right away, as it
+ * tells what's being waited for.
+ */
+static void
+progress_print (const gchar *string)
+{
+  gchar *converted;
+  gsize  length;
+
+  converted = progress_to_locale (string);
+  if (converted == NULL)
+    return;
+  length = strlen (converted);
+
+  g_mutex_lock (&progress_lock);
+  g_string_append_len (progress_output, converted, length);
+  if (progress_output->len >= PROGRESS_OUTPUT_MAX
+      || (length > 0 && converted[length - 1] != '\n'))
+    progress_flush (g_get_monotonic_time ());
+  g_mutex_unlock (&progress_lock);
+
+  g_free (converted);
+}
+
+/* Errors come after what was printed before them. */
+static void
+progress_printerr (const gchar *string)
+{
+  gchar *converted;
+
+  converted = progress_to_locale (string);
+  if (converted == NULL)
+    return;
+
+  g_mutex_lock (&progress_lock);
+  progress_clear_status ();
+  fwrite (progress_output->str, 1, progress_output->len, stdout);
+  g_string_truncate (progress_output, 0);
+  fflush (stdout);
+
+  fputs (converted, stderr);
+  fflush (stderr);
+  g_mutex_unlock (&progress_lock);
+
+  g_free (converted);
+}
+
+static void
+progress_exit (void)
+{
+  g_mutex_lock (&progress_lock);
+  progress_active = FALSE;
+  progress_flush (g_get_monotonic_time ());
+  g_mutex_unlock (&progress_lock);
+}
+
+void
+rudgiosync_progress_init (guint verbosity, gint fd)
+{
+  progress_verbosity = verbosity;
+  progress_fd = fd;
+  progress_terminal = verbosity >= RUDGIOSYNC_VERBOSITY_NORMAL && isatty (STDOUT_FILENO);
+  progress_output = g_string_sized_new (PROGRESS_OUTPUT_MAX);
+
+  g_set_print_handler (progress_print);
+  g_set_printerr_handler (progress_printerr);
+  atexit (progress_exit);
+
+  g_thread_unref (g_thread_new ("rudgiosync-progress", progress_ticker, NULL));
+}
+
+guint
+rudgiosync_progress_verbosity (void)
+{
+  return progress_verbosity;
+}
+
+void
+rudgiosync_progress_begin (gint64 files, gint64 bytes)
+{
+  g_mutex_lock (&progress_lock);
+  progress_files_total = files;
+  progress_bytes_total = bytes;
+  progress_files_done = 0;
+  progress_bytes_done = 0;
+  progress_started = g_get_monotonic_time ();
+  progress_recorded = progress_started;
+  progress_active = TRUE;
+  g_mutex_unlock (&progress_lock);
+}
+
+void
+rudgiosync_progress_bytes (guint64 bytes)
+{
+  if (!progress_active)
+    return;
+
+  g_mutex_lock (&progress_lock);
+  progress_bytes_done += bytes;
+  g_mutex_unlock (&progress_lock);
+}
+
+void
+rudgiosync_progress_file (guint64 skipped_bytes)
+{
+  if (!progress_active)
+    return;
+
+  g_mutex_lock (&progress_lock);
+  progress_files_done++;
+  progress_bytes_done += skipped_bytes;
+  g_mutex_unlock (&progress_lock);
+}
+
+void
+rudgiosync_progress_end (void)
+{
+  gint64 now;
+
+  g_mutex_lock (&progress_lock);
+  if (progress_active)
+    {
+      now = g_get_monotonic_time ();
+      if (progress_fd >= 0)
+        progress_write_record (now, TRUE);
+
+      /* The status line goes, as nothing is left to be done. */
+      progress_active = FALSE;
+      progress_flush (now);
+    }
+  g_mutex_unlock (&progress_lock);
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Progress reporting.
+ *
+ * Once the work to be done is known, the files and bytes done are tracked,
+ * and shown on a status line with the rate and the time left when the output
+ * is a terminal.  Records of the same, one JSON object per line, may also be
+ * written to a file descriptor for other programs to follow.
+ *
+ * Everything printed through g_print() is buffered and written out a bunch at
+ * a time, as printing each name on its own is slow with millions of them.
+ */
+
+#ifndef _RUDGIOSYNC_PROGRESS_H_
+#define _RUDGIOSYNC_PROGRESS_H_
+
+#include "boiler.h"
+
+
+enum
+{
+  RUDGIOSYNC_VERBOSITY_QUIET,   /* Only errors and summaries. */
+  RUDGIOSYNC_VERBOSITY_NORMAL,  /* Also every change made. */
+  RUDGIOSYNC_VERBOSITY_VERBOSE  /* Also the files left alone. */
+};
+
+
+/**
+ * Take over the printing of messages, which lasts until the program exits.
+ * Progress records are written to the given file descriptor, unless it's
+ * negative.
+ */
+void rudgiosync_progress_init (guint verbosity,
+                               gint fd);
+
+guint rudgiosync_progress_verbosity (void);
+
+/**
+ * Start tracking the work, with the number of files and bytes to be copied,
+ * either of which is negative if it isn't known in advance.
+ */
+void rudgiosync_progress_begin (gint64 files,
+                                gint64 bytes);
+
+/* Note data having been copied. */
+void rudgiosync_progress_bytes (guint64 bytes);
+
+/**
+ * Note a file being done with, the bytes of which are counted as done as well
+ * if it was skipped rather than copied.
+ */
+void rudgiosync_progress_file (guint64 skipped_bytes);
+
+/* Stop tracking, with a final record written out. */
+void rudgiosync_progress_end (void);
+
+
+#endif /* _RUDGIOSYNC_PROGRESS_H_ */
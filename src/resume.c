@@ -0,0 +1,392 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "resume.h"
+#include "operations.h"
+#include "buffers.h"
+#include "stats.h"
+#include "trace.h"
+#include "progress.h"
+
+#include <string.h>
+
+#define RESUME_MIN_SIZE   ((guint64)(64 * 1024 * 1024)) /* 64 MiB */
+#define RESUME_CHECK_SIZE ((gsize)(1024 * 1024))        /* 1 MiB, twice fits a buffer. */
+
+#define RESUME_PARTIAL_SUFFIX ".rudgiosync-partial"
+#define RESUME_INFO_SUFFIX    ".rudgiosync-partial.info"
+#define RESUME_INFO_GROUP     "Source"
+
+static gboolean resume_enabled = TRUE;
+
+
+void
+rudgiosync_resume_set_enabled (gboolean enabled)
+{
+  resume_enabled = enabled;
+}
+
+gboolean
+rudgiosync_resume_wanted (guint64 size)
+{
+  return resume_enabled && size >= RESUME_MIN_SIZE;
+}
+
+gboolean
+rudgiosync_resume_is_leftover (const gchar *name)
+{
+  return name[0] == '.'
+         && (g_str_has_suffix (name, RESUME_PARTIAL_SUFFIX)
+             || g_str_has_suffix (name, RESUME_INFO_SUFFIX));
+}
+
+gchar *
+rudgiosync_resume_leftover_target (const gchar *name)
+{
+  gsize length = strlen (name);
+
+  if (!rudgiosync_resume_is_leftover (name))
+    return NULL;
+
+  if (g_str_has_suffix (name, RESUME_INFO_SUFFIX))
+    length -= strlen (RESUME_INFO_SUFFIX);
+  else
+    length -= strlen (RESUME_PARTIAL_SUFFIX);
+
+  return g_strndup (name + 1, (length > 0) ? length - 1 : 0);
+}
+
+/* The hidden file next to a destination, with the given suffix. */
+static GFile *
+resume_sibling (GFile *destination, const gchar *suffix)
+{
+  GFile *parent;
+  GFile *retval;
+  gchar *basename;
+  gchar *name;
+
+  parent = g_file_get_parent (destination);
+  basename = g_file_get_basename (destination);
+  name = g_strconcat (".", basename, suffix, NULL);
+
+  retval = g_file_get_child (parent, name);
+
+  g_free (name);
+  g_free (basename);
+  g_object_unref (parent);
+
+  return retval;
+}
+
+/* Move a freshly opened stream to the given offset, seeking if it can. */
+static gboolean
+resume_seek (GInputStream *input, guint64 offset, GError **error)
+{
+  gssize skipped;
+
+  if (G_IS_SEEKABLE (input) && g_seekable_can_seek (G_SEEKABLE (input)))
+    return g_seekable_seek (G_SEEKABLE (input), (goffset)offset, G_SEEK_SET, NULL, error);
+
+  while (offset > 0)
+    {
+      skipped = g_input_stream_skip (input, (gsize)MIN (offset, G_MAXSSIZE), NULL, error);
+      if (skipped <= 0)
+        return FALSE;
+
+      offset -= (guint64)skipped;
+    }
+
+  return TRUE;
+}
+
+/* Read a stretch of a freshly opened stream, failing if it's cut short. */
+static gboolean
+resume_read_at (GInputStream *input, guint64 offset, gchar *buffer, gsize size)
+{
+  RudgiosyncTraceSpan span;
+  gsize               read_count = 0;
+
+  if (!resume_seek (input, offset, NULL))
+    return FALSE;
+
+  rudgiosync_trace_begin (&span);
+  g_input_stream_read_all (input, buffer, size, &read_count, NULL, NULL);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_READ, NULL, read_count);
+
+  return read_count == size;
+}
+
+/* Whether a sidecar describes the given source. */
+static gboolean
+resume_info_matches (GFile *info_file, guint64 size, guint64 modified_time)
+{
+  GKeyFile *key_file;
+  gchar    *contents;
+  gsize     length;
+  gboolean  retval = FALSE;
+
+  if (!g_file_load_contents (info_file, NULL, &contents, &length, NULL, NULL))
+    return FALSE;
+
+  key_file = g_key_file_new ();
+  if (g_key_file_load_from_data (key_file, contents, length, G_KEY_FILE_NONE, NULL))
+    {
+      retval = g_key_file_get_uint64 (key_file, RESUME_INFO_GROUP, "Size", NULL) == size
+               && g_key_file_get_uint64 (key_file, RESUME_INFO_GROUP, "Modified", NULL) == modified_time;
+    }
+  g_key_file_free (key_file);
+  g_free (contents);
+
+  return retval;
+}
+
+static gboolean
+resume_info_write (GFile *info_file, guint64 size, guint64 modified_time, GError **error)
+{
+  GKeyFile *key_file;
+  gchar    *contents;
+  gsize     length;
+  gboolean  retval;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_uint64 (key_file, RESUME_INFO_GROUP, "Size", size);
+  g_key_file_set_uint64 (key_file, RESUME_INFO_GROUP, "Modified", modified_time);
+  contents = g_key_file_to_data (key_file, &length, NULL);
+  g_key_file_free (key_file);
+
+  retval = g_file_replace_contents (info_file, contents, length,
+                                    NULL, FALSE, G_FILE_CREATE_NONE,
+                                    NULL, NULL, error);
+  g_free (contents);
+
+  return retval;
+}
+
+/**
+ * Find out how much of an interrupted copy can be kept: all of its partial
+ * file, if the sidecar matches the source and the last stretch of the file
+ * matches the source's data at the same spot, which leaves the input right
+ * past it.  Anything else means starting over.  Whether the input was read
+ * from is stored in `moved'.
+ */
+static guint64
+resume_check (GFile *partial,
+              GFile *info_file,
+              GInputStream *input,
+              guint64 size,
+              guint64 modified_time,
+              gboolean *moved)
+{
+  GFileInfo           *info;
+  GFileInputStream    *stream;
+  RudgiosyncTraceSpan  span;
+  gchar               *buffer;
+  guint64              length;
+  gsize                window;
+  gboolean             matches;
+
+  *moved = FALSE;
+  if (!resume_info_matches (info_file, size, modified_time))
+    return 0;
+
+  rudgiosync_trace_begin (&span);
+  info = g_file_query_info (partial,
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            NULL,
+                            NULL);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, partial, -1);
+  if (info == NULL)
+    return 0;
+
+  length = (guint64)g_file_info_get_size (info);
+  g_object_unref (info);
+  if (length == 0 || length > size)
+    return 0;
+
+  rudgiosync_trace_begin (&span);
+  stream = g_file_read (partial, NULL, NULL);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, partial, -1);
+  if (stream == NULL)
+    return 0;
+
+  window = (gsize)MIN (length, RESUME_CHECK_SIZE);
+  buffer = rudgiosync_buffer_acquire ();
+  matches = resume_read_at (G_INPUT_STREAM (stream), length - window, buffer, window);
+  if (matches)
+    {
+      *moved = TRUE;
+      matches = resume_read_at (input, length - window, buffer + RESUME_CHECK_SIZE, window)
+                && memcmp (buffer, buffer + RESUME_CHECK_SIZE, window) == 0;
+    }
+  rudgiosync_buffer_release (buffer);
+  g_object_unref (stream);
+
+  return matches ? length : 0;
+}
+
+GFileOutputStream *
+rudgiosync_resume_open (GFile *destination,
+                        GFile *source,
+                        GFileInputStream **input,
+                        guint64 size,
+                        guint64 modified_time,
+                        guint64 *offset,
+                        GError **error)
+{
+  GFile               *partial;
+  GFile               *info_file;
+  GFileOutputStream   *retval = NULL;
+  RudgiosyncTraceSpan  span;
+  gboolean             moved;
+  gboolean             rewound = FALSE;
+
+  partial = resume_sibling (destination, RESUME_PARTIAL_SUFFIX);
+  info_file = resume_sibling (destination, RESUME_INFO_SUFFIX);
+
+  *offset = resume_check (partial, info_file, G_INPUT_STREAM (*input), size, modified_time, &moved);
+  if (*offset > 0)
+    {
+      rudgiosync_trace_begin (&span);
+      retval = g_file_append_to (partial, G_FILE_CREATE_NONE, NULL, error);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, partial, -1);
+      goto out;
+    }
+
+  if (moved)
+    {
+      if (G_IS_SEEKABLE (*input) && g_seekable_can_seek (G_SEEKABLE (*input)))
+        rewound = g_seekable_seek (G_SEEKABLE (*input), 0, G_SEEK_SET, NULL, NULL);
+
+      if (!rewound)
+        {
+          g_object_unref (*input);
+
+          rudgiosync_trace_begin (&span);
+          *input = g_file_read (source, NULL, error);
+          rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, source, -1);
+          if (*input == NULL)
+            goto out;
+        }
+    }
+
+  /* The partial file is only ever written under a sidecar describing its
+     source, so whatever's left of it can be trusted to come from there. */
+  rudgiosync_trace_begin (&span);
+  g_file_delete (partial, NULL, NULL);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_DELETE, partial, -1);
+
+  if (!resume_info_write (info_file, size, modified_time, error))
+    goto out;
+
+  rudgiosync_trace_begin (&span);
+  retval = g_file_create (partial, G_FILE_CREATE_NONE, NULL, error);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, partial, -1);
+
+out:
+  g_object_unref (partial);
+  g_object_unref (info_file);
+
+  return retval;
+}
+
+/* Hash the start of the source, up to where an interrupted copy stopped. */
+static gboolean
+resume_hash_kept (GFile *source, guint64 offset, RudgiosyncHashContext *hash, gchar *buffer, GError **error)
+{
+  GFileInputStream    *stream;
+  RudgiosyncTraceSpan  span;
+  gssize               read_count = 0;
+
+  rudgiosync_trace_begin (&span);
+  stream = g_file_read (source, NULL, error);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_OPEN, source, -1);
+  if (stream == NULL)
+    return FALSE;
+
+  for (; offset > 0; offset -= (guint64)read_count)
+    {
+      rudgiosync_trace_begin (&span);
+      read_count = g_input_stream_read (G_INPUT_STREAM (stream), buffer,
+                                        (gsize)MIN (offset, RUDGIOSYNC_TRANSFER_BUF_SIZE),
+                                        NULL, error);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_READ, NULL, MAX (read_count, 0));
+      if (read_count <= 0)
+        break;
+
+      rudgiosync_hash_data (hash, (gsize)read_count, buffer);
+    }
+  g_object_unref (stream);
+
+  if (read_count == 0 && offset > 0)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "The source was cut short while being copied");
+
+  return offset == 0;
+}
+
+gboolean
+rudgiosync_resume_transfer (GFile *source,
+                            GFileInputStream *input,
+                            GFileOutputStream *output,
+                            guint64 size,
+                            guint64 offset,
+                            RudgiosyncHashContext *hash,
+                            GError **error)
+{
+  gchar    *buffer;
+  gboolean  retval;
+
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_RESUMED, 1);
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_RESUMED, offset);
+  rudgiosync_progress_bytes (offset);
+
+  if (!rudgiosync_preallocate (G_OUTPUT_STREAM (output), size, error))
+    return FALSE;
+
+  buffer = rudgiosync_buffer_acquire ();
+  retval = (hash == NULL || resume_hash_kept (source, offset, hash, buffer, error))
+           && rudgiosync_copy_stream (G_INPUT_STREAM (input), G_OUTPUT_STREAM (output),
+                                      FALSE,
+                                      buffer, RUDGIOSYNC_TRANSFER_BUF_SIZE,
+                                      hash, error);
+  rudgiosync_buffer_release (buffer);
+
+  return retval;
+}
+
+gboolean
+rudgiosync_resume_complete (GFile *destination, GError **error)
+{
+  GFile    *partial;
+  GFile    *info_file;
+  gboolean  retval;
+
+  partial = resume_sibling (destination, RESUME_PARTIAL_SUFFIX);
+  info_file = resume_sibling (destination, RESUME_INFO_SUFFIX);
+
+  /* A rename within the directory, where the backend allows for one. */
+  retval = g_file_move (partial, destination,
+                        G_FILE_COPY_OVERWRITE | G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                        NULL, NULL, NULL, error);
+  if (retval)
+    g_file_delete (info_file, NULL, NULL);
+
+  g_object_unref (partial);
+  g_object_unref (info_file);
+
+  return retval;
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Resumable copies of large files.
+ *
+ * Large files are written to a hidden partial file next to their destination,
+ * with a sidecar recording the size and modification time of the source they
+ * come from, and only renamed into place once complete.  When a copy gets
+ * interrupted, the next one to the same destination picks up where it left
+ * off, provided the source is still the same and the tail of what was
+ * written matches it.  Smaller files are simply copied again.
+ */
+
+#ifndef _RUDGIOSYNC_RESUME_H_
+#define _RUDGIOSYNC_RESUME_H_
+
+#include "boiler.h"
+#include "checksum.h"
+
+
+/* Write large files in place instead, as everything else is. */
+void rudgiosync_resume_set_enabled (gboolean enabled);
+
+/* Whether a file of the given size is to be copied by way of a partial file. */
+gboolean rudgiosync_resume_wanted (guint64 size);
+
+/* Whether a destination entry is the partial file, or the sidecar, of an
+   interrupted copy.  These are kept while the copy is still to be resumed. */
+gboolean rudgiosync_resume_is_leftover (const gchar *name);
+
+/* The name of the file whose interrupted copy left the given entry behind,
+   or NULL if it isn't a leftover. */
+gchar *rudgiosync_resume_leftover_target (const gchar *name);
+
+/**
+ * Open the partial file of a destination for writing.  If an earlier copy of
+ * the same source was interrupted there, the source input is moved past what
+ * it left behind, which is appended to, and `offset' is set to its size.
+ * Otherwise the copy starts anew, and the input may be replaced by a freshly
+ * opened one if it couldn't be rewound.
+ */
+GFileOutputStream *rudgiosync_resume_open (GFile *destination,
+                                           GFile *source,
+                                           GFileInputStream **input,
+                                           guint64 size,
+                                           guint64 modified_time,
+                                           guint64 *offset,
+                                           GError **error);
+
+/**
+ * Copy the rest of an interrupted copy, the input being past what's kept.  As
+ * the partial file is appended to, runs of zeroes are written out.  If a
+ * hashing state is given, what's kept is hashed by reading it from the source
+ * again, followed by the rest.
+ */
+gboolean rudgiosync_resume_transfer (GFile *source,
+                                     GFileInputStream *input,
+                                     GFileOutputStream *output,
+                                     guint64 size,
+                                     guint64 offset,
+                                     RudgiosyncHashContext *hash,
+                                     GError **error);
+
+/* Move a completed partial file over its destination, and drop its sidecar. */
+gboolean rudgiosync_resume_complete (GFile *destination,
+                                     GError **error);
+
+
+#endif /* _RUDGIOSYNC_RESUME_H_ */
@@ -0,0 +1,846 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "schedule.h"
+#include "descriptions.h"
+#include "throttle.h"
+#include "stats.h"
+#include "progress.h"
+#include "verify.h"
+
+#include <string.h>
+
+#define SCHEDULE_LARGE_CEILING   4    /* Threads per lane, with automatic jobs. */
+#define SCHEDULE_SMALL_CEILING   16
+#define SCHEDULE_LARGE_THRESHOLD ((guint64)(8 * 1024 * 1024)) /* 8 MiB */
+#define SCHEDULE_DIRECTORY_PENDING 16 /* Directory actions in flight at once. */
+#define SCHEDULE_DELETE_PENDING    16 /* Deletions in flight at once. */
+
+enum
+{
+  LANE_SMALL,
+  LANE_LARGE,
+  LANE_COUNT
+};
+
+typedef struct
+{
+  GPtrArray *actions;
+  guint      next;
+} ScheduleQueue;
+
+/* The destinations a source file is copied to, with several plans. */
+typedef struct
+{
+  RudgiosyncPlan   **plans;
+  RudgiosyncAction **actions;
+  guint              count;
+} ScheduleTargets;
+
+typedef struct
+{
+  RudgiosyncPlan **plans;
+  gboolean         validate;
+  GHashTable      *targets;      /* By the queued copy, unless a single plan. */
+
+  GMutex          lock;          /* Guards the queues and the error. */
+  ScheduleQueue   queues[LANE_COUNT];
+  GError         *error;         /* The first failure, stops all lanes. */
+} ScheduleState;
+
+typedef struct
+{
+  ScheduleState      *state;
+  guint               lane;
+  RudgiosyncThrottle *throttle;   /* NULL with a fixed number of jobs. */
+} ScheduleWorker;
+
+typedef struct
+{
+  RudgiosyncPlan *plan;
+  GPtrArray      *deletions;
+  gboolean        validate;
+  GError         *error;
+} ScheduleDeleter;
+
+/* What's done at a destination apart from the copies. */
+typedef struct
+{
+  RudgiosyncPlan  *plan;
+  GPtrArray       *urgent;         /* Deletions which come first regardless. */
+  GPtrArray       *directories;
+  GPtrArray       *touches;
+  ScheduleDeleter  deleter;        /* The rest of the deletions. */
+  GThread         *deleter_thread;
+} ScheduleDestination;
+
+
+static const gchar *order_names[] =
+{
+  "default",          /* RUDGIOSYNC_ORDER_DEFAULT */
+  "newest-first",     /* RUDGIOSYNC_ORDER_NEWEST_FIRST */
+  "oldest-first",     /* RUDGIOSYNC_ORDER_OLDEST_FIRST */
+  "largest-first",    /* RUDGIOSYNC_ORDER_LARGEST_FIRST */
+  "smallest-first"    /* RUDGIOSYNC_ORDER_SMALLEST_FIRST */
+};
+
+
+void
+rudgiosync_schedule_init (RudgiosyncSchedule *schedule)
+{
+  schedule->large_jobs      = RUDGIOSYNC_JOBS_AUTO;
+  schedule->small_jobs      = RUDGIOSYNC_JOBS_AUTO;
+  schedule->large_threshold = SCHEDULE_LARGE_THRESHOLD;
+  schedule->order           = RUDGIOSYNC_ORDER_DEFAULT;
+  schedule->delete_timing   = RUDGIOSYNC_DELETE_BEFORE;
+  schedule->check_space     = TRUE;
+}
+
+gboolean
+rudgiosync_schedule_parse_jobs (const gchar *value, guint *jobs)
+{
+  gchar   *end;
+  guint64  parsed;
+
+  if (strcmp (value, "auto") == 0)
+    {
+      *jobs = RUDGIOSYNC_JOBS_AUTO;
+      return TRUE;
+    }
+
+  parsed = g_ascii_strtoull (value, &end, 10);
+  if (end == value || *end != '\0' || parsed == 0 || parsed > G_MAXINT)
+    return FALSE;
+
+  *jobs = (guint)parsed;
+  return TRUE;
+}
+
+gboolean
+rudgiosync_schedule_parse_order (const gchar *name, guint *order)
+{
+  guint iter;
+
+  for (iter = 0; iter < G_N_ELEMENTS (order_names); iter++)
+    {
+      if (strcmp (name, order_names[iter]) == 0)
+        {
+          *order = iter;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Comparison functions for g_ptr_array_sort, which is stable. */
+static gint
+compare_newest_first (gconstpointer action_a, gconstpointer action_b)
+{
+  const RudgiosyncAction *a = *(RudgiosyncAction * const *)action_a;
+  const RudgiosyncAction *b = *(RudgiosyncAction * const *)action_b;
+
+  return (a->modified_time < b->modified_time) - (a->modified_time > b->modified_time);
+}
+
+static gint
+compare_oldest_first (gconstpointer action_a, gconstpointer action_b)
+{
+  return compare_newest_first (action_b, action_a);
+}
+
+static gint
+compare_largest_first (gconstpointer action_a, gconstpointer action_b)
+{
+  const RudgiosyncAction *a = *(RudgiosyncAction * const *)action_a;
+  const RudgiosyncAction *b = *(RudgiosyncAction * const *)action_b;
+
+  return (a->size < b->size) - (a->size > b->size);
+}
+
+static gint
+compare_smallest_first (gconstpointer action_a, gconstpointer action_b)
+{
+  return compare_largest_first (action_b, action_a);
+}
+
+static void
+schedule_sort (GPtrArray *actions, guint order, guint lane)
+{
+  switch (order)
+    {
+      case RUDGIOSYNC_ORDER_NEWEST_FIRST:
+        g_ptr_array_sort (actions, compare_newest_first);
+        break;
+
+      case RUDGIOSYNC_ORDER_OLDEST_FIRST:
+        g_ptr_array_sort (actions, compare_oldest_first);
+        break;
+
+      case RUDGIOSYNC_ORDER_LARGEST_FIRST:
+        g_ptr_array_sort (actions, compare_largest_first);
+        break;
+
+      case RUDGIOSYNC_ORDER_SMALLEST_FIRST:
+        g_ptr_array_sort (actions, compare_smallest_first);
+        break;
+
+      default:
+        /* Starting with the largest file keeps it from finishing last. */
+        if (lane == LANE_LARGE)
+          g_ptr_array_sort (actions, compare_largest_first);
+        break;
+    }
+}
+
+/**
+ * Take the next copy for a lane.  The large file lane helps out with the
+ * small files once it runs out, the other way around would exceed the limit
+ * on concurrent large transfers.
+ */
+static RudgiosyncAction *
+schedule_next (ScheduleState *state, guint lane)
+{
+  RudgiosyncAction *retval = NULL;
+  ScheduleQueue    *queue;
+
+  g_mutex_lock (&(state->lock));
+  while (state->error == NULL && retval == NULL)
+    {
+      queue = &(state->queues[lane]);
+      if (queue->next < queue->actions->len)
+        retval = g_ptr_array_index (queue->actions, queue->next++);
+      else if (lane == LANE_LARGE)
+        lane = LANE_SMALL;
+      else
+        break;
+    }
+  g_mutex_unlock (&(state->lock));
+
+  return retval;
+}
+
+static gboolean
+schedule_failed (ScheduleState *state)
+{
+  gboolean retval;
+
+  g_mutex_lock (&(state->lock));
+  retval = (state->error != NULL);
+  g_mutex_unlock (&(state->lock));
+
+  return retval;
+}
+
+/* Record a failure, which stops all lanes. */
+static void
+schedule_fail (ScheduleState *state, GError *ierror)
+{
+  g_mutex_lock (&(state->lock));
+  if (state->error == NULL)
+    g_propagate_error (&(state->error), ierror);
+  else
+    g_error_free (ierror);
+  g_mutex_unlock (&(state->lock));
+}
+
+static void
+schedule_targets_free (ScheduleTargets *targets)
+{
+  g_free (targets->plans);
+  g_free (targets->actions);
+  g_slice_free (ScheduleTargets, targets);
+}
+
+/* The plan of a queued copy, or NULL if it's to several destinations. */
+static RudgiosyncPlan *
+schedule_plan (ScheduleState *state, RudgiosyncAction *action)
+{
+  ScheduleTargets *targets;
+
+  if (state->targets == NULL)
+    return state->plans[0];
+
+  targets = g_hash_table_lookup (state->targets, action);
+  return (targets->count == 1) ? targets->plans[0] : NULL;
+}
+
+static gboolean
+schedule_run (ScheduleState *state, RudgiosyncAction *action, RudgiosyncCopier *copier, GError **error)
+{
+  RudgiosyncPlan  *plan;
+  ScheduleTargets *targets;
+
+  plan = schedule_plan (state, action);
+  if (plan != NULL)
+    return rudgiosync_plan_execute_action (plan, action, state->validate, copier, error);
+
+  targets = g_hash_table_lookup (state->targets, action);
+  return rudgiosync_plan_execute_fanout (targets->plans, targets->actions, targets->count, error);
+}
+
+static gpointer
+schedule_worker (gpointer data)
+{
+  ScheduleWorker   *worker = data;
+  ScheduleState    *state = worker->state;
+  RudgiosyncCopier *copier;
+  RudgiosyncPlan   *plan;
+  RudgiosyncAction *action;
+  RudgiosyncAction *next_action = NULL;
+  gint64            started;
+
+  GError *ierror = NULL;
+
+
+  copier = rudgiosync_copier_new ();
+  while (TRUE)
+    {
+      if (worker->throttle != NULL)
+        rudgiosync_throttle_acquire (worker->throttle);
+
+      if (next_action != NULL && !schedule_failed (state))
+        action = next_action;
+      else
+        action = schedule_next (state, worker->lane);
+      if (action == NULL)
+        {
+          if (worker->throttle != NULL)
+            rudgiosync_throttle_release (worker->throttle, 0, 0);
+          break;
+        }
+
+      /* The next file is opened while this one is being transferred, unless
+         it's read for several destinations at once, without the copier. */
+      next_action = schedule_next (state, worker->lane);
+      if (next_action != NULL && (plan = schedule_plan (state, next_action)) != NULL)
+        rudgiosync_plan_prefetch (plan, next_action, state->validate, copier);
+
+      started = g_get_monotonic_time ();
+      if (!schedule_run (state, action, copier, &ierror))
+        schedule_fail (state, ierror);
+
+      /* Small files are about the count, large ones about the bytes. */
+      if (worker->throttle != NULL)
+        rudgiosync_throttle_release (worker->throttle,
+                                     (worker->lane == LANE_LARGE) ? action->size : 1,
+                                     started);
+    }
+
+  if (!rudgiosync_copier_free (copier, &ierror))
+    schedule_fail (state, ierror);
+
+  return NULL;
+}
+
+static gboolean
+schedule_copy (RudgiosyncSchedule *schedule, ScheduleState *state, GError **error)
+{
+  ScheduleWorker     *workers;
+  GThread           **threads;
+  RudgiosyncThrottle *throttles[LANE_COUNT] = { NULL, NULL };
+  guint               jobs[LANE_COUNT];
+  guint               thread_count;
+  guint               lane;
+  guint               iter;
+  gchar              *src_backend;
+  gchar              *dest_backend;
+  gchar              *backend;
+
+
+  jobs[LANE_SMALL] = schedule->small_jobs;
+  jobs[LANE_LARGE] = schedule->large_jobs;
+  if (jobs[LANE_SMALL] == RUDGIOSYNC_JOBS_AUTO || jobs[LANE_LARGE] == RUDGIOSYNC_JOBS_AUTO)
+    {
+      src_backend = rudgiosync_backend_name (state->plans[0]->source);
+      dest_backend = rudgiosync_backend_name (state->plans[0]->destination);
+      backend = g_strdup_printf ("%s -> %s", src_backend, dest_backend);
+
+      if (jobs[LANE_SMALL] == RUDGIOSYNC_JOBS_AUTO && state->queues[LANE_SMALL].actions->len > 0)
+        {
+          throttles[LANE_SMALL] = rudgiosync_throttle_get (backend, "small file copies", SCHEDULE_SMALL_CEILING);
+          jobs[LANE_SMALL] = SCHEDULE_SMALL_CEILING;
+        }
+      if (jobs[LANE_LARGE] == RUDGIOSYNC_JOBS_AUTO && state->queues[LANE_LARGE].actions->len > 0)
+        {
+          throttles[LANE_LARGE] = rudgiosync_throttle_get (backend, "large file copies", SCHEDULE_LARGE_CEILING);
+          jobs[LANE_LARGE] = SCHEDULE_LARGE_CEILING;
+        }
+
+      g_free (src_backend);
+      g_free (dest_backend);
+      g_free (backend);
+    }
+
+  jobs[LANE_SMALL] = MIN (jobs[LANE_SMALL], state->queues[LANE_SMALL].actions->len);
+  jobs[LANE_LARGE] = MIN (jobs[LANE_LARGE], state->queues[LANE_LARGE].actions->len);
+  thread_count = jobs[LANE_SMALL] + jobs[LANE_LARGE];
+  if (thread_count == 0)
+    return TRUE;
+
+  workers = g_new (ScheduleWorker, thread_count);
+  threads = g_new (GThread *, thread_count);
+
+  for (lane = 0, iter = 0; lane < LANE_COUNT; lane++)
+    {
+      for (; jobs[lane] > 0; jobs[lane]--, iter++)
+        {
+          workers[iter].state = state;
+          workers[iter].lane = lane;
+          workers[iter].throttle = throttles[lane];
+          threads[iter] = g_thread_new ((lane == LANE_LARGE) ? "rudgiosync-large" : "rudgiosync-small",
+                                        schedule_worker, &(workers[iter]));
+        }
+    }
+  for (iter = 0; iter < thread_count; iter++)
+    g_thread_join (threads[iter]);
+
+  g_free (threads);
+  g_free (workers);
+
+  if (state->error != NULL)
+    {
+      g_propagate_error (error, state->error);
+      state->error = NULL;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* The number of levels between a path and the root, which is level 0. */
+static guint
+schedule_depth (const gchar *path)
+{
+  guint depth = (path[0] != '\0') ? 1 : 0;
+
+  for (; *path != '\0'; path++)
+    {
+      if (*path == '/')
+        depth++;
+    }
+
+  return depth;
+}
+
+/**
+ * Create the missing directories, level by level, with all of the ones in a
+ * level created at once.  A directory precedes its contents in the plan, so
+ * its level is always done by the time its children's starts.
+ */
+static gboolean
+schedule_directories (RudgiosyncPlan *plan, GPtrArray *directories, gboolean validate, GError **error)
+{
+  RudgiosyncAction     *action;
+  RudgiosyncStatsTimer  timer;
+  GPtrArray            *levels;
+  GPtrArray            *level;
+  gboolean              success = TRUE;
+  guint             depth;
+  guint             iter;
+
+
+  levels = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+  for (iter = 0; iter < directories->len; iter++)
+    {
+      action = g_ptr_array_index (directories, iter);
+      depth = schedule_depth (action->path);
+      while (levels->len <= depth)
+        g_ptr_array_add (levels, g_ptr_array_new ());
+
+      g_ptr_array_add (g_ptr_array_index (levels, depth), action);
+    }
+
+  rudgiosync_stats_start (&timer);
+  for (depth = 0; depth < levels->len && success; depth++)
+    {
+      level = g_ptr_array_index (levels, depth);
+      success = rudgiosync_plan_execute_batch (plan, level, validate, SCHEDULE_DIRECTORY_PENDING, error);
+    }
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_MKDIR);
+
+  g_ptr_array_free (levels, TRUE);
+
+  return success;
+}
+
+/**
+ * Delete entries, all of which are either files or directories whose contents
+ * are being deleted as well.  Everything but the directories goes first, then
+ * the directories are removed from the deepest level up, so each is empty by
+ * the time it's removed.
+ */
+static gboolean
+schedule_delete (RudgiosyncPlan *plan, GPtrArray *deletions, gboolean validate, GError **error)
+{
+  RudgiosyncAction     *action;
+  RudgiosyncStatsTimer  timer;
+  GPtrArray            *levels;
+  gboolean              success;
+  guint                 depth;
+  guint                 iter;
+
+
+  /* Level 0 holds the leaves, the directories follow, a level deeper. */
+  levels = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+  for (iter = 0; iter < deletions->len; iter++)
+    {
+      action = g_ptr_array_index (deletions, iter);
+      depth = (action->entry_type == RUDGIOSYNC_DIR_ENTRY_DIR) ? schedule_depth (action->path) + 1 : 0;
+      while (levels->len <= depth)
+        g_ptr_array_add (levels, g_ptr_array_new ());
+
+      g_ptr_array_add (g_ptr_array_index (levels, depth), action);
+    }
+
+  rudgiosync_stats_start (&timer);
+  success = (levels->len == 0)
+            || rudgiosync_plan_execute_batch (plan, g_ptr_array_index (levels, 0), validate,
+                                              SCHEDULE_DELETE_PENDING, error);
+  for (depth = levels->len; depth > 1 && success; depth--)
+    success = rudgiosync_plan_execute_batch (plan, g_ptr_array_index (levels, depth - 1), validate,
+                                             SCHEDULE_DELETE_PENDING, error);
+  rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_DELETE);
+
+  g_ptr_array_free (levels, TRUE);
+
+  return success;
+}
+
+static gpointer
+schedule_deleter (gpointer data)
+{
+  ScheduleDeleter *deleter = data;
+
+  schedule_delete (deleter->plan, deleter->deletions, deleter->validate, &(deleter->error));
+
+  return NULL;
+}
+
+/* Whether a deletion makes way for an entry which is created in its place. */
+static gboolean
+schedule_in_the_way (GHashTable *created, const gchar *path)
+{
+  gchar    *parent;
+  gchar    *separator;
+  gboolean  retval;
+
+  if (g_hash_table_contains (created, path))
+    return TRUE;
+
+  /* The entries within a directory which is replaced by a file. */
+  parent = g_strdup (path);
+  retval = FALSE;
+  while (!retval && (separator = strrchr (parent, '/')) != NULL)
+    {
+      *separator = '\0';
+      retval = g_hash_table_contains (created, parent);
+    }
+  g_free (parent);
+
+  return retval;
+}
+
+/**
+ * Make sure the copies fit at the destination, counting on the space freed
+ * by the deletions which come first.  Files being replaced are counted in
+ * full, as their new contents are written beside the old.
+ */
+static gboolean
+schedule_check_space (RudgiosyncPlan *plan, GPtrArray *urgent, GError **error)
+{
+  RudgiosyncAction *action;
+  GFileInfo        *info;
+  guint64           needed = plan->copy_bytes;
+  guint64           freed = 0;
+  guint64           available;
+  gchar            *needed_text;
+  gchar            *available_text;
+  guint             iter;
+
+  for (iter = 0; iter < urgent->len; iter++)
+    {
+      action = g_ptr_array_index (urgent, iter);
+      freed += action->size;
+    }
+  if (needed <= freed)
+    return TRUE;
+  needed -= freed;
+
+  /* Backends which can't tell are left to report running out of space. */
+  info = g_file_query_filesystem_info (plan->destination, G_FILE_ATTRIBUTE_FILESYSTEM_FREE, NULL, NULL);
+  if (info == NULL)
+    return TRUE;
+
+  if (!g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE))
+    {
+      g_object_unref (info);
+      return TRUE;
+    }
+  available = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+  g_object_unref (info);
+
+  if (available >= needed)
+    return TRUE;
+
+  needed_text = g_format_size (needed);
+  available_text = g_format_size (available);
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+               "Not enough free space at the destination, %s needed but only %s available",
+               needed_text, available_text);
+  g_free (needed_text);
+  g_free (available_text);
+
+  return FALSE;
+}
+
+/**
+ * Sort the actions of a destination's plan by when they're carried out.  With
+ * several destinations, a copy is queued along with those of the same source
+ * file to the others, the first time it's come across.
+ */
+static void
+schedule_split (RudgiosyncSchedule *schedule,
+                ScheduleState *state,
+                ScheduleDestination *destination,
+                GHashTable *by_source,
+                guint plan_count)
+{
+  RudgiosyncPlan   *plan = destination->plan;
+  RudgiosyncAction *action;
+  ScheduleTargets  *targets;
+  GHashTable       *created;
+  GPtrArray        *deletions;
+  guint             lane;
+  guint             iter;
+
+
+  /**
+   * Deletions of entries which are in the way of new ones have to be done
+   * before anything else.  The directory skeleton is then put in place before
+   * any copy, and directory times depend on everything within, so they go
+   * last.
+   */
+  deletions = g_ptr_array_new ();
+  created = g_hash_table_new (g_str_hash, g_str_equal);
+  for (iter = 0; iter < plan->actions->len; iter++)
+    {
+      action = g_ptr_array_index (plan->actions, iter);
+      switch (action->type)
+        {
+          case RUDGIOSYNC_ACTION_DELETE:
+            g_ptr_array_add (deletions, action);
+            break;
+
+          case RUDGIOSYNC_ACTION_MKDIR:
+            g_hash_table_add (created, (gpointer) action->path);
+            g_ptr_array_add (destination->directories, action);
+            break;
+
+          case RUDGIOSYNC_ACTION_COPY:
+            g_hash_table_add (created, (gpointer) action->path);
+            targets = NULL;
+            if (by_source != NULL)
+              targets = g_hash_table_lookup (by_source, action->src_path);
+
+            if (targets == NULL)
+              {
+                lane = (action->size >= schedule->large_threshold) ? LANE_LARGE : LANE_SMALL;
+                g_ptr_array_add (state->queues[lane].actions, action);
+              }
+            if (by_source != NULL)
+              {
+                if (targets == NULL)
+                  {
+                    targets = g_slice_new0 (ScheduleTargets);
+                    targets->plans = g_new (RudgiosyncPlan *, plan_count);
+                    targets->actions = g_new (RudgiosyncAction *, plan_count);
+                    g_hash_table_insert (by_source, (gpointer) action->src_path, targets);
+                    g_hash_table_insert (state->targets, action, targets);
+                  }
+                targets->plans[targets->count] = plan;
+                targets->actions[targets->count++] = action;
+              }
+            break;
+
+          case RUDGIOSYNC_ACTION_TOUCH:
+            g_ptr_array_add (destination->touches, action);
+            break;
+        }
+    }
+
+  for (iter = 0; iter < deletions->len; iter++)
+    {
+      action = g_ptr_array_index (deletions, iter);
+      if (schedule->delete_timing == RUDGIOSYNC_DELETE_BEFORE
+          || schedule_in_the_way (created, action->path))
+        g_ptr_array_add (destination->urgent, action);
+      else
+        g_ptr_array_add (destination->deleter.deletions, action);
+    }
+  g_hash_table_destroy (created);
+  g_ptr_array_free (deletions, TRUE);
+}
+
+gboolean
+rudgiosync_schedule_execute (RudgiosyncSchedule *schedule,
+                             RudgiosyncPlan *plan,
+                             gboolean validate,
+                             GError **error)
+{
+  return rudgiosync_schedule_execute_many (schedule, &plan, 1, validate, error);
+}
+
+gboolean
+rudgiosync_schedule_execute_many (RudgiosyncSchedule *schedule,
+                                  RudgiosyncPlan **plans,
+                                  guint plan_count,
+                                  gboolean validate,
+                                  GError **error)
+{
+  RudgiosyncStatsTimer  timer;
+  ScheduleState         state;
+  ScheduleDestination  *destinations;
+  ScheduleDestination  *destination;
+  GHashTable           *by_source = NULL;
+  guint64               copy_count = 0;
+  guint64               copy_bytes = 0;
+  gboolean              success = TRUE;
+  guint                 lane;
+  guint                 iter;
+
+
+  /* Each destination counts, even when the source is read once for several. */
+  for (iter = 0; iter < plan_count; iter++)
+    {
+      copy_count += plans[iter]->copy_count;
+      copy_bytes += plans[iter]->copy_bytes;
+    }
+  rudgiosync_progress_begin (copy_count, copy_bytes);
+
+  memset (&state, 0, sizeof (state));
+  state.plans = plans;
+  state.validate = validate;
+  g_mutex_init (&(state.lock));
+  for (lane = 0; lane < LANE_COUNT; lane++)
+    state.queues[lane].actions = g_ptr_array_new ();
+  if (plan_count > 1)
+    {
+      state.targets = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, (GDestroyNotify) schedule_targets_free);
+      by_source = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+  destinations = g_new0 (ScheduleDestination, plan_count);
+  for (iter = 0; iter < plan_count; iter++)
+    {
+      destination = &(destinations[iter]);
+      destination->plan = plans[iter];
+      destination->urgent = g_ptr_array_new ();
+      destination->directories = g_ptr_array_new ();
+      destination->touches = g_ptr_array_new ();
+      destination->deleter.plan = plans[iter];
+      destination->deleter.deletions = g_ptr_array_new ();
+      destination->deleter.validate = validate;
+
+      schedule_split (schedule, &state, destination, by_source, plan_count);
+    }
+  if (by_source != NULL)
+    g_hash_table_destroy (by_source);
+
+  /* Nothing is changed anywhere unless everything fits. */
+  for (iter = 0; iter < plan_count && success && schedule->check_space; iter++)
+    success = schedule_check_space (plans[iter], destinations[iter].urgent, error);
+
+  for (iter = 0; iter < plan_count && success; iter++)
+    {
+      destination = &(destinations[iter]);
+      success = schedule_delete (destination->plan, destination->urgent, validate, error)
+                && schedule_directories (destination->plan, destination->directories, validate, error);
+    }
+
+  if (success)
+    {
+      for (iter = 0; iter < plan_count; iter++)
+        {
+          destination = &(destinations[iter]);
+          if (schedule->delete_timing == RUDGIOSYNC_DELETE_DURING && destination->deleter.deletions->len > 0)
+            destination->deleter_thread = g_thread_new ("rudgiosync-delete", schedule_deleter,
+                                                        &(destination->deleter));
+        }
+
+      for (lane = 0; lane < LANE_COUNT; lane++)
+        schedule_sort (state.queues[lane].actions, schedule->order, lane);
+
+      rudgiosync_stats_start (&timer);
+      success = schedule_copy (schedule, &state, error);
+      rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_COPY);
+
+      /* Copies made again change their directory's time, which comes last. */
+      success = rudgiosync_verify_wait (success ? error : NULL) && success;
+
+      for (iter = 0; iter < plan_count; iter++)
+        {
+          destination = &(destinations[iter]);
+          if (destination->deleter_thread == NULL)
+            continue;
+
+          g_thread_join (destination->deleter_thread);
+          if (destination->deleter.error != NULL)
+            {
+              if (success)
+                g_propagate_error (error, destination->deleter.error);
+              else
+                g_error_free (destination->deleter.error);
+
+              destination->deleter.error = NULL;
+              success = FALSE;
+            }
+        }
+    }
+
+  for (iter = 0; iter < plan_count && success && schedule->delete_timing == RUDGIOSYNC_DELETE_AFTER; iter++)
+    success = schedule_delete (plans[iter], destinations[iter].deleter.deletions, validate, error);
+
+  /* Setting the time of a directory doesn't change that of its parent. */
+  if (success)
+    {
+      rudgiosync_stats_start (&timer);
+      for (iter = 0; iter < plan_count && success; iter++)
+        success = rudgiosync_plan_execute_batch (plans[iter], destinations[iter].touches, validate,
+                                                 SCHEDULE_DIRECTORY_PENDING, error);
+      rudgiosync_stats_stop (&timer, RUDGIOSYNC_PHASE_MTIME);
+    }
+
+  for (iter = 0; iter < plan_count; iter++)
+    {
+      destination = &(destinations[iter]);
+      g_ptr_array_free (destination->urgent, TRUE);
+      g_ptr_array_free (destination->directories, TRUE);
+      g_ptr_array_free (destination->touches, TRUE);
+      g_ptr_array_free (destination->deleter.deletions, TRUE);
+    }
+  g_free (destinations);
+  for (lane = 0; lane < LANE_COUNT; lane++)
+    g_ptr_array_free (state.queues[lane].actions, TRUE);
+  if (state.targets != NULL)
+    g_hash_table_destroy (state.targets);
+  g_mutex_clear (&(state.lock));
+  rudgiosync_progress_end ();
+
+  return success;
+}
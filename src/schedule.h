@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Scheduling of the actions of a plan.
+ *
+ * Deletions are dealt with first, then the new directories are created, a
+ * level of the tree at a time.  The copies are then spread over two lanes of
+ * worker threads by size: a few streaming large files, to keep the link busy,
+ * and a wider one for small files, to hide the latency of each.  Directory
+ * times are set last, all at once.
+ *
+ * Deletions may also be put off until, or run alongside, the copies, except
+ * for those of entries which are in the way of new ones.
+ *
+ * Nothing is done if the destination is seen to lack the space for the
+ * copies up front.
+ *
+ * Unless fixed, the number of copies in flight in each lane is tuned for the
+ * backends involved as the copying goes.
+ *
+ * The plans for several destinations of the same source may be carried out
+ * together, each step for all of them in turn, with a file which is copied
+ * to several of them read once for all (see fanout.h).
+ */
+
+#ifndef _RUDGIOSYNC_SCHEDULE_H_
+#define _RUDGIOSYNC_SCHEDULE_H_
+
+#include "boiler.h"
+#include "plan.h"
+
+
+enum
+{
+  RUDGIOSYNC_ORDER_DEFAULT,   /* Large files largest first, small in plan order. */
+  RUDGIOSYNC_ORDER_NEWEST_FIRST,
+  RUDGIOSYNC_ORDER_OLDEST_FIRST,
+  RUDGIOSYNC_ORDER_LARGEST_FIRST,
+  RUDGIOSYNC_ORDER_SMALLEST_FIRST
+};
+
+/* When to delete extraneous entries, relative to the copies. */
+enum
+{
+  RUDGIOSYNC_DELETE_BEFORE,   /* Free up the space before copying. */
+  RUDGIOSYNC_DELETE_DURING,   /* Alongside the copies. */
+  RUDGIOSYNC_DELETE_AFTER     /* Keep everything until the copies are done. */
+};
+
+/* A number of jobs which is tuned while running, see throttle.h. */
+#define RUDGIOSYNC_JOBS_AUTO 0
+
+typedef struct
+{
+  guint   large_jobs;        /* Concurrent copies of large files. */
+  guint   small_jobs;        /* Concurrent copies of small files. */
+  guint64 large_threshold;   /* Size from which a file counts as large. */
+  guint   order;
+  guint   delete_timing;
+  gboolean check_space;      /* Refuse to start copies which won't fit. */
+} RudgiosyncSchedule;
+
+
+/* Fill in the default schedule. */
+void rudgiosync_schedule_init (RudgiosyncSchedule *schedule);
+
+/* Parse a number of jobs, a positive number or "auto". */
+gboolean rudgiosync_schedule_parse_jobs (const gchar *value, guint *jobs);
+
+/* Look up an order by its name, as given on the command line. */
+gboolean rudgiosync_schedule_parse_order (const gchar *name, guint *order);
+
+/* Carry out the actions of a plan according to the schedule. */
+gboolean rudgiosync_schedule_execute (RudgiosyncSchedule *schedule,
+                                      RudgiosyncPlan *plan,
+                                      gboolean validate,
+                                      GError **error);
+
+/* Carry out the plans made for several destinations of the same source. */
+gboolean rudgiosync_schedule_execute_many (RudgiosyncSchedule *schedule,
+                                           RudgiosyncPlan **plans,
+                                           guint plan_count,
+                                           gboolean validate,
+                                           GError **error);
+
+
+#endif /* _RUDGIOSYNC_SCHEDULE_H_ */
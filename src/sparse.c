@@ -0,0 +1,319 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "sparse.h"
+#include "trace.h"
+#include "progress.h"
+
+/**
+ * Zeroes are looked for in blocks aligned with the file, the ends of which
+ * may come in separate reads.
+ */
+#define SPARSE_BLOCK_SIZE ((gsize)4096)
+
+/* Shorter runs of zeroes are written out, as with a plain copy. */
+#define SPARSE_MIN_HOLE   ((gsize)(64 * 1024)) /* 64 KiB */
+
+
+static const gchar sparse_zeroes[SPARSE_MIN_HOLE];
+
+
+gboolean
+rudgiosync_sparse_supported (GOutputStream *output)
+{
+  return G_IS_SEEKABLE (output)
+         && g_seekable_can_seek (G_SEEKABLE (output))
+         && g_seekable_can_truncate (G_SEEKABLE (output));
+}
+
+void
+rudgiosync_sparse_writer_init (RudgiosyncSparseWriter *writer,
+                               GOutputStream *output,
+                               gboolean detect,
+                               RudgiosyncHashContext *hash)
+{
+  writer->output = output;
+  writer->detect = detect && rudgiosync_sparse_supported (output);
+  writer->offset = 0;
+  writer->hole = 0;
+  writer->hash = hash;
+}
+
+/* Catch up with the zeroes skipped, seeking past them if there are enough. */
+static gboolean
+sparse_writer_flush (RudgiosyncSparseWriter *writer, GError **error)
+{
+  RudgiosyncTraceSpan span;
+  gsize               chunk;
+  gsize               wrote_count;
+
+  if (writer->hole == 0)
+    return TRUE;
+
+  if (!writer->detect || writer->hole >= (goffset)SPARSE_MIN_HOLE)
+    {
+      if (!g_seekable_seek (G_SEEKABLE (writer->output), writer->hole, G_SEEK_CUR, NULL, error))
+        return FALSE;
+
+      writer->hole = 0;
+      return TRUE;
+    }
+
+  while (writer->hole > 0)
+    {
+      chunk = MIN ((gsize)writer->hole, SPARSE_MIN_HOLE);
+      rudgiosync_trace_begin (&span);
+      if (!g_output_stream_write_all (writer->output, sparse_zeroes, chunk, &wrote_count, NULL, error))
+        return FALSE;
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_WRITE, NULL, chunk);
+
+      writer->hole -= chunk;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+sparse_writer_put (RudgiosyncSparseWriter *writer,
+                   const gchar *data,
+                   gsize length,
+                   GError **error)
+{
+  RudgiosyncTraceSpan span;
+  gsize               wrote_count;
+
+  if (length == 0)
+    return TRUE;
+  if (!sparse_writer_flush (writer, error))
+    return FALSE;
+
+  rudgiosync_trace_begin (&span);
+  if (!g_output_stream_write_all (writer->output, data, length, &wrote_count, NULL, error))
+    return FALSE;
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_WRITE, NULL, length);
+
+  return TRUE;
+}
+
+static gboolean
+sparse_is_zero (const gchar *data, gsize length)
+{
+  return data[0] == 0 && memcmp (data, data + 1, length - 1) == 0;
+}
+
+gboolean
+rudgiosync_sparse_writer_write (RudgiosyncSparseWriter *writer,
+                                const gchar *data,
+                                gsize length,
+                                GError **error)
+{
+  gsize start = 0;   /* Data not yet written. */
+  gsize position;
+  gsize block;
+
+  if (writer->hash != NULL)
+    rudgiosync_hash_data (writer->hash, length, data);
+
+  if (writer->detect)
+    {
+      for (position = 0; position < length; position += block)
+        {
+          block = SPARSE_BLOCK_SIZE - (gsize)((writer->offset + position) % SPARSE_BLOCK_SIZE);
+          block = MIN (block, length - position);
+
+          if (sparse_is_zero (data + position, block))
+            {
+              if (!sparse_writer_put (writer, data + start, position - start, error))
+                return FALSE;
+
+              writer->hole += block;
+              start = position + block;
+            }
+        }
+    }
+
+  writer->offset += length;
+  rudgiosync_progress_bytes (length);
+  return sparse_writer_put (writer, data + start, length - start, error);
+}
+
+void
+rudgiosync_sparse_writer_skip (RudgiosyncSparseWriter *writer, goffset length)
+{
+  goffset left;
+  gsize   chunk;
+
+  /* A hole reads as zeroes, and is hashed as such. */
+  for (left = length; writer->hash != NULL && left > 0; left -= chunk)
+    {
+      chunk = (gsize)MIN (left, (goffset)SPARSE_MIN_HOLE);
+      rudgiosync_hash_data (writer->hash, chunk, sparse_zeroes);
+    }
+
+  writer->offset += length;
+  writer->hole += length;
+  rudgiosync_progress_bytes (length);
+}
+
+gboolean
+rudgiosync_sparse_writer_finish (RudgiosyncSparseWriter *writer, GError **error)
+{
+  goffset length;
+
+  if (writer->hole == 0)
+    return TRUE;
+
+  if (writer->detect && writer->hole < (goffset)SPARSE_MIN_HOLE)
+    return sparse_writer_flush (writer, error);
+
+  length = g_seekable_tell (G_SEEKABLE (writer->output)) + writer->hole;
+  writer->hole = 0;
+
+  return g_seekable_truncate (G_SEEKABLE (writer->output), length, NULL, error);
+}
+
+
+#if defined (SEEK_DATA) && defined (SEEK_HOLE)
+
+static void
+sparse_set_error (GError **error, const gchar *format)
+{
+  int saved_errno = errno;
+
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+               format, g_strerror (saved_errno));
+}
+
+int
+rudgiosync_sparse_open (GFile *source, GOutputStream *output)
+{
+  struct stat info;
+  gchar      *path;
+  off_t       hole;
+  int         fd;
+
+  if (!g_file_is_native (source) || !rudgiosync_sparse_supported (output))
+    return -1;
+
+  path = g_file_get_path (source);
+  if (path == NULL)
+    return -1;
+
+  fd = open (path, O_RDONLY);
+  g_free (path);
+  if (fd < 0)
+    return -1;
+
+  /* Files without holes, or on filesystems which can't tell, end in one. */
+  if (fstat (fd, &info) != 0
+      || !S_ISREG (info.st_mode)
+      || (hole = lseek (fd, 0, SEEK_HOLE)) < 0
+      || hole >= info.st_size)
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+gboolean
+rudgiosync_sparse_copy (int fd,
+                        GOutputStream *output,
+                        gchar *buffer,
+                        gsize buffer_size,
+                        RudgiosyncHashContext *hash,
+                        GError **error)
+{
+  RudgiosyncSparseWriter writer;
+  off_t                  offset = 0;
+  off_t                  data;
+  off_t                  hole;
+  off_t                  end;
+  gssize                 read_count;
+
+  rudgiosync_sparse_writer_init (&writer, output, FALSE, hash);
+  while ((data = lseek (fd, offset, SEEK_DATA)) >= 0)
+    {
+      hole = lseek (fd, data, SEEK_HOLE);
+      if (hole < 0)
+        {
+          sparse_set_error (error, "Error seeking in file: %s");
+          return FALSE;
+        }
+
+      rudgiosync_sparse_writer_skip (&writer, data - offset);
+      for (offset = data; offset < hole; offset += read_count)
+        {
+          read_count = pread (fd, buffer, MIN (buffer_size, (gsize)(hole - offset)), offset);
+          if (read_count < 0)
+            {
+              if (errno == EINTR)
+                {
+                  read_count = 0;
+                  continue;
+                }
+
+              sparse_set_error (error, "Error reading from file: %s");
+              return FALSE;
+            }
+
+          /* The file was cut short while being copied. */
+          if (read_count == 0)
+            break;
+
+          if (!rudgiosync_sparse_writer_write (&writer, buffer, read_count, error))
+            return FALSE;
+        }
+      if (offset < hole)
+        break;
+    }
+
+  /* Past the last of the data, the rest of the file is a hole. */
+  if (data < 0 && errno != ENXIO)
+    {
+      sparse_set_error (error, "Error seeking in file: %s");
+      return FALSE;
+    }
+
+  end = lseek (fd, 0, SEEK_END);
+  if (end > offset)
+    rudgiosync_sparse_writer_skip (&writer, end - offset);
+
+  return rudgiosync_sparse_writer_finish (&writer, error);
+}
+
+#else /* !(SEEK_DATA && SEEK_HOLE) */
+
+int
+rudgiosync_sparse_open (GFile *source, GOutputStream *output)
+{
+  return -1;
+}
+
+gboolean
+rudgiosync_sparse_copy (int fd,
+                        GOutputStream *output,
+                        gchar *buffer,
+                        gsize buffer_size,
+                        RudgiosyncHashContext *hash,
+                        GError **error)
+{
+  g_return_val_if_reached (FALSE);
+}
+
+#endif /* !(SEEK_DATA && SEEK_HOLE) */
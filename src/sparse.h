@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Copying of sparse files.
+ *
+ * Holes are left as holes in destinations which can seek and truncate: the
+ * data of local sources is found with SEEK_DATA and SEEK_HOLE, and long runs
+ * of zeroes are looked for in the data of other sources, which can't tell.
+ * Skipped over, they become holes when the destination is written further
+ * on, or truncated to its final size.
+ */
+
+#ifndef _RUDGIOSYNC_SPARSE_H_
+#define _RUDGIOSYNC_SPARSE_H_
+
+#include "boiler.h"
+#include "checksum.h"
+
+
+typedef struct
+{
+  GOutputStream *output;
+  gboolean       detect;   /* Whether to look for runs of zeroes. */
+  goffset        offset;   /* Bytes written or skipped so far. */
+  goffset        hole;     /* Zeroes skipped, not yet written. */
+  RudgiosyncHashContext *hash; /* Fed all of it, holes included, if given. */
+} RudgiosyncSparseWriter;
+
+
+/* Whether holes can be left in an output stream. */
+gboolean rudgiosync_sparse_supported (GOutputStream *output);
+
+/**
+ * Set up writing to an output stream, leaving runs of zeroes out if told to
+ * detect them and the stream supports holes.  What's written is hashed along
+ * the way if a hashing state is given.
+ */
+void rudgiosync_sparse_writer_init (RudgiosyncSparseWriter *writer,
+                                    GOutputStream *output,
+                                    gboolean detect,
+                                    RudgiosyncHashContext *hash);
+
+gboolean rudgiosync_sparse_writer_write (RudgiosyncSparseWriter *writer,
+                                         const gchar *data,
+                                         gsize length,
+                                         GError **error);
+
+/* Leave a hole, the stream must support them. */
+void rudgiosync_sparse_writer_skip (RudgiosyncSparseWriter *writer,
+                                    goffset length);
+
+/* Write out or truncate the file over what's left of a hole at its end. */
+gboolean rudgiosync_sparse_writer_finish (RudgiosyncSparseWriter *writer,
+                                          GError **error);
+
+/**
+ * Open a local file for copying by its data, if it has holes and they can
+ * be kept in the output.  Returns -1 otherwise.
+ */
+int rudgiosync_sparse_open (GFile *source, GOutputStream *output);
+
+/* Copy the data of a file opened by rudgiosync_sparse_open, leaving holes,
+   and hashing it if a hashing state is given. */
+gboolean rudgiosync_sparse_copy (int fd,
+                                 GOutputStream *output,
+                                 gchar *buffer,
+                                 gsize buffer_size,
+                                 RudgiosyncHashContext *hash,
+                                 GError **error);
+
+
+#endif /* _RUDGIOSYNC_SPARSE_H_ */
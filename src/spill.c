@@ -0,0 +1,1363 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "spill.h"
+#include "descriptions.h"
+#include "operations.h"
+#include "arena.h"
+#include "resume.h"
+#include "errors.h"
+#include "stats.h"
+#include "trace.h"
+#include "progress.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#define SPILL_MIN_MEMORY   ((gsize)(8 * 1024 * 1024)) /* 8 MiB */
+#define SPILL_MAX_FAN_IN   64
+#define SPILL_RUN_BUF_SIZE ((gsize)(64 * 1024))      /* 64 KiB */
+
+#define ENTRY_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_TYPE ","           \
+                         G_FILE_ATTRIBUTE_STANDARD_NAME ","           \
+                         G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","   \
+                         G_FILE_ATTRIBUTE_STANDARD_SIZE ","           \
+                         G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+
+typedef struct SpillRecord_ SpillRecord;
+typedef struct SpillRun_ SpillRun;
+typedef struct SpillReader_ SpillReader;
+
+/* A single examined file or directory, keyed by its path below the root. */
+struct SpillRecord_
+{
+  const gchar *path;      /* "" for the root itself. */
+  guint64      size;
+  guint64      modified_time;
+  guint        type;
+  gboolean     has_checksum;
+  RudgiosyncChecksum checksum;
+};
+
+/* A sorted sequence of records, either in a run file or still in memory. */
+struct SpillRun_
+{
+  FILE        *stream;
+  gchar       *run_path;
+  GString     *path_buffer;
+
+  GPtrArray   *records;
+  guint        index;
+
+  SpillRecord  current;
+};
+
+/* Produces the records of several runs as a single sorted sequence. */
+struct SpillReader_
+{
+  SpillRun **heap;
+  guint      heap_size;
+  GPtrArray *runs;
+};
+
+struct RudgiosyncSpillList_
+{
+  GFile     *descriptor;
+  gchar     *display_name;     /* Of the examined location itself. */
+  guint      type;
+  gboolean   checksum_wanted;
+  gsize      memory_limit;
+
+  gchar     *run_dir;          /* Created with the first run file. */
+  GPtrArray *run_paths;
+  guint      run_count;
+
+  RudgiosyncArena  arena;      /* Holds the records not yet spilled. */
+  GPtrArray       *records;
+};
+
+
+/**
+ * Paths are compared component by component, which is the same as treating
+ * the separator as lower than any other byte.  A directory is thus always
+ * immediately followed by its whole subtree.
+ */
+static gint
+spill_path_compare (const gchar *path_a, const gchar *path_b)
+{
+  guint value_a;
+  guint value_b;
+
+  while (*path_a == *path_b && *path_a != '\0')
+    {
+      path_a++;
+      path_b++;
+    }
+
+  value_a = (*path_a == '\0') ? 0 : (*path_a == '/') ? 1 : (guint)(guchar)*path_a + 2;
+  value_b = (*path_b == '\0') ? 0 : (*path_b == '/') ? 1 : (guint)(guchar)*path_b + 2;
+
+  return (value_a < value_b) ? -1 : (value_a > value_b) ? 1 : 0;
+}
+
+static gint
+spill_record_compare (gconstpointer record_a, gconstpointer record_b)
+{
+  return spill_path_compare ((*(SpillRecord **)record_a)->path,
+                             (*(SpillRecord **)record_b)->path);
+}
+
+/* Check whether the given path lies within the given directory. */
+static gboolean
+spill_path_is_inside (const gchar *path, const gchar *directory)
+{
+  gsize length = strlen (directory);
+
+  if (length == 0)
+    return path[0] != '\0';
+
+  return strncmp (path, directory, length) == 0 && path[length] == '/';
+}
+
+/* Check whether the entry at the given path was left by an interrupted copy. */
+static gboolean
+spill_is_leftover (const gchar *path)
+{
+  const gchar *name = strrchr (path, '/');
+
+  return rudgiosync_resume_is_leftover ((name != NULL) ? name + 1 : path);
+}
+
+static GFile *
+spill_descriptor_for_path (RudgiosyncSpillList *list, const gchar *path)
+{
+  if (path[0] == '\0')
+    return g_object_ref (list->descriptor);
+
+  return g_file_resolve_relative_path (list->descriptor, path);
+}
+
+static void
+spill_set_io_error (GError **error, const gchar *action, const gchar *path, gint errsv)
+{
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+               "Failed to %s the run file `%s': %s",
+               action, path, g_strerror (errsv));
+}
+
+
+/* Run file handling. */
+
+static gboolean
+spill_write_record (FILE *stream, SpillRecord *record)
+{
+  guint32 path_length;
+  guint8  type;
+  guint8  has_checksum;
+
+  path_length  = (guint32)strlen (record->path);
+  type         = (guint8)record->type;
+  has_checksum = (guint8)record->has_checksum;
+
+  fwrite (&path_length, sizeof (path_length), 1, stream);
+  fwrite (record->path, 1, path_length, stream);
+  fwrite (&type, sizeof (type), 1, stream);
+  fwrite (&(record->size), sizeof (record->size), 1, stream);
+  fwrite (&(record->modified_time), sizeof (record->modified_time), 1, stream);
+  fwrite (&has_checksum, sizeof (has_checksum), 1, stream);
+  if (record->has_checksum)
+    fwrite (&(record->checksum), sizeof (record->checksum), 1, stream);
+
+  return !ferror (stream);
+}
+
+/* Read the next record of a run, returning FALSE once it's exhausted. */
+static gboolean
+spill_run_next (SpillRun *run, GError **error)
+{
+  SpillRecord *record;
+  guint32 path_length;
+  guint8  type;
+  guint8  has_checksum;
+  gboolean complete;
+
+  if (run->stream == NULL)
+    {
+      if (run->index >= run->records->len)
+        return FALSE;
+
+      record = g_ptr_array_index (run->records, run->index);
+      run->current = *record;
+      run->index++;
+
+      return TRUE;
+    }
+
+  if (fread (&path_length, sizeof (path_length), 1, run->stream) != 1)
+    {
+      if (ferror (run->stream))
+        spill_set_io_error (error, "read", run->run_path, errno);
+
+      return FALSE;
+    }
+
+  g_string_set_size (run->path_buffer, path_length);
+  complete = fread (run->path_buffer->str, 1, path_length, run->stream) == path_length
+             && fread (&type, sizeof (type), 1, run->stream) == 1
+             && fread (&(run->current.size), sizeof (run->current.size), 1, run->stream) == 1
+             && fread (&(run->current.modified_time), sizeof (run->current.modified_time), 1, run->stream) == 1
+             && fread (&has_checksum, sizeof (has_checksum), 1, run->stream) == 1
+             && (!has_checksum
+                 || fread (&(run->current.checksum), sizeof (run->current.checksum), 1, run->stream) == 1);
+  if (!complete)
+    {
+      if (ferror (run->stream))
+        spill_set_io_error (error, "read", run->run_path, errno);
+      else
+        g_set_error (error, RUDGIOSYNC_ERROR,
+                     RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                     "Failed to read the run file `%s': %s",
+                     run->run_path, "Unexpected end of file");
+
+      return FALSE;
+    }
+
+  run->current.path = run->path_buffer->str;
+  run->current.type = type;
+  run->current.has_checksum = has_checksum;
+
+  return TRUE;
+}
+
+static void
+spill_run_free (SpillRun *run)
+{
+  if (run->stream != NULL)
+    fclose (run->stream);
+  if (run->path_buffer != NULL)
+    g_string_free (run->path_buffer, TRUE);
+
+  g_free (run->run_path);
+  g_slice_free (SpillRun, run);
+}
+
+
+/* Merging of runs, using a binary min-heap of their current records. */
+
+static void
+spill_reader_sift_down (SpillReader *reader, guint position)
+{
+  SpillRun *swap;
+  guint smallest;
+  guint child;
+
+  while (TRUE)
+    {
+      smallest = position;
+      for (child = 2 * position + 1;
+           child <= 2 * position + 2 && child < reader->heap_size;
+           child++)
+        {
+          if (spill_path_compare (reader->heap[child]->current.path,
+                                  reader->heap[smallest]->current.path) < 0)
+            smallest = child;
+        }
+      if (smallest == position)
+        break;
+
+      swap = reader->heap[position];
+      reader->heap[position] = reader->heap[smallest];
+      reader->heap[smallest] = swap;
+      position = smallest;
+    }
+}
+
+static void
+spill_reader_free (SpillReader *reader)
+{
+  g_ptr_array_free (reader->runs, TRUE);
+  g_free (reader->heap);
+  g_slice_free (SpillReader, reader);
+}
+
+static SpillReader *
+spill_reader_new (GPtrArray *run_paths, guint first, guint count, GPtrArray *records, GError **error)
+{
+  SpillReader *retval;
+  SpillRun    *run;
+  guint        iter;
+
+  GError *ierror = NULL;
+
+
+  retval = g_slice_new0 (SpillReader);
+  retval->runs = g_ptr_array_new_with_free_func ((GDestroyNotify)spill_run_free);
+
+  for (iter = first; iter < first + count; iter++)
+    {
+      run = g_slice_new0 (SpillRun);
+      run->run_path = g_strdup (g_ptr_array_index (run_paths, iter));
+      run->path_buffer = g_string_new (NULL);
+      g_ptr_array_add (retval->runs, run);
+
+      run->stream = fopen (run->run_path, "rb");
+      if (run->stream == NULL)
+        {
+          spill_set_io_error (error, "open", run->run_path, errno);
+
+          spill_reader_free (retval);
+          return NULL;
+        }
+      setvbuf (run->stream, NULL, _IOFBF, SPILL_RUN_BUF_SIZE);
+    }
+  if (records != NULL && records->len > 0)
+    {
+      run = g_slice_new0 (SpillRun);
+      run->records = records;
+      g_ptr_array_add (retval->runs, run);
+    }
+
+  retval->heap = g_new (SpillRun *, retval->runs->len + 1);
+  for (iter = 0; iter < retval->runs->len; iter++)
+    {
+      run = g_ptr_array_index (retval->runs, iter);
+      if (spill_run_next (run, &ierror))
+        retval->heap[retval->heap_size++] = run;
+
+      if (ierror != NULL)
+        {
+          g_propagate_error (error, ierror);
+
+          spill_reader_free (retval);
+          return NULL;
+        }
+    }
+  for (iter = retval->heap_size / 2 + 1; iter > 0; iter--)
+    spill_reader_sift_down (retval, iter - 1);
+
+  return retval;
+}
+
+/* Return the smallest record not yet consumed, or NULL at the end. */
+static SpillRecord *
+spill_reader_peek (SpillReader *reader)
+{
+  if (reader->heap_size == 0)
+    return NULL;
+
+  return &(reader->heap[0]->current);
+}
+
+static gboolean
+spill_reader_advance (SpillReader *reader, GError **error)
+{
+  GError *ierror = NULL;
+
+  if (reader->heap_size == 0)
+    return TRUE;
+
+  if (!spill_run_next (reader->heap[0], &ierror))
+    {
+      if (ierror != NULL)
+        {
+          g_propagate_error (error, ierror);
+          return FALSE;
+        }
+      reader->heap[0] = reader->heap[--(reader->heap_size)];
+    }
+  spill_reader_sift_down (reader, 0);
+
+  return TRUE;
+}
+
+
+/* Listing construction. */
+
+static gchar *
+spill_list_next_run_path (RudgiosyncSpillList *list, GError **error)
+{
+  GError *ierror = NULL;
+
+  if (list->run_dir == NULL)
+    {
+      list->run_dir = g_dir_make_tmp ("rudgiosync-XXXXXX", &ierror);
+      if (ierror != NULL)
+        {
+          g_propagate_prefixed_error (error, ierror, "Failed to create a directory for run files: ");
+          return NULL;
+        }
+    }
+
+  return g_strdup_printf ("%s/run-%u", list->run_dir, list->run_count++);
+}
+
+/* Write the records held in memory out as a new sorted run. */
+static gboolean
+spill_list_flush (RudgiosyncSpillList *list, GError **error)
+{
+  FILE  *stream;
+  gchar *run_path;
+  guint  iter;
+
+  GError *ierror = NULL;
+
+
+  run_path = spill_list_next_run_path (list, &ierror);
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+  stream = fopen (run_path, "wb");
+  if (stream == NULL)
+    {
+      spill_set_io_error (error, "create", run_path, errno);
+
+      g_free (run_path);
+      return FALSE;
+    }
+  setvbuf (stream, NULL, _IOFBF, SPILL_RUN_BUF_SIZE);
+
+  g_ptr_array_sort (list->records, spill_record_compare);
+  for (iter = 0; iter < list->records->len; iter++)
+    {
+      if (!spill_write_record (stream, g_ptr_array_index (list->records, iter)))
+        break;
+    }
+  if (fclose (stream) != 0 || iter < list->records->len)
+    {
+      spill_set_io_error (error, "write", run_path, errno);
+
+      g_free (run_path);
+      return FALSE;
+    }
+  g_ptr_array_add (list->run_paths, run_path);
+
+  g_ptr_array_set_size (list->records, 0);
+  rudgiosync_arena_clear (&(list->arena));
+
+  return TRUE;
+}
+
+/**
+ * Merge groups of runs into bigger ones, until all of them can be merged in
+ * a single pass without exceeding the fan-in limit.
+ */
+static gboolean
+spill_list_compact (RudgiosyncSpillList *list, GError **error)
+{
+  SpillReader *reader;
+  GPtrArray   *merged_paths;
+  FILE        *stream;
+  gchar       *run_path;
+  guint        first;
+  guint        count;
+
+  GError *ierror = NULL;
+
+
+  while (list->run_paths->len >= SPILL_MAX_FAN_IN)
+    {
+      merged_paths = g_ptr_array_new_with_free_func (g_free);
+
+      for (first = 0; first < list->run_paths->len; first += count)
+        {
+          count = MIN (SPILL_MAX_FAN_IN - 1, list->run_paths->len - first);
+
+          run_path = spill_list_next_run_path (list, &ierror);
+          if (ierror != NULL)
+            break;
+          g_ptr_array_add (merged_paths, run_path);
+
+          stream = fopen (run_path, "wb");
+          if (stream == NULL)
+            {
+              spill_set_io_error (&ierror, "create", run_path, errno);
+              break;
+            }
+          setvbuf (stream, NULL, _IOFBF, SPILL_RUN_BUF_SIZE);
+
+          reader = spill_reader_new (list->run_paths, first, count, NULL, &ierror);
+          while (ierror == NULL && spill_reader_peek (reader) != NULL)
+            {
+              if (!spill_write_record (stream, spill_reader_peek (reader)))
+                spill_set_io_error (&ierror, "write", run_path, errno);
+              else
+                spill_reader_advance (reader, &ierror);
+            }
+          if (reader != NULL)
+            spill_reader_free (reader);
+
+          if (fclose (stream) != 0 && ierror == NULL)
+            spill_set_io_error (&ierror, "write", run_path, errno);
+          if (ierror != NULL)
+            break;
+        }
+
+      if (ierror != NULL)
+        {
+          g_propagate_error (error, ierror);
+
+          for (first = 0; first < merged_paths->len; first++)
+            g_unlink (g_ptr_array_index (merged_paths, first));
+          g_ptr_array_free (merged_paths, TRUE);
+          return FALSE;
+        }
+
+      for (first = 0; first < list->run_paths->len; first++)
+        g_unlink (g_ptr_array_index (list->run_paths, first));
+      g_ptr_array_free (list->run_paths, TRUE);
+      list->run_paths = merged_paths;
+    }
+
+  return TRUE;
+}
+
+static guint
+spill_type_from_info (GFileInfo *info)
+{
+  switch (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_STANDARD_TYPE))
+    {
+      case G_FILE_TYPE_REGULAR:
+        return RUDGIOSYNC_DIR_ENTRY_FILE;
+
+      case G_FILE_TYPE_DIRECTORY:
+        return RUDGIOSYNC_DIR_ENTRY_DIR;
+
+      default:
+        return RUDGIOSYNC_DIR_ENTRY_OTHER;
+    }
+}
+
+static gboolean
+spill_list_add (RudgiosyncSpillList *list, const gchar *path, GFileInfo *info, GFile *descriptor, GError **error)
+{
+  SpillRecord *record;
+  gsize        path_length;
+  gchar       *uri;
+
+  GError *ierror = NULL;
+
+
+  record = rudgiosync_arena_alloc (&(list->arena), sizeof (SpillRecord));
+  path_length = strlen (path) + 1;
+  record->path = memcpy (rudgiosync_arena_alloc (&(list->arena), path_length), path, path_length);
+
+  record->modified_time = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  record->type = spill_type_from_info (info);
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_ENTRIES_SCANNED, 1);
+  if (record->type == RUDGIOSYNC_DIR_ENTRY_FILE)
+    {
+      record->size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SCANNED, record->size);
+
+      if (list->checksum_wanted && !spill_is_leftover (path))
+        {
+          rudgiosync_checksum_for_gfile (descriptor, &(record->checksum), &ierror);
+          if (ierror != NULL)
+            {
+              uri = g_file_get_uri (descriptor);
+              g_propagate_prefixed_error (error, ierror, "Failed to produce a checksum for the file `%s': ", uri);
+              g_free (uri);
+
+              return FALSE;
+            }
+          record->has_checksum = TRUE;
+        }
+    }
+  g_ptr_array_add (list->records, record);
+
+  if (list->arena.allocated + list->records->len * sizeof (gpointer) > list->memory_limit)
+    return spill_list_flush (list, error);
+
+  return TRUE;
+}
+
+static gboolean
+spill_list_scan_directory (RudgiosyncSpillList *list, GFile *descriptor, const gchar *path, const gchar *uri, GError **error)
+{
+  GFileEnumerator     *enumerator;
+  GFileInfo           *child_info;
+  GFile               *child_descriptor;
+  RudgiosyncTraceSpan  span;
+  const gchar         *child_name;
+  gchar               *child_path;
+  gchar               *child_uri;
+
+  GError *ierror = NULL;
+
+
+  rudgiosync_trace_begin (&span);
+  enumerator = g_file_enumerate_children (descriptor,
+                                          ENTRY_ATTRIBUTES,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL,
+                                          &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_ENUMERATE, descriptor, -1);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the children of the directory `%s': ", uri);
+      return FALSE;
+    }
+  while (TRUE)
+    {
+      rudgiosync_trace_begin (&span);
+      child_info = g_file_enumerator_next_file (enumerator, NULL, &ierror);
+      rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_ENUMERATE, descriptor, -1);
+      if (ierror != NULL)
+        {
+          g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
+
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+      if (child_info == NULL)
+        {
+          break;
+        }
+      child_name = g_file_info_get_attribute_byte_string (child_info, G_FILE_ATTRIBUTE_STANDARD_NAME);
+      if (child_name == NULL)
+        {
+          g_set_error (error, RUDGIOSYNC_ERROR,
+                       RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                       "Failed to retrieve information about a child of the directory `%s': %s",
+                       uri,
+                       "Filename information missing in GFileInfo retrieved from GFileEnumerator");
+
+          g_object_unref (child_info);
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+
+      child_descriptor = g_file_get_child (descriptor, child_name);
+      if (path[0] != '\0')
+        child_path = g_strconcat (path, "/", child_name, NULL);
+      else
+        child_path = g_strdup (child_name);
+
+      spill_list_add (list, child_path, child_info, child_descriptor, &ierror);
+      if (ierror == NULL
+          && spill_type_from_info (child_info) == RUDGIOSYNC_DIR_ENTRY_DIR)
+        {
+          child_uri = g_file_get_uri (child_descriptor);
+          spill_list_scan_directory (list, child_descriptor, child_path, child_uri, &ierror);
+          g_free (child_uri);
+        }
+      g_free (child_path);
+      g_object_unref (child_descriptor);
+      g_object_unref (child_info);
+
+      if (ierror != NULL)
+        {
+          g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about a child of the directory `%s': ", uri);
+
+          g_object_unref (enumerator);
+          return FALSE;
+        }
+    }
+
+  g_object_unref (enumerator);
+  return TRUE;
+}
+
+RudgiosyncSpillList *
+rudgiosync_spill_list_new (GFile *descriptor,
+                           gboolean checksum_wanted,
+                           gsize memory_limit,
+                           GError **error)
+{
+  RudgiosyncSpillList *retval;
+  RudgiosyncTraceSpan  span;
+  GFileInfo   *info;
+  const gchar *display_name;
+  gchar       *uri;
+
+  GError *ierror = NULL;
+
+
+  retval = g_slice_new0 (RudgiosyncSpillList);
+  retval->descriptor = g_object_ref (descriptor);
+  retval->checksum_wanted = checksum_wanted;
+  retval->memory_limit = MAX (memory_limit, SPILL_MIN_MEMORY);
+  retval->run_paths = g_ptr_array_new_with_free_func (g_free);
+  retval->records = g_ptr_array_new ();
+  rudgiosync_arena_init (&(retval->arena));
+
+  uri = g_file_get_uri (descriptor);
+  rudgiosync_trace_begin (&span);
+  info = g_file_query_info (descriptor,
+                            ENTRY_ATTRIBUTES,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            NULL,
+                            &ierror);
+  rudgiosync_trace_end (&span, RUDGIOSYNC_TRACE_QUERY_INFO, descriptor, -1);
+  if (ierror != NULL)
+    {
+      g_propagate_prefixed_error (error, ierror, "Failed to retrieve information about the file `%s': ", uri);
+
+      g_free (uri);
+      rudgiosync_spill_list_free (retval);
+      return NULL;
+    }
+  display_name = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME);
+  if (display_name == NULL)
+    {
+      g_set_error (error, RUDGIOSYNC_ERROR,
+                   RUDGIOSYNC_INFO_RETRIEVAL_ERROR,
+                   "Failed to retrieve information about the file `%s': %s",
+                   uri,
+                   "Displayable filename information missing in GFileInfo");
+
+      g_object_unref (info);
+      g_free (uri);
+      rudgiosync_spill_list_free (retval);
+      return NULL;
+    }
+  retval->display_name = g_strdup (display_name);
+
+  retval->type = spill_type_from_info (info);
+  spill_list_add (retval, "", info, descriptor, &ierror);
+  g_object_unref (info);
+
+  if (ierror == NULL && retval->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+    spill_list_scan_directory (retval, descriptor, "", uri, &ierror);
+  if (ierror == NULL)
+    spill_list_compact (retval, &ierror);
+  g_free (uri);
+
+  /* Whatever wasn't spilled is kept in memory, as one more sorted run. */
+  g_ptr_array_sort (retval->records, spill_record_compare);
+
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+
+      rudgiosync_spill_list_free (retval);
+      return NULL;
+    }
+
+  return retval;
+}
+
+void
+rudgiosync_spill_list_free (RudgiosyncSpillList *list)
+{
+  guint iter;
+
+  if (list == NULL)
+    return;
+
+  for (iter = 0; iter < list->run_paths->len; iter++)
+    g_unlink (g_ptr_array_index (list->run_paths, iter));
+  if (list->run_dir != NULL)
+    g_rmdir (list->run_dir);
+
+  g_ptr_array_free (list->run_paths, TRUE);
+  g_ptr_array_free (list->records, TRUE);
+  rudgiosync_arena_clear (&(list->arena));
+
+  g_free (list->run_dir);
+  g_free (list->display_name);
+  g_object_unref (list->descriptor);
+
+  g_slice_free (RudgiosyncSpillList, list);
+}
+
+
+/* Synchronization by merge-joining two listings. */
+
+typedef struct
+{
+  gchar    *path;
+  guint64   modified_time;
+  gboolean  announce;
+  gboolean  modified;       /* Its time needs to be set when closed. */
+} SpillOpenDirectory;
+
+typedef struct
+{
+  RudgiosyncSpillList *destination;
+  RudgiosyncSpillList *source;
+  gboolean  check_timestamp;
+  gboolean  checksum_only;
+  gboolean  delete_unwanted;
+
+  RudgiosyncActionFunc func;
+  gpointer             user_data;
+
+  GPtrArray *open_dirs;          /* Innermost last. */
+
+  /**
+   * Destination entries below `skip_prefix' have no counterpart in the
+   * source.  When they are being deleted, directories wait in `doomed_dirs'
+   * until their subtree has been passed, and a file replacing the subtree
+   * waits in `pending_copy'.
+   */
+  gchar     *skip_prefix;
+  gboolean   skip_deleting;
+  GPtrArray *doomed_dirs;        /* Of paths, innermost last. */
+  SpillRecord *pending_copy;
+
+  /**
+   * With deletion, leftovers of interrupted copies wait in `leftovers' until
+   * their directory has been passed.  They are then deleted, unless the copy
+   * they were left by is among the resumable ones in `resumed'.
+   */
+  GPtrArray  *leftovers;         /* Of records, innermost last. */
+  GHashTable *resumed;           /* Of paths. */
+} SpillJoin;
+
+static gboolean
+spill_records_differ (SpillRecord *destination,
+                      SpillRecord *source,
+                      gboolean check_timestamp, gboolean checksum_only)
+{
+  if (checksum_only)
+    {
+      /* Leftovers of interrupted copies aren't hashed. */
+      if (!destination->has_checksum || !source->has_checksum)
+        return TRUE;
+
+      return rudgiosync_checksums_differ (&(destination->checksum),
+                                          &(source->checksum));
+    }
+  if (!check_timestamp)
+    {
+      return destination->size != source->size;
+    }
+  else
+    {
+      return (destination->size != source->size)
+             || (destination->modified_time != source->modified_time);
+    }
+}
+
+/* Print a message about a source entry, at the given verbosity or above. */
+static void
+spill_print_source (RudgiosyncSpillList *source, const gchar *path, guint verbosity, const gchar *message)
+{
+  GFile *descriptor;
+  gchar *uri;
+
+  if (rudgiosync_progress_verbosity () < verbosity)
+    return;
+
+  descriptor = spill_descriptor_for_path (source, path);
+  uri = g_file_get_uri (descriptor);
+  g_print (message, uri);
+  g_free (uri);
+  g_object_unref (descriptor);
+}
+
+static gboolean
+spill_emit (SpillJoin *join,
+            guint type,
+            guint entry_type,
+            gboolean announce,
+            guint64 size,
+            guint64 modified_time,
+            const gchar *path,
+            SpillRecord *replaced,
+            GError **error)
+{
+  RudgiosyncAction    action;
+  SpillOpenDirectory *open_dir;
+  const gchar        *name;
+  guint               iter;
+
+  action.type          = type;
+  action.entry_type    = entry_type;
+  action.announce      = announce;
+  action.size          = size;
+  action.modified_time = modified_time;
+  action.path          = path;
+  action.src_path      = path;
+  action.source        = 0;
+  action.replaces      = replaced != NULL;
+  action.replaced_size = (replaced != NULL) ? replaced->size : 0;
+  action.replaced_modified_time = (replaced != NULL) ? replaced->modified_time : 0;
+
+  /* Creating, replacing or removing an entry disturbs its directory's time. */
+  for (iter = join->open_dirs->len; type != RUDGIOSYNC_ACTION_TOUCH && iter > 0; iter--)
+    {
+      open_dir = g_ptr_array_index (join->open_dirs, iter - 1);
+      if (spill_path_is_inside (path, open_dir->path))
+        {
+          name = path + strlen (open_dir->path) + (open_dir->path[0] != '\0');
+          if (strchr (name, '/') == NULL)
+            open_dir->modified = TRUE;
+          break;
+        }
+    }
+
+  return join->func (&action, join->user_data, error);
+}
+
+/* Copy a source file, over the given destination file if there's one. */
+static gboolean
+spill_emit_copy (SpillJoin *join, SpillRecord *record, SpillRecord *replaced, GError **error)
+{
+  if (join->resumed != NULL && rudgiosync_resume_wanted (record->size))
+    g_hash_table_add (join->resumed, g_strdup (record->path));
+
+  return spill_emit (join, RUDGIOSYNC_ACTION_COPY, RUDGIOSYNC_DIR_ENTRY_FILE, TRUE,
+                     record->size, record->modified_time, record->path, replaced,
+                     error);
+}
+
+/* Delete a destination entry, directories are held back until emptied. */
+static gboolean
+spill_delete_record (SpillJoin *join, SpillRecord *record, GError **error)
+{
+  if (record->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+    {
+      g_ptr_array_add (join->doomed_dirs, g_strdup (record->path));
+      return TRUE;
+    }
+
+  return spill_emit (join, RUDGIOSYNC_ACTION_DELETE, record->type, FALSE,
+                     record->size, record->modified_time, record->path, NULL,
+                     error);
+}
+
+/* Delete the held back directories the given path is outside of. */
+static gboolean
+spill_release_doomed (SpillJoin *join, const gchar *path, GError **error)
+{
+  gchar    *doomed_path;
+  gboolean  success;
+
+  while (join->doomed_dirs->len > 0)
+    {
+      doomed_path = g_ptr_array_index (join->doomed_dirs, join->doomed_dirs->len - 1);
+      if (path != NULL && spill_path_is_inside (path, doomed_path))
+        break;
+
+      success = spill_emit (join, RUDGIOSYNC_ACTION_DELETE, RUDGIOSYNC_DIR_ENTRY_DIR, FALSE,
+                            0, 0, doomed_path, NULL,
+                            error);
+      g_ptr_array_set_size (join->doomed_dirs, join->doomed_dirs->len - 1);
+
+      if (!success)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+spill_hold_leftover (SpillJoin *join, SpillRecord *dest_record)
+{
+  SpillRecord *leftover;
+
+  leftover = g_slice_dup (SpillRecord, dest_record);
+  leftover->path = g_strdup (dest_record->path);
+  g_ptr_array_add (join->leftovers, leftover);
+}
+
+static void
+spill_free_leftover (SpillRecord *leftover)
+{
+  g_free ((gchar *)leftover->path);
+  g_slice_free (SpillRecord, leftover);
+}
+
+/* Delete the held back leftovers whose directory the given path is outside of,
+ * unless their copy is resumed. */
+static gboolean
+spill_release_leftovers (SpillJoin *join, const gchar *path, GError **error)
+{
+  SpillRecord *leftover;
+  const gchar *name;
+  gchar       *directory;
+  gchar       *target;
+  gchar       *target_path;
+  gboolean     success = TRUE;
+
+  while (join->leftovers->len > 0 && success)
+    {
+      leftover = g_ptr_array_index (join->leftovers, join->leftovers->len - 1);
+      name = strrchr (leftover->path, '/');
+      directory = (name != NULL) ? g_strndup (leftover->path, name - leftover->path) : g_strdup ("");
+      name = (name != NULL) ? name + 1 : leftover->path;
+
+      if (path != NULL && spill_path_is_inside (path, directory))
+        {
+          g_free (directory);
+          break;
+        }
+
+      target = rudgiosync_resume_leftover_target (name);
+      target_path = (directory[0] != '\0') ? g_strconcat (directory, "/", target, NULL) : g_strdup (target);
+      if (!g_hash_table_contains (join->resumed, target_path))
+        success = spill_delete_record (join, leftover, error);
+
+      g_free (target_path);
+      g_free (target);
+      g_free (directory);
+      g_ptr_array_set_size (join->leftovers, join->leftovers->len - 1);
+    }
+
+  return success;
+}
+
+static gboolean
+spill_begin_skip (SpillJoin *join, SpillRecord *dest_record, gboolean deleting, GError **error)
+{
+  join->skip_prefix = g_strdup (dest_record->path);
+  join->skip_deleting = deleting;
+
+  if (deleting)
+    return spill_delete_record (join, dest_record, error);
+
+  return TRUE;
+}
+
+static gboolean
+spill_end_skip (SpillJoin *join, GError **error)
+{
+  gboolean success;
+
+  g_free (join->skip_prefix);
+  join->skip_prefix = NULL;
+
+  success = spill_release_doomed (join, NULL, error);
+  if (join->pending_copy != NULL)
+    {
+      if (success)
+        success = spill_emit_copy (join, join->pending_copy, NULL, error);
+
+      g_free ((gchar *)join->pending_copy->path);
+      g_slice_free (SpillRecord, join->pending_copy);
+      join->pending_copy = NULL;
+    }
+
+  return success;
+}
+
+/* Set the modification times of the directories the given path is outside of. */
+static gboolean
+spill_close_directories (SpillJoin *join, const gchar *path, GError **error)
+{
+  SpillOpenDirectory *open_dir;
+  gboolean success;
+
+  while (join->open_dirs->len > 0)
+    {
+      open_dir = g_ptr_array_index (join->open_dirs, join->open_dirs->len - 1);
+      if (path != NULL && spill_path_is_inside (path, open_dir->path))
+        break;
+
+      success = !open_dir->modified
+                || spill_emit (join, RUDGIOSYNC_ACTION_TOUCH, RUDGIOSYNC_DIR_ENTRY_DIR, open_dir->announce,
+                               0, open_dir->modified_time, open_dir->path, NULL,
+                               error);
+
+      g_free (open_dir->path);
+      g_slice_free (SpillOpenDirectory, open_dir);
+      g_ptr_array_set_size (join->open_dirs, join->open_dirs->len - 1);
+
+      if (!success)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+spill_open_directory (SpillJoin *join, SpillRecord *source, gboolean announce, gboolean modified)
+{
+  SpillOpenDirectory *open_dir;
+
+  open_dir = g_slice_new (SpillOpenDirectory);
+  open_dir->path = g_strdup (source->path);
+  open_dir->modified_time = source->modified_time;
+  open_dir->announce = announce;
+  open_dir->modified = modified;
+
+  g_ptr_array_add (join->open_dirs, open_dir);
+}
+
+static gboolean
+spill_make_directory (SpillJoin *join, SpillRecord *record, GError **error)
+{
+  if (!spill_emit (join, RUDGIOSYNC_ACTION_MKDIR, RUDGIOSYNC_DIR_ENTRY_DIR, TRUE,
+                   0, record->modified_time, record->path, NULL,
+                   error))
+    return FALSE;
+
+  spill_open_directory (join, record, FALSE, TRUE);
+  return TRUE;
+}
+
+/**
+ * Handle a path present in both listings.  If the remaining destination
+ * entries below the path are to be left alone, or deleted, a skip is begun.
+ */
+static gboolean
+spill_sync_existing (SpillJoin *join, SpillRecord *dest_record, SpillRecord *src_record,
+                     GError **error)
+{
+  GFile *src_descriptor;
+  GFile *dest_descriptor;
+  gchar *src_uri;
+  gchar *dest_uri;
+
+
+  switch (src_record->type)
+    {
+      case RUDGIOSYNC_DIR_ENTRY_FILE:
+        if (dest_record->type == RUDGIOSYNC_DIR_ENTRY_DIR)
+          {
+            if (!join->delete_unwanted)
+              {
+                src_descriptor = spill_descriptor_for_path (join->source, src_record->path);
+                dest_descriptor = spill_descriptor_for_path (join->destination, dest_record->path);
+                src_uri = g_file_get_uri (src_descriptor);
+                dest_uri = g_file_get_uri (dest_descriptor);
+
+                g_set_error (error, RUDGIOSYNC_ERROR,
+                             RUDGIOSYNC_DIR_PROTECTION_ERROR,
+                             "Refusing to replace the directory `%s' with "
+                             "the file `%s': %s",
+                             dest_uri,
+                             src_uri,
+                             "Could cause major data loss if the request was not "
+                             "intentional, use the --delete argument to override "
+                             "this behavior");
+
+                g_free (dest_uri);
+                g_free (src_uri);
+                g_object_unref (src_descriptor);
+                g_object_unref (dest_descriptor);
+
+                return FALSE;
+              }
+
+            /* The copy has to wait until the directory's subtree is gone. */
+            join->pending_copy = g_slice_dup (SpillRecord, src_record);
+            join->pending_copy->path = g_strdup (src_record->path);
+
+            return spill_begin_skip (join, dest_record, TRUE, error);
+          }
+        if (dest_record->type != RUDGIOSYNC_DIR_ENTRY_FILE)
+          {
+            if (!spill_delete_record (join, dest_record, error))
+              return FALSE;
+
+            return spill_emit_copy (join, src_record, NULL, error);
+          }
+        else if (!spill_records_differ (dest_record, src_record, join->check_timestamp, join->checksum_only))
+          {
+            rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_SKIPPED, 1);
+            rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_SKIPPED, src_record->size);
+            spill_print_source (join->source, src_record->path, RUDGIOSYNC_VERBOSITY_VERBOSE, "Up to date: `%s'.\n");
+            return TRUE;
+          }
+
+        return spill_emit_copy (join, src_record, dest_record, error);
+
+      case RUDGIOSYNC_DIR_ENTRY_DIR:
+        if (dest_record->type != RUDGIOSYNC_DIR_ENTRY_DIR)
+          {
+            return spill_delete_record (join, dest_record, error)
+                   && spill_make_directory (join, src_record, error);
+          }
+
+        spill_open_directory (join, src_record,
+                              join->check_timestamp
+                              && dest_record->modified_time != src_record->modified_time,
+                              dest_record->modified_time != src_record->modified_time);
+        return TRUE;
+
+      default:
+        spill_print_source (join->source, src_record->path, RUDGIOSYNC_VERBOSITY_NORMAL, "Skipping non-regular file `%s'.\n");
+        return spill_begin_skip (join, dest_record, FALSE, error);
+    }
+}
+
+/* Handle a path which is only present in the source listing. */
+static gboolean
+spill_sync_new (SpillJoin *join, SpillRecord *src_record, GError **error)
+{
+  switch (src_record->type)
+    {
+      case RUDGIOSYNC_DIR_ENTRY_FILE:
+        return spill_emit_copy (join, src_record, NULL, error);
+
+      case RUDGIOSYNC_DIR_ENTRY_DIR:
+        return spill_make_directory (join, src_record, error);
+
+      default:
+        spill_print_source (join->source, src_record->path, RUDGIOSYNC_VERBOSITY_NORMAL, "Skipping non-regular file `%s'.\n");
+        return TRUE;
+    }
+}
+
+const gchar *
+rudgiosync_spill_list_get_display_name (RudgiosyncSpillList *list)
+{
+  return list->display_name;
+}
+
+gboolean
+rudgiosync_spill_plan (RudgiosyncSpillList *destination,
+                       RudgiosyncSpillList *source,
+                       gboolean check_timestamp,
+                       gboolean checksum_only,
+                       gboolean delete_unwanted,
+                       RudgiosyncActionFunc func,
+                       gpointer user_data,
+                       GError **error)
+{
+  SpillReader *src_reader;
+  SpillReader *dest_reader;
+  SpillRecord *src_record;
+  SpillRecord *dest_record;
+  SpillJoin    join;
+  gint         comparison;
+
+  GError *ierror = NULL;
+
+
+  g_assert (source->type == RUDGIOSYNC_DIR_ENTRY_DIR);
+
+  src_reader = spill_reader_new (source->run_paths, 0, source->run_paths->len, source->records, &ierror);
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+  dest_reader = spill_reader_new (destination->run_paths, 0, destination->run_paths->len, destination->records, &ierror);
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      spill_reader_free (src_reader);
+      return FALSE;
+    }
+
+  memset (&join, 0, sizeof (join));
+  join.destination     = destination;
+  join.source          = source;
+  join.check_timestamp = check_timestamp;
+  join.checksum_only   = checksum_only;
+  join.delete_unwanted = delete_unwanted;
+  join.func            = func;
+  join.user_data       = user_data;
+  join.open_dirs       = g_ptr_array_new ();
+  join.doomed_dirs     = g_ptr_array_new_with_free_func (g_free);
+  join.leftovers       = g_ptr_array_new_with_free_func ((GDestroyNotify) spill_free_leftover);
+  if (delete_unwanted)
+    join.resumed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  while (ierror == NULL)
+    {
+      src_record = spill_reader_peek (src_reader);
+      dest_record = spill_reader_peek (dest_reader);
+
+      if (join.skip_prefix != NULL)
+        {
+          if (dest_record != NULL && spill_path_is_inside (dest_record->path, join.skip_prefix))
+            {
+              if (join.skip_deleting
+                  && spill_release_doomed (&join, dest_record->path, &ierror))
+                spill_delete_record (&join, dest_record, &ierror);
+              if (ierror == NULL)
+                spill_reader_advance (dest_reader, &ierror);
+              continue;
+            }
+          if (!spill_end_skip (&join, &ierror))
+            break;
+        }
+
+      if (src_record == NULL && dest_record == NULL)
+        break;
+      else if (src_record != NULL && dest_record != NULL)
+        comparison = spill_path_compare (src_record->path, dest_record->path);
+      else
+        comparison = (src_record != NULL) ? -1 : 1;
+
+      if (!spill_release_leftovers (&join,
+                                    (comparison <= 0) ? src_record->path : dest_record->path,
+                                    &ierror)
+          || !spill_close_directories (&join,
+                                       (comparison <= 0) ? src_record->path : dest_record->path,
+                                       &ierror))
+        break;
+
+      if (comparison == 0)
+        {
+          spill_sync_existing (&join, dest_record, src_record, &ierror);
+          if (ierror == NULL)
+            spill_reader_advance (src_reader, &ierror);
+          if (ierror == NULL)
+            spill_reader_advance (dest_reader, &ierror);
+        }
+      else if (comparison < 0)
+        {
+          spill_sync_new (&join, src_record, &ierror);
+          if (ierror == NULL)
+            spill_reader_advance (src_reader, &ierror);
+        }
+      else
+        {
+          /* Entries only present in the destination are deleted along with
+           * their subtrees, or left alone altogether.  The leftovers of
+           * interrupted copies are held back until it's known whether their
+           * copy is resumed. */
+          if (delete_unwanted && dest_record->type == RUDGIOSYNC_DIR_ENTRY_FILE
+              && spill_is_leftover (dest_record->path))
+            spill_hold_leftover (&join, dest_record);
+          else
+            spill_begin_skip (&join, dest_record, delete_unwanted, &ierror);
+          if (ierror == NULL)
+            spill_reader_advance (dest_reader, &ierror);
+        }
+    }
+
+  if (ierror == NULL && spill_release_leftovers (&join, NULL, &ierror))
+    spill_close_directories (&join, NULL, &ierror);
+
+  g_free (join.skip_prefix);
+  if (join.pending_copy != NULL)
+    {
+      g_free ((gchar *)join.pending_copy->path);
+      g_slice_free (SpillRecord, join.pending_copy);
+    }
+  while (join.open_dirs->len > 0)
+    {
+      g_free (((SpillOpenDirectory *)g_ptr_array_index (join.open_dirs, join.open_dirs->len - 1))->path);
+      g_slice_free (SpillOpenDirectory, g_ptr_array_index (join.open_dirs, join.open_dirs->len - 1));
+      g_ptr_array_set_size (join.open_dirs, join.open_dirs->len - 1);
+    }
+  g_ptr_array_free (join.open_dirs, TRUE);
+  g_ptr_array_free (join.doomed_dirs, TRUE);
+  g_ptr_array_free (join.leftovers, TRUE);
+  if (join.resumed != NULL)
+    g_hash_table_destroy (join.resumed);
+  spill_reader_free (src_reader);
+  spill_reader_free (dest_reader);
+
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+
+  return TRUE;
+}
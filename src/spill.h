@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Bounded-memory directory listings.
+ *
+ * Instead of building a tree, the listing of a location is written out as
+ * sorted runs of path-keyed records whenever the memory limit is reached.
+ * Two listings are then synchronized with a merge-join of their runs, so the
+ * memory used stays flat regardless of the size of the trees.
+ */
+
+#ifndef _RUDGIOSYNC_SPILL_H_
+#define _RUDGIOSYNC_SPILL_H_
+
+#include "boiler.h"
+#include "checksum.h"
+#include "plan.h"
+
+
+typedef struct RudgiosyncSpillList_ RudgiosyncSpillList;
+
+
+/* Examine the given location, spilling to disk beyond the memory limit. */
+RudgiosyncSpillList *rudgiosync_spill_list_new (GFile *descriptor,
+                                                gboolean checksum_wanted,
+                                                gsize memory_limit,
+                                                GError **error);
+
+/* Release a listing, deleting its run files. */
+void rudgiosync_spill_list_free (RudgiosyncSpillList *list);
+
+/* Return the display name of the examined location. */
+const gchar *rudgiosync_spill_list_get_display_name (RudgiosyncSpillList *list);
+
+/**
+ * Compare two directory listings, passing the actions which would make the
+ * destination match the source to the given function, in the same manner
+ * as rudgiosync_plan_trees.
+ */
+gboolean rudgiosync_spill_plan (RudgiosyncSpillList *destination,
+                                RudgiosyncSpillList *source,
+                                gboolean check_timestamp,
+                                gboolean checksum_only,
+                                gboolean delete_unwanted,
+                                RudgiosyncActionFunc func,
+                                gpointer user_data,
+                                GError **error);
+
+
+#endif /* _RUDGIOSYNC_SPILL_H_ */
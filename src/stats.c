@@ -0,0 +1,201 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "stats.h"
+#include "throttle.h"
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+
+static const gchar *phase_names[] =
+{
+  "scan",       /* RUDGIOSYNC_PHASE_SCAN */
+  "checksum",   /* RUDGIOSYNC_PHASE_CHECKSUM */
+  "compare",    /* RUDGIOSYNC_PHASE_COMPARE */
+  "delete",     /* RUDGIOSYNC_PHASE_DELETE */
+  "mkdir",      /* RUDGIOSYNC_PHASE_MKDIR */
+  "copy",       /* RUDGIOSYNC_PHASE_COPY */
+  "mtime"       /* RUDGIOSYNC_PHASE_MTIME */
+};
+
+typedef struct
+{
+  gint64 wall;
+  gint64 cpu;
+  guint  spans;
+} StatsPhase;
+
+static gboolean   stats_enabled = FALSE;
+static GMutex     stats_lock;
+static StatsPhase stats_phases[RUDGIOSYNC_PHASE_COUNT];
+static guint64    stats_counters[RUDGIOSYNC_STAT_COUNT];
+static gsize      stats_memory = 0;
+static gsize      stats_memory_peak = 0;
+static RudgiosyncStatsTimer stats_started;
+
+
+/* CPU time used by the whole process so far, in microseconds. */
+static gint64
+stats_cpu_time (void)
+{
+#if HAVE_GETRUSAGE
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+
+  return 0;
+}
+
+void
+rudgiosync_stats_enable (void)
+{
+  stats_enabled = TRUE;
+  rudgiosync_stats_start (&stats_started);
+}
+
+gboolean
+rudgiosync_stats_enabled (void)
+{
+  return stats_enabled;
+}
+
+void
+rudgiosync_stats_start (RudgiosyncStatsTimer *timer)
+{
+  if (!stats_enabled)
+    return;
+
+  timer->wall = g_get_monotonic_time ();
+  timer->cpu = stats_cpu_time ();
+}
+
+void
+rudgiosync_stats_stop (RudgiosyncStatsTimer *timer, guint phase)
+{
+  gint64 wall;
+  gint64 cpu;
+
+  if (!stats_enabled)
+    return;
+
+  wall = g_get_monotonic_time () - timer->wall;
+  cpu = stats_cpu_time () - timer->cpu;
+
+  g_mutex_lock (&stats_lock);
+  stats_phases[phase].wall += wall;
+  stats_phases[phase].cpu += cpu;
+  stats_phases[phase].spans++;
+  g_mutex_unlock (&stats_lock);
+}
+
+void
+rudgiosync_stats_add (guint counter, guint64 amount)
+{
+  if (!stats_enabled)
+    return;
+
+  g_mutex_lock (&stats_lock);
+  stats_counters[counter] += amount;
+  g_mutex_unlock (&stats_lock);
+}
+
+void
+rudgiosync_stats_memory (gssize change)
+{
+  if (!stats_enabled)
+    return;
+
+  g_mutex_lock (&stats_lock);
+  stats_memory += change;
+  stats_memory_peak = MAX (stats_memory_peak, stats_memory);
+  g_mutex_unlock (&stats_lock);
+}
+
+
+/* Print a count of things, with the bytes they amount to. */
+static void
+stats_print_amount (const gchar *label, guint files, guint bytes)
+{
+  gchar *size;
+
+  size = g_format_size (stats_counters[bytes]);
+  g_print ("  %-22s %" G_GUINT64_FORMAT " (%s)\n", label, stats_counters[files], size);
+  g_free (size);
+}
+
+void
+rudgiosync_stats_report (void)
+{
+  StatsPhase *phase;
+  gdouble     seconds;
+  gchar      *text;
+  guint       iter;
+
+  if (!stats_enabled)
+    return;
+
+  g_print ("\nRun statistics:\n");
+  /* The CPU time is the whole process's, overlapping phases share it. */
+  g_print ("  %-22s %10s %12s\n", "Phase", "Wall", "Process CPU");
+  for (iter = 0; iter < RUDGIOSYNC_PHASE_COUNT; iter++)
+    {
+      phase = &(stats_phases[iter]);
+      if (phase->spans > 0)
+        g_print ("  %-22s %9.3fs %11.3fs\n", phase_names[iter],
+                 (gdouble)phase->wall / G_USEC_PER_SEC, (gdouble)phase->cpu / G_USEC_PER_SEC);
+    }
+  g_print ("  %-22s %9.3fs %11.3fs\n", "total",
+           (gdouble)(g_get_monotonic_time () - stats_started.wall) / G_USEC_PER_SEC,
+           (gdouble)(stats_cpu_time () - stats_started.cpu) / G_USEC_PER_SEC);
+
+  g_print ("\n");
+  stats_print_amount ("Entries examined:", RUDGIOSYNC_STAT_ENTRIES_SCANNED, RUDGIOSYNC_STAT_BYTES_SCANNED);
+  stats_print_amount ("Files hashed:", RUDGIOSYNC_STAT_FILES_HASHED, RUDGIOSYNC_STAT_BYTES_HASHED);
+  stats_print_amount ("Files up to date:", RUDGIOSYNC_STAT_FILES_SKIPPED, RUDGIOSYNC_STAT_BYTES_SKIPPED);
+  stats_print_amount ("Files copied:", RUDGIOSYNC_STAT_FILES_COPIED, RUDGIOSYNC_STAT_BYTES_COPIED);
+  g_print ("  %-22s %" G_GUINT64_FORMAT "\n", "Directories created:", stats_counters[RUDGIOSYNC_STAT_DIRECTORIES_MADE]);
+  stats_print_amount ("Entries deleted:", RUDGIOSYNC_STAT_ENTRIES_DELETED, RUDGIOSYNC_STAT_BYTES_DELETED);
+  if (stats_counters[RUDGIOSYNC_STAT_FILES_RESUMED] > 0)
+    stats_print_amount ("Files resumed:", RUDGIOSYNC_STAT_FILES_RESUMED, RUDGIOSYNC_STAT_BYTES_RESUMED);
+  if (stats_counters[RUDGIOSYNC_STAT_FILES_VERIFIED] > 0)
+    stats_print_amount ("Files verified:", RUDGIOSYNC_STAT_FILES_VERIFIED, RUDGIOSYNC_STAT_BYTES_VERIFIED);
+  if (stats_counters[RUDGIOSYNC_STAT_FILES_RECOPIED] > 0)
+    g_print ("  %-22s %" G_GUINT64_FORMAT "\n", "Files copied again:", stats_counters[RUDGIOSYNC_STAT_FILES_RECOPIED]);
+  if (stats_counters[RUDGIOSYNC_STAT_ROUND_TRIPS] > 0)
+    g_print ("  %-22s %" G_GUINT64_FORMAT "\n", "Emulated round trips:", stats_counters[RUDGIOSYNC_STAT_ROUND_TRIPS]);
+
+  /* Rates are over the time spent copying, rather than the whole run. */
+  seconds = (gdouble)stats_phases[RUDGIOSYNC_PHASE_COPY].wall / G_USEC_PER_SEC;
+  if (seconds > 0)
+    {
+      text = g_format_size ((guint64)(stats_counters[RUDGIOSYNC_STAT_BYTES_COPIED] / seconds));
+      g_print ("  %-22s %s/s, %.1f files/s\n", "Copy rate:", text,
+               stats_counters[RUDGIOSYNC_STAT_FILES_COPIED] / seconds);
+      g_free (text);
+    }
+
+  text = g_format_size (stats_memory_peak);
+  g_print ("  %-22s %s\n", "Peak listing memory:", text);
+  g_free (text);
+
+  rudgiosync_throttle_report ();
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Run statistics.
+ *
+ * The time spent in each phase of a run is measured, both on the clock and
+ * as CPU time of the whole process meanwhile, along with counts of what was
+ * done.  Phases may overlap, as checksums are computed while scanning, and
+ * deletions may run alongside the copies.  The CPU time spent while they do
+ * is counted in each of them, so the times needn't add up.
+ *
+ * Nothing is measured unless enabled.  Counters may be added to from any
+ * thread.
+ */
+
+#ifndef _RUDGIOSYNC_STATS_H_
+#define _RUDGIOSYNC_STATS_H_
+
+#include "boiler.h"
+
+
+enum
+{
+  RUDGIOSYNC_PHASE_SCAN,
+  RUDGIOSYNC_PHASE_CHECKSUM,
+  RUDGIOSYNC_PHASE_COMPARE,
+  RUDGIOSYNC_PHASE_DELETE,
+  RUDGIOSYNC_PHASE_MKDIR,
+  RUDGIOSYNC_PHASE_COPY,
+  RUDGIOSYNC_PHASE_MTIME,
+  RUDGIOSYNC_PHASE_COUNT
+};
+
+enum
+{
+  RUDGIOSYNC_STAT_ENTRIES_SCANNED,
+  RUDGIOSYNC_STAT_BYTES_SCANNED,      /* Sizes of the files scanned. */
+  RUDGIOSYNC_STAT_FILES_HASHED,
+  RUDGIOSYNC_STAT_BYTES_HASHED,
+  RUDGIOSYNC_STAT_FILES_SKIPPED,      /* Already up to date. */
+  RUDGIOSYNC_STAT_BYTES_SKIPPED,
+  RUDGIOSYNC_STAT_FILES_COPIED,
+  RUDGIOSYNC_STAT_BYTES_COPIED,
+  RUDGIOSYNC_STAT_DIRECTORIES_MADE,
+  RUDGIOSYNC_STAT_ENTRIES_DELETED,
+  RUDGIOSYNC_STAT_BYTES_DELETED,      /* Sizes of the files deleted. */
+  RUDGIOSYNC_STAT_FILES_RESUMED,
+  RUDGIOSYNC_STAT_BYTES_RESUMED,      /* Kept from interrupted copies. */
+  RUDGIOSYNC_STAT_FILES_VERIFIED,
+  RUDGIOSYNC_STAT_BYTES_VERIFIED,
+  RUDGIOSYNC_STAT_FILES_RECOPIED,     /* Which didn't read back as written. */
+  RUDGIOSYNC_STAT_ROUND_TRIPS,        /* Paid for by an emulated backend. */
+  RUDGIOSYNC_STAT_COUNT
+};
+
+/* The start of a timed span, usually kept on the stack. */
+typedef struct
+{
+  gint64 wall;
+  gint64 cpu;
+} RudgiosyncStatsTimer;
+
+
+/* Start collecting statistics. */
+void rudgiosync_stats_enable (void);
+
+gboolean rudgiosync_stats_enabled (void);
+
+void rudgiosync_stats_start (RudgiosyncStatsTimer *timer);
+
+/* Account the time since the timer was started to the given phase. */
+void rudgiosync_stats_stop (RudgiosyncStatsTimer *timer, guint phase);
+
+void rudgiosync_stats_add (guint counter, guint64 amount);
+
+/* Note memory being taken up, or given back, by listings and plans. */
+void rudgiosync_stats_memory (gssize change);
+
+/* Print what was collected. */
+void rudgiosync_stats_report (void);
+
+
+#endif /* _RUDGIOSYNC_STATS_H_ */
@@ -0,0 +1,297 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "throttle.h"
+
+#include <string.h>
+
+#define THROTTLE_EPOCH_MIN   ((gint64)(250 * 1000))   /* 250 ms */
+#define THROTTLE_EPOCH_MAX   ((gint64)(2000 * 1000))  /* 2 s */
+#define THROTTLE_GAIN        1.05   /* Throughput growth worth growing for. */
+#define THROTTLE_LOSS        0.90   /* Throughput loss worth backing off on. */
+#define THROTTLE_LATENCY_MAX 4.0    /* Latency growth worth backing off on. */
+
+
+struct RudgiosyncThrottle_
+{
+  gchar   *name;
+  guint    ceiling;
+
+  GMutex   lock;
+  GCond    available;
+  guint    limit;
+  guint    in_flight;
+  gboolean slow_start;        /* Doubling, until the first setback. */
+  gboolean used;
+
+  /* The current epoch. */
+  gint64   epoch_start;
+  guint64  epoch_units;
+  guint    epoch_ops;
+  gint64   epoch_latency;
+
+  /* What the previous epoch achieved. */
+  gdouble  last_rate;
+  gdouble  min_latency;       /* Per operation, over the whole run. */
+};
+
+static GMutex      registry_lock;
+static GHashTable *registry = NULL;
+static GPtrArray  *registry_order = NULL;
+
+
+/**
+ * Find where the filesystem of a local file is mounted, by walking up for
+ * as long as the filesystem stays the same.  The file itself need not exist.
+ */
+static gchar *
+throttle_mount_point (GFile *descriptor)
+{
+  GFileInfo   *info;
+  GFile       *current;
+  GFile       *parent;
+  GFile       *top = NULL;
+  gchar       *filesystem = NULL;
+  gchar       *retval;
+  const gchar *attribute;
+
+  current = g_object_ref (descriptor);
+  while (current != NULL)
+    {
+      info = g_file_query_info (current, G_FILE_ATTRIBUTE_ID_FILESYSTEM,
+                                G_FILE_QUERY_INFO_NONE, NULL, NULL);
+      attribute = (info != NULL) ? g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILESYSTEM) : NULL;
+      if (attribute != NULL)
+        {
+          if (filesystem == NULL)
+            filesystem = g_strdup (attribute);
+          else if (strcmp (filesystem, attribute) != 0)
+            attribute = NULL;
+
+          if (attribute != NULL)
+            {
+              if (top != NULL)
+                g_object_unref (top);
+              top = g_object_ref (current);
+            }
+        }
+      if (info != NULL)
+        g_object_unref (info);
+
+      /* Crossed into another filesystem. */
+      if (filesystem != NULL && attribute == NULL)
+        break;
+
+      parent = g_file_get_parent (current);
+      g_object_unref (current);
+      current = parent;
+    }
+  if (current != NULL)
+    g_object_unref (current);
+
+  retval = (top != NULL) ? g_file_get_path (top) : NULL;
+  if (top != NULL)
+    g_object_unref (top);
+  g_free (filesystem);
+
+  return retval;
+}
+
+gchar *
+rudgiosync_backend_name (GFile *descriptor)
+{
+  GMount      *mount;
+  GFile       *mount_root;
+  gchar       *scheme;
+  gchar       *uri;
+  gchar       *retval;
+  gchar       *mount_point;
+  const gchar *authority_end;
+
+  if (g_file_is_native (descriptor))
+    {
+      mount_point = throttle_mount_point (descriptor);
+      retval = g_strdup_printf ("local %s", mount_point != NULL ? mount_point : "filesystem");
+      g_free (mount_point);
+
+      return retval;
+    }
+
+  scheme = g_file_get_uri_scheme (descriptor);
+
+  mount = g_file_find_enclosing_mount (descriptor, NULL, NULL);
+  if (mount != NULL)
+    {
+      mount_root = g_mount_get_root (mount);
+      retval = g_file_get_uri (mount_root);
+      g_object_unref (mount_root);
+      g_object_unref (mount);
+      g_free (scheme);
+
+      return retval;
+    }
+
+  /* Fall back to the scheme and authority parts of the URI. */
+  uri = g_file_get_uri (descriptor);
+  authority_end = strstr (uri, "://");
+  if (authority_end != NULL)
+    authority_end = strchr (authority_end + 3, '/');
+  retval = (authority_end != NULL) ? g_strndup (uri, authority_end - uri) : g_strdup (scheme);
+  g_free (uri);
+  g_free (scheme);
+
+  return retval;
+}
+
+RudgiosyncThrottle *
+rudgiosync_throttle_get (const gchar *backend, const gchar *operation, guint ceiling)
+{
+  RudgiosyncThrottle *retval;
+  gchar *name;
+
+  name = g_strdup_printf ("%s (%s)", operation, backend);
+
+  g_mutex_lock (&registry_lock);
+  if (registry == NULL)
+    {
+      registry = g_hash_table_new (g_str_hash, g_str_equal);
+      registry_order = g_ptr_array_new ();
+    }
+
+  retval = g_hash_table_lookup (registry, name);
+  if (retval == NULL)
+    {
+      retval = g_new0 (RudgiosyncThrottle, 1);
+      retval->name = name;
+      retval->ceiling = MAX (ceiling, 1);
+      retval->limit = 1;
+      retval->slow_start = TRUE;
+      g_mutex_init (&(retval->lock));
+      g_cond_init (&(retval->available));
+
+      g_hash_table_insert (registry, retval->name, retval);
+      g_ptr_array_add (registry_order, retval);
+    }
+  else
+    {
+      g_free (name);
+    }
+  g_mutex_unlock (&registry_lock);
+
+  return retval;
+}
+
+void
+rudgiosync_throttle_acquire (RudgiosyncThrottle *throttle)
+{
+  g_mutex_lock (&(throttle->lock));
+  while (throttle->in_flight >= throttle->limit)
+    g_cond_wait (&(throttle->available), &(throttle->lock));
+
+  throttle->in_flight++;
+  throttle->used = TRUE;
+  if (throttle->epoch_start == 0)
+    throttle->epoch_start = g_get_monotonic_time ();
+  g_mutex_unlock (&(throttle->lock));
+}
+
+/* Adjust the limit at the end of an epoch, the lock is held. */
+static void
+throttle_adjust (RudgiosyncThrottle *throttle, gint64 now)
+{
+  gdouble rate;
+  gdouble latency;
+  guint   limit = throttle->limit;
+
+  rate = (gdouble)throttle->epoch_units * G_USEC_PER_SEC / (gdouble)(now - throttle->epoch_start);
+  latency = (gdouble)throttle->epoch_latency / throttle->epoch_ops;
+
+  if (throttle->min_latency == 0.0 || latency < throttle->min_latency)
+    throttle->min_latency = latency;
+
+  if (throttle->last_rate > 0.0
+      && (rate < throttle->last_rate * THROTTLE_LOSS
+          || latency > throttle->min_latency * THROTTLE_LATENCY_MAX))
+    {
+      limit = MAX (limit / 2, 1);
+      throttle->slow_start = FALSE;
+    }
+  else if (throttle->last_rate == 0.0 || rate >= throttle->last_rate * THROTTLE_GAIN)
+    {
+      limit = throttle->slow_start ? limit * 2 : limit + 1;
+    }
+  else
+    {
+      /* No better, no worse: stop doubling, and hold. */
+      throttle->slow_start = FALSE;
+    }
+
+  throttle->limit = MIN (limit, throttle->ceiling);
+  throttle->last_rate = rate;
+
+  throttle->epoch_start = now;
+  throttle->epoch_units = 0;
+  throttle->epoch_ops = 0;
+  throttle->epoch_latency = 0;
+}
+
+void
+rudgiosync_throttle_release (RudgiosyncThrottle *throttle, guint64 units, gint64 started)
+{
+  gint64 now;
+
+  g_mutex_lock (&(throttle->lock));
+  throttle->in_flight--;
+
+  if (started != 0)
+    {
+      now = g_get_monotonic_time ();
+
+      throttle->epoch_units += units;
+      throttle->epoch_ops++;
+      throttle->epoch_latency += now - started;
+
+      /* An epoch lets every slot finish at least once, within reason. */
+      if ((throttle->epoch_ops >= throttle->limit && now - throttle->epoch_start >= THROTTLE_EPOCH_MIN)
+          || now - throttle->epoch_start >= THROTTLE_EPOCH_MAX)
+        throttle_adjust (throttle, now);
+    }
+
+  g_cond_broadcast (&(throttle->available));
+  g_mutex_unlock (&(throttle->lock));
+}
+
+void
+rudgiosync_throttle_report (void)
+{
+  RudgiosyncThrottle *throttle;
+  const gchar *label = "Settled concurrency:";
+  guint iter;
+
+  if (registry_order == NULL)
+    return;
+
+  for (iter = 0; iter < registry_order->len; iter++)
+    {
+      throttle = g_ptr_array_index (registry_order, iter);
+      if (throttle->used)
+        {
+          g_print ("  %-22s %u %s\n", label, throttle->limit, throttle->name);
+          label = "";
+        }
+    }
+}
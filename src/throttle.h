@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Adaptive concurrency limits.
+ *
+ * A throttle bounds the number of operations of one kind in flight against
+ * one backend.  The bound is tuned while running, by measuring throughput
+ * over short epochs: it grows while that helps, and is cut back sharply when
+ * throughput drops or latency balloons, in the manner of TCP's congestion
+ * control (additive increase, multiplicative decrease).
+ */
+
+#ifndef _RUDGIOSYNC_THROTTLE_H_
+#define _RUDGIOSYNC_THROTTLE_H_
+
+#include "boiler.h"
+
+
+typedef struct RudgiosyncThrottle_ RudgiosyncThrottle;
+
+
+/**
+ * Name the backend a location lives on, by its mount, or by where the
+ * filesystem is mounted for local files.
+ */
+gchar *rudgiosync_backend_name (GFile *descriptor);
+
+/**
+ * Return the throttle for the given backend and kind of operation, creating
+ * it on first use.  Throttles live until the program exits.
+ */
+RudgiosyncThrottle *rudgiosync_throttle_get (const gchar *backend,
+                                             const gchar *operation,
+                                             guint ceiling);
+
+/* Wait until another operation may be started. */
+void rudgiosync_throttle_acquire (RudgiosyncThrottle *throttle);
+
+/**
+ * Report an operation started at the given monotonic time as finished, having
+ * done the given units of work.  An operation which didn't happen after all
+ * is reported with a start time of zero, and isn't measured.
+ */
+void rudgiosync_throttle_release (RudgiosyncThrottle *throttle,
+                                  guint64 units,
+                                  gint64 started);
+
+/* Print the limits the throttles which were used have settled on, as part
+ * of the run statistics. */
+void rudgiosync_throttle_report (void);
+
+
+#endif /* _RUDGIOSYNC_THROTTLE_H_ */
@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "trace.h"
+
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+
+#define TRACE_FLUSH_INTERVAL ((gint64)G_USEC_PER_SEC)  /* 1 s */
+
+static const gchar *trace_names[] =
+{
+  "enumerate",          /* RUDGIOSYNC_TRACE_ENUMERATE */
+  "query_info",         /* RUDGIOSYNC_TRACE_QUERY_INFO */
+  "open",               /* RUDGIOSYNC_TRACE_OPEN */
+  "read",               /* RUDGIOSYNC_TRACE_READ */
+  "write",              /* RUDGIOSYNC_TRACE_WRITE */
+  "close",              /* RUDGIOSYNC_TRACE_CLOSE */
+  "set_attributes",     /* RUDGIOSYNC_TRACE_SET_ATTRIBUTES */
+  "delete",             /* RUDGIOSYNC_TRACE_DELETE */
+  "mkdir"               /* RUDGIOSYNC_TRACE_MKDIR */
+};
+
+static FILE     *trace_stream = NULL;
+static gchar    *trace_filename = NULL;
+static GMutex    trace_lock;
+static gint64    trace_origin;
+static gint64    trace_flushed;
+static gint      trace_threads = 0;
+static GPrivate  trace_thread_id;
+
+
+/* A small number standing for the calling thread, stable for its lifetime. */
+static guint
+trace_thread (void)
+{
+  guint id;
+
+  id = GPOINTER_TO_UINT (g_private_get (&trace_thread_id));
+  if (id == 0)
+    {
+      id = (guint) g_atomic_int_add (&trace_threads, 1) + 1;
+      g_private_set (&trace_thread_id, GUINT_TO_POINTER (id));
+    }
+
+  return id;
+}
+
+/* Write a string as the contents of a JSON string. */
+static void
+trace_write_escaped (const gchar *string)
+{
+  for (; *string != '\0'; string++)
+    {
+      if (*string == '"' || *string == '\\')
+        fprintf (trace_stream, "\\%c", *string);
+      else if ((guchar) *string < 0x20)
+        fprintf (trace_stream, "\\u%04x", (guint)(guchar) *string);
+      else
+        fputc (*string, trace_stream);
+    }
+}
+
+gboolean
+rudgiosync_trace_open (const gchar *filename, GError **error)
+{
+  gint errsv;
+
+  trace_stream = fopen (filename, "w");
+  if (trace_stream == NULL)
+    {
+      errsv = errno;
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Failed to create the trace file `%s': %s",
+                   filename, g_strerror (errsv));
+      return FALSE;
+    }
+
+  /**
+   * The closing bracket of the array is optional in this format, and is left
+   * out, so the trace of an interrupted run loads just the same.
+   */
+  trace_origin = g_get_monotonic_time ();
+  trace_flushed = trace_origin;
+  trace_filename = g_strdup (filename);
+  fprintf (trace_stream, "[\n");
+
+  return TRUE;
+}
+
+gboolean
+rudgiosync_trace_close (GError **error)
+{
+  gboolean failed;
+  gint     errsv;
+
+  if (trace_stream == NULL)
+    return TRUE;
+
+  /* An earlier write may have failed without a trace of why. */
+  g_mutex_lock (&trace_lock);
+  errno = 0;
+  failed = fflush (trace_stream) != 0 || ferror (trace_stream);
+  errsv = (errno != 0) ? errno : EIO;
+  if (fclose (trace_stream) != 0 && !failed)
+    {
+      failed = TRUE;
+      errsv = errno;
+    }
+  trace_stream = NULL;
+  g_mutex_unlock (&trace_lock);
+
+  if (failed)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+                   "Failed to write the trace file `%s': %s",
+                   trace_filename, g_strerror (errsv));
+    }
+  g_free (trace_filename);
+  trace_filename = NULL;
+
+  return !failed;
+}
+
+void
+rudgiosync_trace_begin (RudgiosyncTraceSpan *span)
+{
+  if (trace_stream == NULL)
+    return;
+
+  span->start = g_get_monotonic_time ();
+}
+
+/* Write out an event, for an operation on the file of the given URI, if any. */
+static void
+trace_record (RudgiosyncTraceSpan *span, guint operation, const gchar *uri, gint64 bytes)
+{
+  gint64  now;
+  guint   thread;
+
+  now = g_get_monotonic_time ();
+  thread = trace_thread ();
+
+  g_mutex_lock (&trace_lock);
+  if (trace_stream == NULL)
+    {
+      g_mutex_unlock (&trace_lock);
+      return;
+    }
+  fprintf (trace_stream,
+           "{\"name\":\"%s\",\"cat\":\"io\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+           "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"args\":{",
+           trace_names[operation], thread,
+           span->start - trace_origin, now - span->start);
+  if (uri != NULL)
+    {
+      fprintf (trace_stream, "\"uri\":\"");
+      trace_write_escaped (uri);
+      fprintf (trace_stream, (bytes >= 0) ? "\"," : "\"");
+    }
+  if (bytes >= 0)
+    fprintf (trace_stream, "\"bytes\":%" G_GINT64_FORMAT, bytes);
+  fprintf (trace_stream, "}},\n");
+
+  /* What was recorded survives a crash, within a second. */
+  if (now - trace_flushed >= TRACE_FLUSH_INTERVAL)
+    {
+      fflush (trace_stream);
+      trace_flushed = now;
+    }
+  g_mutex_unlock (&trace_lock);
+}
+
+void
+rudgiosync_trace_end (RudgiosyncTraceSpan *span, guint operation, GFile *file, gint64 bytes)
+{
+  gchar *uri;
+
+  if (trace_stream == NULL)
+    return;
+
+  uri = (file != NULL) ? g_file_get_uri (file) : NULL;
+  trace_record (span, operation, uri, bytes);
+  g_free (uri);
+}
+
+void
+rudgiosync_trace_end_path (RudgiosyncTraceSpan *span, guint operation, const gchar *path, gint64 bytes)
+{
+  gchar *uri;
+
+  if (trace_stream == NULL)
+    return;
+
+  uri = g_filename_to_uri (path, NULL, NULL);
+  trace_record (span, operation, uri, bytes);
+  g_free (uri);
+}
+
+#endif /* RUDGIOSYNC_TRACE_ENABLED */
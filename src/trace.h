@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Operation tracing.
+ *
+ * Every backend operation can be recorded, with when it started and how long
+ * it took, to a file in the Chrome trace event format, which Perfetto and
+ * chrome://tracing load, to find out where a slow backend spends its time.
+ *
+ * Events are written as they complete, from any thread, and flushed to the
+ * file every second or so.  Tracing can be left out at compile time, and the
+ * calls then cost nothing.
+ */
+
+#ifndef _RUDGIOSYNC_TRACE_H_
+#define _RUDGIOSYNC_TRACE_H_
+
+#include "boiler.h"
+
+
+enum
+{
+  RUDGIOSYNC_TRACE_ENUMERATE,
+  RUDGIOSYNC_TRACE_QUERY_INFO,
+  RUDGIOSYNC_TRACE_OPEN,
+  RUDGIOSYNC_TRACE_READ,
+  RUDGIOSYNC_TRACE_WRITE,
+  RUDGIOSYNC_TRACE_CLOSE,
+  RUDGIOSYNC_TRACE_SET_ATTRIBUTES,
+  RUDGIOSYNC_TRACE_DELETE,
+  RUDGIOSYNC_TRACE_MKDIR
+};
+
+/* The start of a traced operation. */
+typedef struct
+{
+  gint64 start;
+} RudgiosyncTraceSpan;
+
+
+#ifdef RUDGIOSYNC_TRACE_ENABLED
+
+/* Start recording operations to the given file, replacing it. */
+gboolean rudgiosync_trace_open (const gchar *filename,
+                                GError **error);
+
+/**
+ * Finish recording, reporting whether everything recorded made it to the
+ * file.  Does nothing unless recording.
+ */
+gboolean rudgiosync_trace_close (GError **error);
+
+void rudgiosync_trace_begin (RudgiosyncTraceSpan *span);
+
+/**
+ * Record an operation, begun with the span, on a file.  The amount of bytes
+ * is given for reads and writes, and is negative otherwise.
+ */
+void rudgiosync_trace_end (RudgiosyncTraceSpan *span,
+                           guint operation,
+                           GFile *file,
+                           gint64 bytes);
+
+/* Record an operation on a local file, given by its path. */
+void rudgiosync_trace_end_path (RudgiosyncTraceSpan *span,
+                                guint operation,
+                                const gchar *path,
+                                gint64 bytes);
+
+#else /* !RUDGIOSYNC_TRACE_ENABLED */
+
+#define rudgiosync_trace_begin(span) ((void)(span))
+#define rudgiosync_trace_end(span, operation, file, bytes) ((void)(span))
+#define rudgiosync_trace_end_path(span, operation, path, bytes) ((void)(span))
+
+#endif /* !RUDGIOSYNC_TRACE_ENABLED */
+
+#endif /* _RUDGIOSYNC_TRACE_H_ */
@@ -0,0 +1,430 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "uring.h"
+#include "buffers.h"
+
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+
+#include <liburing.h>
+
+#define URING_DEPTH      32                          /* Operations in flight. */
+#define URING_CHUNK_SIZE ((gsize)(256 * 1024))       /* 256 KiB per buffer. */
+
+
+struct RudgiosyncUring_
+{
+  struct io_uring ring;
+  struct iovec    buffers[URING_DEPTH];   /* Registered with the ring. */
+  gchar          *storage;                /* Backing all of the buffers. */
+  guint           queued;                 /* Submitted, not yet completed. */
+};
+
+/* A copy of a chunk, read into and written from one of the buffers. */
+typedef struct
+{
+  guint    index;
+  guint64  offset;
+  gsize    wanted;    /* Bytes asked for by the last read. */
+  gsize    length;    /* Bytes in the buffer. */
+  gsize    written;
+  gboolean writing;
+} UringCopySlot;
+
+enum
+{
+  URING_HASH_IDLE,
+  URING_HASH_OPENING,
+  URING_HASH_READING,
+  URING_HASH_CLOSING
+};
+
+
+static const int uring_operations[] =
+{
+  IORING_OP_READ_FIXED,
+  IORING_OP_WRITE_FIXED,
+  IORING_OP_OPENAT,
+  IORING_OP_CLOSE
+};
+
+static gboolean
+uring_supported (RudgiosyncUring *uring)
+{
+  struct io_uring_probe *probe;
+  gboolean               retval = TRUE;
+  guint                  iter;
+
+  probe = io_uring_get_probe_ring (&(uring->ring));
+  if (probe == NULL)
+    return FALSE;
+
+  for (iter = 0; iter < G_N_ELEMENTS (uring_operations) && retval; iter++)
+    retval = io_uring_opcode_supported (probe, uring_operations[iter]);
+  io_uring_free_probe (probe);
+
+  return retval;
+}
+
+RudgiosyncUring *
+rudgiosync_uring_new (GError **error)
+{
+  RudgiosyncUring *uring;
+  guint            iter;
+  int              ret;
+
+  uring = g_new0 (RudgiosyncUring, 1);
+  ret = io_uring_queue_init (URING_DEPTH, &(uring->ring), 0);
+  if (ret < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (-ret),
+                   "Failed to set up io_uring: %s", g_strerror (-ret));
+      g_free (uring);
+      return NULL;
+    }
+  if (!uring_supported (uring))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Failed to set up io_uring: %s", "The kernel lacks some of the operations needed");
+      io_uring_queue_exit (&(uring->ring));
+      g_free (uring);
+      return NULL;
+    }
+
+  uring->storage = rudgiosync_aligned_alloc (URING_DEPTH * URING_CHUNK_SIZE);
+  for (iter = 0; iter < URING_DEPTH; iter++)
+    {
+      uring->buffers[iter].iov_base = uring->storage + iter * URING_CHUNK_SIZE;
+      uring->buffers[iter].iov_len = URING_CHUNK_SIZE;
+    }
+
+  ret = io_uring_register_buffers (&(uring->ring), uring->buffers, URING_DEPTH);
+  if (ret < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (-ret),
+                   "Failed to register buffers with io_uring: %s", g_strerror (-ret));
+      rudgiosync_uring_free (uring);
+      return NULL;
+    }
+
+  return uring;
+}
+
+void
+rudgiosync_uring_free (RudgiosyncUring *uring)
+{
+  io_uring_queue_exit (&(uring->ring));
+  rudgiosync_aligned_free (uring->storage);
+  g_free (uring);
+}
+
+/* Every user keeps one operation per buffer in flight, so there's room. */
+static struct io_uring_sqe *
+uring_get_sqe (RudgiosyncUring *uring)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = io_uring_get_sqe (&(uring->ring));
+  if (sqe == NULL)
+    {
+      io_uring_submit (&(uring->ring));
+      sqe = io_uring_get_sqe (&(uring->ring));
+    }
+  g_assert (sqe != NULL);
+  uring->queued++;
+
+  return sqe;
+}
+
+/* Wait for an operation to complete, returning its result. */
+static gint
+uring_wait (RudgiosyncUring *uring, gpointer *data)
+{
+  struct io_uring_cqe *cqe;
+  gint                 retval;
+  int                  ret;
+
+  io_uring_submit (&(uring->ring));
+  while ((ret = io_uring_wait_cqe (&(uring->ring), &cqe)) == -EINTR);
+  if (ret < 0)
+    g_error ("Failed to wait for io_uring: %s", g_strerror (-ret));
+
+  *data = io_uring_cqe_get_data (cqe);
+  retval = cqe->res;
+  io_uring_cqe_seen (&(uring->ring), cqe);
+  uring->queued--;
+
+  return retval;
+}
+
+static void
+uring_set_error (GError **error, gint result, const gchar *format)
+{
+  if (error != NULL && *error == NULL)
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (-result), format, g_strerror (-result));
+}
+
+
+/* Copying. */
+
+static void
+uring_copy_read (RudgiosyncUring *uring, UringCopySlot *slot, int src_fd)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe (uring);
+
+  io_uring_prep_read_fixed (sqe, src_fd,
+                            uring->buffers[slot->index].iov_base, slot->wanted,
+                            slot->offset, slot->index);
+  io_uring_sqe_set_data (sqe, slot);
+  slot->writing = FALSE;
+}
+
+static void
+uring_copy_write (RudgiosyncUring *uring, UringCopySlot *slot, int dest_fd)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe (uring);
+
+  io_uring_prep_write_fixed (sqe, dest_fd,
+                             (gchar *)uring->buffers[slot->index].iov_base + slot->written,
+                             slot->length - slot->written,
+                             slot->offset + slot->written, slot->index);
+  io_uring_sqe_set_data (sqe, slot);
+  slot->writing = TRUE;
+}
+
+gboolean
+rudgiosync_uring_copy (RudgiosyncUring *uring, int dest_fd, int src_fd, GError **error)
+{
+  UringCopySlot  slots[URING_DEPTH];
+  UringCopySlot *slot;
+  guint64        next_offset = 0;
+  gboolean       at_end = FALSE;
+  gint           result;
+  guint          iter;
+
+  GError *ierror = NULL;
+
+
+  for (iter = 0; iter < URING_DEPTH; iter++, next_offset += URING_CHUNK_SIZE)
+    {
+      slots[iter].index = iter;
+      slots[iter].offset = next_offset;
+      slots[iter].wanted = URING_CHUNK_SIZE;
+      uring_copy_read (uring, &(slots[iter]), src_fd);
+    }
+
+  /**
+   * The size isn't known for sure until a read comes up empty, so chunks are
+   * read until one does.  Whatever is in flight is waited for after errors.
+   */
+  while (uring->queued > 0)
+    {
+      result = uring_wait (uring, (gpointer *)&slot);
+      if (ierror != NULL)
+        continue;
+
+      if (result < 0)
+        {
+          uring_set_error (&ierror, result, slot->writing ? "Error writing to file: %s" : "Error reading from file: %s");
+          continue;
+        }
+
+      if (!slot->writing)
+        {
+          if (result == 0)
+            {
+              at_end = TRUE;
+              continue;
+            }
+
+          slot->length = result;
+          slot->written = 0;
+          uring_copy_write (uring, slot, dest_fd);
+          continue;
+        }
+
+      slot->written += result;
+      if (slot->written < slot->length)
+        {
+          uring_copy_write (uring, slot, dest_fd);
+        }
+      else if (slot->length < slot->wanted)
+        {
+          /* A short read, the rest of the chunk is still to come. */
+          slot->offset += slot->length;
+          slot->wanted -= slot->length;
+          uring_copy_read (uring, slot, src_fd);
+        }
+      else if (!at_end)
+        {
+          slot->offset = next_offset;
+          slot->wanted = URING_CHUNK_SIZE;
+          next_offset += URING_CHUNK_SIZE;
+          uring_copy_read (uring, slot, src_fd);
+        }
+    }
+
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+/* Hashing. */
+
+#ifdef RUDGIOSYNC_CHECKSUM_ENABLED
+
+typedef struct
+{
+  guint                 index;
+  guint                 state;
+  guint                 file;      /* Index of the file being hashed. */
+  int                   fd;
+  guint64               offset;
+  RudgiosyncHashContext context;
+} UringHashSlot;
+
+static void
+uring_hash_open (RudgiosyncUring *uring, UringHashSlot *slot, gchar **paths, guint file)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe (uring);
+
+  slot->state = URING_HASH_OPENING;
+  slot->file = file;
+  io_uring_prep_openat (sqe, AT_FDCWD, paths[file], O_RDONLY | O_CLOEXEC, 0);
+  io_uring_sqe_set_data (sqe, slot);
+}
+
+static void
+uring_hash_read (RudgiosyncUring *uring, UringHashSlot *slot)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe (uring);
+
+  slot->state = URING_HASH_READING;
+  io_uring_prep_read_fixed (sqe, slot->fd,
+                            uring->buffers[slot->index].iov_base, URING_CHUNK_SIZE,
+                            slot->offset, slot->index);
+  io_uring_sqe_set_data (sqe, slot);
+}
+
+static void
+uring_hash_close (RudgiosyncUring *uring, UringHashSlot *slot)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe (uring);
+
+  rudgiosync_cache_drop_fd (slot->fd, FALSE);
+
+  slot->state = URING_HASH_CLOSING;
+  io_uring_prep_close (sqe, slot->fd);
+  io_uring_sqe_set_data (sqe, slot);
+}
+
+gboolean
+rudgiosync_uring_checksum (RudgiosyncUring *uring,
+                           gchar **paths,
+                           RudgiosyncChecksum **checksums,
+                           guint count,
+                           guint *failed,
+                           GError **error)
+{
+  UringHashSlot *slots;
+  UringHashSlot *slot;
+  guint          next_file = 0;
+  gint           result;
+  guint          iter;
+
+  GError *ierror = NULL;
+
+
+  slots = g_new0 (UringHashSlot, URING_DEPTH);
+  for (iter = 0; iter < URING_DEPTH && next_file < count; iter++)
+    {
+      slots[iter].index = iter;
+      uring_hash_open (uring, &(slots[iter]), paths, next_file++);
+    }
+
+  while (uring->queued > 0)
+    {
+      result = uring_wait (uring, (gpointer *)&slot);
+      switch (slot->state)
+        {
+          case URING_HASH_OPENING:
+            if (result < 0)
+              {
+                if (ierror == NULL)
+                  *failed = slot->file;
+                uring_set_error (&ierror, result, "Error opening file: %s");
+                slot->state = URING_HASH_IDLE;
+                break;
+              }
+
+            slot->fd = result;
+            slot->offset = 0;
+            rudgiosync_hash_init (&(slot->context));
+            if (ierror == NULL)
+              uring_hash_read (uring, slot);
+            else
+              uring_hash_close (uring, slot);
+            break;
+
+          case URING_HASH_READING:
+            if (result < 0)
+              {
+                if (ierror == NULL)
+                  *failed = slot->file;
+                uring_set_error (&ierror, result, "Error reading from file: %s");
+              }
+            else if (result == 0)
+              {
+                rudgiosync_hash_finish (&(slot->context), checksums[slot->file]);
+              }
+            else if (ierror == NULL)
+              {
+                rudgiosync_hash_data (&(slot->context), result, uring->buffers[slot->index].iov_base);
+                slot->offset += result;
+                uring_hash_read (uring, slot);
+                break;
+              }
+
+            uring_hash_close (uring, slot);
+            break;
+
+          case URING_HASH_CLOSING:
+            slot->state = URING_HASH_IDLE;
+            if (ierror == NULL && next_file < count)
+              uring_hash_open (uring, slot, paths, next_file++);
+            break;
+        }
+    }
+  g_free (slots);
+
+  if (ierror != NULL)
+    {
+      g_propagate_error (error, ierror);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+#endif /* RUDGIOSYNC_CHECKSUM_ENABLED */
+
+#endif /* RUDGIOSYNC_IO_URING_ENABLED */
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Transfers of local files through io_uring.
+ *
+ * Copies keep many chunks of a file in flight at once, and checksums are
+ * computed for many files at once, with their opening, reading and closing
+ * all queued in the same ring, using buffers registered with it.  GIO
+ * remains in use wherever io_uring isn't, and for everything else.
+ */
+
+#ifndef _RUDGIOSYNC_URING_H_
+#define _RUDGIOSYNC_URING_H_
+
+#include "boiler.h"
+#include "checksum.h"
+
+#ifdef RUDGIOSYNC_IO_URING_ENABLED
+
+typedef struct RudgiosyncUring_ RudgiosyncUring;
+
+/**
+ * Set up a ring, which is to be used by one thread at a time.  Fails if the
+ * kernel lacks io_uring or any of the operations needed.
+ */
+RudgiosyncUring *rudgiosync_uring_new (GError **error);
+
+void rudgiosync_uring_free (RudgiosyncUring *uring);
+
+/* Copy everything from one file to another, both written from their start. */
+gboolean rudgiosync_uring_copy (RudgiosyncUring *uring,
+                                int dest_fd,
+                                int src_fd,
+                                GError **error);
+
+#ifdef RUDGIOSYNC_CHECKSUM_ENABLED
+/**
+ * Produce checksums for a number of local files.  When one fails, its index
+ * is stored in `failed'.
+ */
+gboolean rudgiosync_uring_checksum (RudgiosyncUring *uring,
+                                    gchar **paths,
+                                    RudgiosyncChecksum **checksums,
+                                    guint count,
+                                    guint *failed,
+                                    GError **error);
+#endif /* RUDGIOSYNC_CHECKSUM_ENABLED */
+
+#endif /* RUDGIOSYNC_IO_URING_ENABLED */
+
+#endif /* _RUDGIOSYNC_URING_H_ */
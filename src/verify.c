@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "boiler.h"
+#include "verify.h"
+#include "operations.h"
+#include "buffers.h"
+#include "stats.h"
+#include "progress.h"
+
+#define VERIFY_THREADS  2   /* Reading back alongside the copies. */
+#define VERIFY_ATTEMPTS 3   /* Copies made before giving up, the first included. */
+
+
+typedef struct
+{
+  GFile              *destination;
+  GFile              *source;
+  RudgiosyncChecksum  checksum;
+  guint64             size;
+  guint64             modified_time;
+} VerifyJob;
+
+static gboolean     verify_enabled = FALSE;
+static GMutex       verify_lock;
+static GThreadPool *verify_pool = NULL;
+static GError      *verify_error = NULL;   /* The first failure in the background. */
+
+
+void
+rudgiosync_verify_set_enabled (gboolean enabled)
+{
+  verify_enabled = enabled;
+}
+
+gboolean
+rudgiosync_verify_enabled (void)
+{
+  return verify_enabled;
+}
+
+static void
+verify_print_recopy (GFile *destination)
+{
+  gchar *uri;
+
+  if (rudgiosync_progress_verbosity () < RUDGIOSYNC_VERBOSITY_NORMAL)
+    return;
+
+  uri = g_file_get_uri (destination);
+  g_print ("Copying `%s' again, it didn't read back as written.\n", uri);
+  g_free (uri);
+}
+
+gboolean
+rudgiosync_verify_file (GFile *destination,
+                        GFile *source,
+                        RudgiosyncChecksum *checksum,
+                        guint64 size,
+                        guint64 modified_time,
+                        GError **error)
+{
+  RudgiosyncChecksum expected = *checksum;
+  RudgiosyncChecksum actual;
+  gchar             *src_uri;
+  gchar             *dest_uri;
+  guint              attempt;
+
+  for (attempt = 1; ; attempt++)
+    {
+      rudgiosync_cache_evict (destination);
+      if (!rudgiosync_checksum_for_gfile (destination, &actual, error))
+        return FALSE;
+
+      if (!rudgiosync_checksums_differ (&expected, &actual))
+        break;
+
+      if (attempt == VERIFY_ATTEMPTS)
+        {
+          src_uri = g_file_get_uri (source);
+          dest_uri = g_file_get_uri (destination);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "The copy `%s' of `%s' still reads back differently after %u attempts",
+                       dest_uri, src_uri, attempt);
+          g_free (src_uri);
+          g_free (dest_uri);
+          return FALSE;
+        }
+
+      /* The source may have changed meanwhile, what's written next counts. */
+      verify_print_recopy (destination);
+      rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_RECOPIED, 1);
+      if (!rudgiosync_copy_file (destination, source, size, modified_time, &expected, error))
+        return FALSE;
+    }
+
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_FILES_VERIFIED, 1);
+  rudgiosync_stats_add (RUDGIOSYNC_STAT_BYTES_VERIFIED, size);
+  return TRUE;
+}
+
+static void
+verify_job (gpointer data, gpointer user_data)
+{
+  VerifyJob *job = data;
+
+  GError *ierror = NULL;
+
+
+  if (!rudgiosync_verify_file (job->destination, job->source, &(job->checksum),
+                               job->size, job->modified_time, &ierror))
+    {
+      g_mutex_lock (&verify_lock);
+      if (verify_error == NULL)
+        g_propagate_error (&verify_error, ierror);
+      else
+        g_error_free (ierror);
+      g_mutex_unlock (&verify_lock);
+    }
+
+  g_object_unref (job->destination);
+  g_object_unref (job->source);
+  g_slice_free (VerifyJob, job);
+}
+
+void
+rudgiosync_verify_queue (GFile *destination,
+                         GFile *source,
+                         RudgiosyncChecksum *checksum,
+                         guint64 size,
+                         guint64 modified_time)
+{
+  VerifyJob *job;
+
+  job = g_slice_new (VerifyJob);
+  job->destination = g_object_ref (destination);
+  job->source = g_object_ref (source);
+  job->checksum = *checksum;
+  job->size = size;
+  job->modified_time = modified_time;
+
+  g_mutex_lock (&verify_lock);
+  if (verify_pool == NULL)
+    verify_pool = g_thread_pool_new (verify_job, NULL, VERIFY_THREADS, FALSE, NULL);
+  g_thread_pool_push (verify_pool, job, NULL);
+  g_mutex_unlock (&verify_lock);
+}
+
+gboolean
+rudgiosync_verify_wait (GError **error)
+{
+  GThreadPool *pool;
+
+  g_mutex_lock (&verify_lock);
+  pool = verify_pool;
+  verify_pool = NULL;
+  g_mutex_unlock (&verify_lock);
+
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (verify_error != NULL)
+    {
+      g_propagate_error (error, verify_error);
+      verify_error = NULL;
+      return FALSE;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2018 Marek Benc <dusxmt@gmx.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * Verification of copies.
+ *
+ * When enabled, the data of every file copied is hashed on its way through,
+ * at no cost of reading it again.  Once the copy is complete, it's read back
+ * from the destination by a few threads of its own, alongside further copies,
+ * and compared with that checksum.  Copies which turn out different are made
+ * again, and checked again, up to a few times.
+ *
+ * Local destinations are flushed to disk and dropped from the page cache
+ * first, so that they're read back from the disk.
+ */
+
+#ifndef _RUDGIOSYNC_VERIFY_H_
+#define _RUDGIOSYNC_VERIFY_H_
+
+#include "boiler.h"
+#include "checksum.h"
+
+
+void rudgiosync_verify_set_enabled (gboolean enabled);
+
+gboolean rudgiosync_verify_enabled (void);
+
+/**
+ * Check a copy of the given size against the checksum of what was written,
+ * copying it again if it's different.  The copy keeps the given time of
+ * modification.
+ */
+gboolean rudgiosync_verify_file (GFile *destination,
+                                 GFile *source,
+                                 RudgiosyncChecksum *checksum,
+                                 guint64 size,
+                                 guint64 modified_time,
+                                 GError **error);
+
+/* Check a copy in the background, as above. */
+void rudgiosync_verify_queue (GFile *destination,
+                              GFile *source,
+                              RudgiosyncChecksum *checksum,
+                              guint64 size,
+                              guint64 modified_time);
+
+/* Wait for the copies queued to be checked, reporting the first failure. */
+gboolean rudgiosync_verify_wait (GError **error);
+
+
+#endif /* _RUDGIOSYNC_VERIFY_H_ */